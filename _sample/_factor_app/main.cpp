@@ -1,15 +1,423 @@
 #include <_test/IntegerMaths.hpp>
 
-#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // read/close
+
+namespace {
+
+/// Bytes of input per job, large enough that the handoff is negligible.
+constexpr std::size_t cChunkSize = std::size_t{1} << 20;
+
+/// Size of the stdout buffer, writes of whole jobs usually bypass it.
+constexpr std::size_t cOutputBuffer = std::size_t{1} << 20;
+
+/// Jobs in flight per thread. Output is written in input order so this
+/// bounds how far the threads can run ahead of the slowest job.
+constexpr std::size_t cJobsPerThread = 4;
+
+constexpr const char *cUsage =
+    "usage: _factor_app NUMBER\n"
+    "       _factor_app [--threads N] [--binary] [FILE...]\n"
+    "Prints the prime factors of NUMBER one per line, or factors the\n"
+    "whitespace separated numbers of each FILE (stdin for - or none) and\n"
+    "prints \"n: f1 f2 ...\" per number in input order.\n"
+    "  --threads N  worker threads, 0 for all cores (default)\n"
+    "  --binary     write native endian uint64_t values n, the number of\n"
+    "               factors, then the factors, for each number\n";
+
+/// Output of one job. A nonempty error ends the stream after the output.
+struct JobResult {
+  std::string output;
+  std::string error;
+};
+
+[[nodiscard]] bool isSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+/// Parses all of text as a number.
+/// \return true if text is a number that fits in 64 bits
+[[nodiscard]] bool parseNumber(std::string_view text, uint64_t &value) {
+  auto const [end, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  return ec == std::errc() && end == text.data() + text.size();
+}
+
+/// Appends a number to text output.
+void appendText(uint64_t value, std::string &out) {
+  char buffer[20];
+  auto const [end, ec] = std::to_chars(buffer, buffer + sizeof buffer, value);
+  out.append(buffer, end);
+}
+
+/// Appends a number to binary output.
+void appendBinary(uint64_t value, std::string &out) {
+  char buffer[sizeof value];
+  std::memcpy(buffer, &value, sizeof value);
+  out.append(buffer, sizeof buffer);
+}
+
+/// Appends a number and its prime factors as "n: f1 f2 ...\n", or in
+/// binary as n, the number of factors, then the factors.
+void appendFactors(uint64_t n, bool binary, std::string &out) {
+  _test::FactorList const factors = _test::primeFactors(n);
+  if (binary) {
+    appendBinary(n, out);
+    appendBinary(factors.size(), out);
+    for (uint64_t factor : factors) {
+      appendBinary(factor, out);
+    }
+    return;
+  }
+  appendText(n, out);
+  out += ':';
+  for (uint64_t factor : factors) {
+    out += ' ';
+    appendText(factor, out);
+  }
+  out += '\n';
+}
+
+/// Factors the whitespace separated numbers of text, stopping at the first
+/// token which is not a 64 bit number.
+JobResult factorText(std::string_view text, bool binary) {
+  JobResult result;
+  result.output.reserve(text.size() * 2);
+  const char *p = text.data();
+  const char *const end = p + text.size();
+  while (true) {
+    p = std::find_if_not(p, end, isSpace);
+    if (p == end) {
+      break;
+    }
+    const char *const tokenEnd = std::find_if(p, end, isSpace);
+    uint64_t n = 0;
+    if (!parseNumber(std::string_view(p, tokenEnd), n)) {
+      result.error = "invalid number: " + std::string(p, tokenEnd);
+      break;
+    }
+    appendFactors(n, binary, result.output);
+    p = tokenEnd;
+  }
+  return result;
+}
+
+/// Fixed set of threads running tasks in submission order.
+class ThreadPool {
+private:
+  std::mutex mMutex;
+  std::condition_variable mReady;
+  std::deque<std::packaged_task<JobResult()>> mTasks;
+  bool mStop = false;
+  std::vector<std::jthread> mThreads; // last so it joins first
+
+  void work() {
+    while (true) {
+      std::packaged_task<JobResult()> task;
+      {
+        std::unique_lock lock(mMutex);
+        mReady.wait(lock, [this]() { return mStop || !mTasks.empty(); });
+        if (mTasks.empty()) {
+          return;
+        }
+        task = std::move(mTasks.front());
+        mTasks.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  explicit ThreadPool(std::size_t threads) {
+    for (std::size_t i = 0; i < threads; ++i) {
+      mThreads.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mMutex);
+      mStop = true;
+    }
+    mReady.notify_all();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /// \return future result of the job
+  std::future<JobResult> submit(std::function<JobResult()> job) {
+    std::packaged_task<JobResult()> task(std::move(job));
+    std::future<JobResult> result = task.get_future();
+    {
+      std::lock_guard lock(mMutex);
+      mTasks.push_back(std::move(task));
+    }
+    mReady.notify_one();
+    return result;
+  }
+};
+
+/// Runs jobs on a pool and writes their output in submission order, with a
+/// bounded number of jobs in flight. Stops writing after a job fails.
+class OrderedWriter {
+private:
+  ThreadPool &mPool;
+  std::size_t mWindow;
+  std::FILE *mOut;
+  std::deque<std::future<JobResult>> mPending;
+  bool mFailed = false;
+
+  void writeFront() {
+    JobResult const result = mPending.front().get();
+    mPending.pop_front();
+    if (mFailed) {
+      return;
+    }
+    std::fwrite(result.output.data(), 1, result.output.size(), mOut);
+    if (!result.error.empty()) {
+      std::fflush(mOut);
+      std::fprintf(stderr, "_factor_app: %s\n", result.error.c_str());
+      mFailed = true;
+    }
+  }
+
+public:
+  OrderedWriter(ThreadPool &pool, std::size_t window, std::FILE *out)
+      : mPool(pool), mWindow(window), mOut(out) {}
+
+  /// Queues a job, first writing the oldest one if the window is full.
+  /// \return false if a job has failed
+  bool submit(std::function<JobResult()> job) {
+    if (mPending.size() >= mWindow) {
+      writeFront();
+    }
+    if (!mFailed) {
+      mPending.push_back(mPool.submit(std::move(job)));
+    }
+    return !mFailed;
+  }
+
+  /// Waits for and writes every queued job.
+  /// \return false if a job has failed
+  bool drain() {
+    while (!mPending.empty()) {
+      writeFront();
+    }
+    return !mFailed;
+  }
+
+  /// Writes every queued job and flushes the output.
+  /// \return false if a job failed or writing failed
+  bool finish() {
+    drain();
+    if (std::fflush(mOut) != 0 || std::ferror(mOut)) {
+      std::fprintf(stderr, "_factor_app: writing output failed\n");
+      mFailed = true;
+    }
+    return !mFailed;
+  }
+};
+
+/// Read-only memory map of a whole file.
+class MappedFile {
+private:
+  void *mData = MAP_FAILED;
+  std::size_t mSize = 0;
+
+public:
+  /// Maps the file, check valid() for success. Fails for pipes and similar
+  /// files which cannot be mapped.
+  explicit MappedFile(int fd) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+      return;
+    }
+    mSize = static_cast<std::size_t>(info.st_size);
+    mData = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mData != MAP_FAILED) {
+      madvise(mData, mSize, MADV_SEQUENTIAL);
+    }
+  }
+
+  ~MappedFile() {
+    if (mData != MAP_FAILED) {
+      munmap(mData, mSize);
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  [[nodiscard]] bool valid() const { return mData != MAP_FAILED; }
+
+  [[nodiscard]] std::string_view text() const {
+    return std::string_view(static_cast<const char *>(mData), mSize);
+  }
+};
+
+/// Splits mapped text into chunks ending at whitespace and queues them. The
+/// jobs are drained before returning since they view the mapping.
+bool factorMapped(std::string_view text, bool binary, OrderedWriter &writer) {
+  std::size_t start = 0;
+  while (start < text.size()) {
+    std::size_t end = std::min(start + cChunkSize, text.size());
+    while (end < text.size() && !isSpace(text[end])) {
+      ++end;
+    }
+    std::string_view const chunk = text.substr(start, end - start);
+    if (!writer.submit(
+            [chunk, binary]() { return factorText(chunk, binary); })) {
+      break;
+    }
+    start = end;
+  }
+  return writer.drain();
+}
+
+/// Reads fd in blocks, carrying a partial number over to the next block,
+/// and queues each block as a job owning its text.
+bool factorStream(int fd, const char *name, bool binary,
+                  OrderedWriter &writer) {
+  std::string carry;
+  while (true) {
+    std::string block = std::move(carry);
+    std::size_t const used = block.size();
+    block.resize(used + cChunkSize);
+    ssize_t count;
+    do {
+      count = read(fd, block.data() + used, cChunkSize);
+    } while (count < 0 && errno == EINTR);
+    if (count < 0) {
+      std::fprintf(stderr, "_factor_app: reading %s failed: %s\n", name,
+                   std::strerror(errno));
+      writer.drain();
+      return false;
+    }
+    block.resize(used + static_cast<std::size_t>(count));
+    if (count > 0) {
+      // hand over up to the last whitespace, the rest may continue
+      auto const split =
+          std::find_if(block.rbegin(), block.rend(), isSpace).base();
+      carry.assign(split, block.end());
+      block.erase(split, block.end());
+    }
+    bool const more = count > 0;
+    if (!block.empty() &&
+        !writer.submit([text = std::move(block), binary]() {
+          return factorText(text, binary);
+        })) {
+      return false;
+    }
+    if (!more) {
+      return true;
+    }
+  }
+}
+
+/// Factors the numbers of a file, or stdin for "-", mapping regular files
+/// and reading anything else as a stream.
+bool factorFile(const std::string &path, bool binary, OrderedWriter &writer) {
+  if (path == "-") {
+    return factorStream(STDIN_FILENO, "stdin", binary, writer);
+  }
+  int const fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::fprintf(stderr, "_factor_app: cannot open %s: %s\n", path.c_str(),
+                 std::strerror(errno));
+    return false;
+  }
+  bool result;
+  {
+    MappedFile const mapped(fd);
+    result = mapped.valid() ? factorMapped(mapped.text(), binary, writer)
+                            : factorStream(fd, path.c_str(), binary, writer);
+  }
+  close(fd);
+  return result;
+}
+
+/// Prints the prime factors of one number, one per line.
+int factorOne(uint64_t n) {
+  std::string out;
+  for (uint64_t factor : _test::primeFactors(n)) {
+    appendText(factor, out);
+    out += '\n';
+  }
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  return std::fflush(stdout) == 0 ? 0 : 1;
+}
+
+} // namespace
 
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cout << "need 1 argument" << std::endl;
-    return 1;
+  std::vector<std::string> const args(argv + 1, argv + argc);
+  uint64_t number = 0;
+  if (args.size() == 1 && parseNumber(args[0], number)) {
+    return factorOne(number);
+  }
+  std::size_t threads = 0;
+  bool binary = false;
+  std::vector<std::string> paths;
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--help") {
+      std::fputs(cUsage, stdout);
+      return 0;
+    } else if (args[i] == "--binary") {
+      binary = true;
+    } else if (args[i] == "--threads") {
+      uint64_t value = 0;
+      if (i + 1 == args.size() || !parseNumber(args[i + 1], value)) {
+        std::fputs(cUsage, stderr);
+        return 1;
+      }
+      threads = static_cast<std::size_t>(value);
+      ++i;
+    } else if (args[i] != "-" && args[i].starts_with("-")) {
+      std::fprintf(stderr, "_factor_app: unknown option %s\n",
+                   args[i].c_str());
+      std::fputs(cUsage, stderr);
+      return 1;
+    } else {
+      paths.push_back(args[i]);
+    }
+  }
+  if (paths.empty()) {
+    paths.push_back("-");
+  }
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
   }
-  auto factors = _test::primeFactorization(std::atoll(argv[1]));
-  for (auto factor : factors) {
-    std::cout << factor << std::endl;
+  std::setvbuf(stdout, nullptr, _IOFBF, cOutputBuffer);
+  ThreadPool pool(threads);
+  OrderedWriter writer(pool, threads * cJobsPerThread, stdout);
+  bool ok = true;
+  for (const std::string &path : paths) {
+    if (!factorFile(path, binary, writer)) {
+      ok = false;
+      break;
+    }
   }
-  return 0;
+  return writer.finish() && ok ? 0 : 1;
 }
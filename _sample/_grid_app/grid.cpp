@@ -1,35 +1,69 @@
+#include <_test/MappedGrid.hpp>
 #include <_test/Vector2d.hpp>
+#include <_test/Vector2dAlgorithms.hpp>
 
+#include <exception>
 #include <format>
 #include <iostream>
+#include <string>
 
-int main(int argc, char **argv) {
-  if (argc != 2 && argc != 3) {
-    std::cout << "requires a grid size as 1 or 2 integers" << std::endl;
-    return 1;
+namespace {
+
+/// Element at a 2d index of the generated grid
+double element(std::size_t i, std::size_t j) {
+  return 1.0 / static_cast<double>(i + j + 1);
+}
+
+/// Prints the sum of a grid
+template <_test::Grid2d G> void printSum(const G &grid) {
+  double const s =
+      _test::sum(grid, _test::Summation::PAIRWISE, _test::cParallel);
+  std::cout << std::format("sum  = {}", s) << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) try {
+  std::string const mode = argc > 1 ? argv[1] : "";
+  if (mode == "--load" && argc == 3) {
+    // pages are read from the file as they are summed, nothing is parsed
+    printSum(_test::MappedGrid<const double>::open(argv[2]));
+    return 0;
   }
-  _test::Basic2dVector<double> grid;
-  if (argc == 2) {
-    grid = _test::Basic2dVector<double>(std::atoi(argv[1]), std::atoi(argv[1]));
-  } else {
-    grid = _test::Basic2dVector<double>(std::atoi(argv[1]), std::atoi(argv[2]));
+  bool const save = mode == "--save";
+  int const first = save ? 3 : 1;
+  if (argc - first != 1 && argc - first != 2) {
+    std::cout << "requires a grid size as 1 or 2 integers, optionally after "
+                 "--save FILE, or --load FILE"
+              << std::endl;
+    return 1;
   }
-  for (std::size_t i = 0; i < grid.rows(); ++i) {
-    for (std::size_t j = 0; j < grid.cols(); ++j) {
-      grid[i, j] = 1.0 / static_cast<double>(i + j + 1);
-      if (j > 0) {
-        std::cout << " ";
-      }
-      std::cout << grid[i, j];
-    }
-    std::cout << std::endl;
+  auto const rows = static_cast<std::size_t>(std::atoi(argv[first]));
+  auto const cols = argc - first == 1
+                        ? rows
+                        : static_cast<std::size_t>(std::atoi(argv[first + 1]));
+  if (save) {
+    // generated straight into the file, so it may be larger than memory
+    auto grid = _test::MappedGrid<double>::create(argv[2], rows, cols);
+    _test::generate(grid, element, _test::cParallel);
+    grid.flush();
+    printSum(grid);
+    return 0;
   }
-  double s = 0.0;
+  // every element is generated, so skip filling it first
+  _test::Basic2dVector<double> grid(rows, cols, _test::cDefaultInit);
+  _test::generate(grid, element, _test::cParallel);
   for (std::size_t i = 0; i < grid.rows(); ++i) {
-    for (std::size_t j = 0; j < grid.cols(); ++j) {
-      s += grid.at(i, j);
+    const char *separator = "";
+    for (double x : grid.row(i)) {
+      std::cout << separator << x;
+      separator = " ";
     }
+    std::cout << '\n';
   }
-  std::cout << std::format("sum  = {}", s) << std::endl;
+  printSum(grid);
   return 0;
+} catch (const std::exception &e) {
+  std::cout << e.what() << std::endl;
+  return 1;
 }
@@ -1,11 +1,504 @@
 #pragma once
 
+#include <_test/PrimeTables.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <numeric>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
 namespace _test {
 
+/// \brief Prime factors of many numbers in one flat buffer. The factors of
+/// the ith number, smallest to largest with multiplicity, are
+/// factors()[offsets()[i]] up to but not including factors()[offsets()[i+1]].
+class FactorTable {
+private:
+  std::vector<std::size_t> mOffsets{0};
+  std::vector<uint64_t> mFactors;
+
+public:
+  /// Constructs as empty
+  FactorTable() = default;
+
+  /// Constructs from the flat buffers
+  /// \param offsets start of each number's factors, followed by the end
+  /// \param factors factors of all numbers
+  FactorTable(std::vector<std::size_t> offsets, std::vector<uint64_t> factors)
+      : mOffsets(std::move(offsets)), mFactors(std::move(factors)) {}
+
+  /// \return number of numbers
+  [[nodiscard]] std::size_t size() const { return mOffsets.size() - 1; }
+
+  /// \return prime factors of the ith number
+  [[nodiscard]] std::span<const uint64_t> operator[](std::size_t i) const {
+    return std::span<const uint64_t>(mFactors)
+        .subspan(mOffsets[i], mOffsets[i + 1] - mOffsets[i]);
+  }
+
+  /// \return start of each number's factors, followed by the end
+  [[nodiscard]] const std::vector<std::size_t> &offsets() const {
+    return mOffsets;
+  }
+
+  /// \return factors of all numbers
+  [[nodiscard]] const std::vector<uint64_t> &factors() const {
+    return mFactors;
+  }
+};
+
+/// \brief Prime factors of one number smallest to largest, with a fixed
+/// capacity since a uint64_t has at most 64 prime factors counting
+/// multiplicity. Usable in constant expressions.
+class FactorList {
+private:
+  std::array<uint64_t, 64> mData{};
+  std::size_t mSize = 0;
+
+public:
+  /// Constructs as empty
+  constexpr FactorList() = default;
+
+  /// Constructs from factors
+  constexpr FactorList(std::initializer_list<uint64_t> factors) {
+    for (uint64_t factor : factors) {
+      push_back(factor);
+    }
+  }
+
+  /// Appends a factor, there must be room for it
+  constexpr void push_back(uint64_t factor) { mData[mSize++] = factor; }
+
+  /// \return number of factors
+  [[nodiscard]] constexpr std::size_t size() const { return mSize; }
+
+  /// \return true if there are no factors
+  [[nodiscard]] constexpr bool empty() const { return mSize == 0; }
+
+  /// \return the ith factor
+  [[nodiscard]] constexpr uint64_t operator[](std::size_t i) const {
+    return mData[i];
+  }
+
+  [[nodiscard]] constexpr uint64_t *begin() { return mData.data(); }
+  [[nodiscard]] constexpr uint64_t *end() { return mData.data() + mSize; }
+  [[nodiscard]] constexpr const uint64_t *begin() const {
+    return mData.data();
+  }
+  [[nodiscard]] constexpr const uint64_t *end() const {
+    return mData.data() + mSize;
+  }
+
+  [[nodiscard]] constexpr bool operator==(const FactorList &other) const {
+    return std::equal(begin(), end(), other.begin(), other.end());
+  }
+};
+
+/// \brief A prime and its exponent in a factorization.
+struct PrimePower {
+  uint64_t mPrime = 0;
+  uint32_t mExponent = 0;
+};
+
+/// \brief Factorization as powers of distinct primes, smallest first. A
+/// uint64_t has at most 15 distinct prime factors.
+struct PrimePowers {
+  std::array<PrimePower, 15> mData{};
+  std::size_t mSize = 0;
+};
+
+/// Most divisors of any uint64_t (897612484786617600 has this many).
+inline constexpr std::size_t cMaxDivisors = 103680;
+
+/// \brief Lazy range of the divisors of a number, made by divisors(). The
+/// divisors are visited as an odometer over the prime exponents.
+class DivisorView : public std::ranges::view_interface<DivisorView> {
+private:
+  PrimePowers mPowers;
+  std::array<uint64_t, 15> mFullPowers{};
+  bool mZero = false;
+
+public:
+  /// \brief Visits divisors by counting up the exponents, the smallest prime
+  /// changing fastest.
+  class Iterator {
+  private:
+    const DivisorView *mView = nullptr;
+    std::array<uint32_t, 15> mExponents{};
+    uint64_t mValue = 0; // 0 after the last divisor
+
+  public:
+    using value_type = uint64_t;
+    using difference_type = std::ptrdiff_t;
+
+    constexpr Iterator() = default;
+    constexpr explicit Iterator(const DivisorView *view)
+        : mView(view), mValue(view->mZero ? 0 : 1) {}
+
+    [[nodiscard]] constexpr uint64_t operator*() const { return mValue; }
+
+    constexpr Iterator &operator++() {
+      const PrimePowers &powers = mView->mPowers;
+      for (std::size_t i = 0; i < powers.mSize; ++i) {
+        if (mExponents[i] < powers.mData[i].mExponent) {
+          ++mExponents[i];
+          mValue *= powers.mData[i].mPrime;
+          return *this;
+        }
+        mExponents[i] = 0;
+        mValue /= mView->mFullPowers[i];
+      }
+      mValue = 0;
+      return *this;
+    }
+
+    constexpr Iterator operator++(int) {
+      Iterator previous = *this;
+      ++*this;
+      return previous;
+    }
+
+    [[nodiscard]] constexpr bool operator==(const Iterator &other) const {
+      return mValue == other.mValue && mExponents == other.mExponents;
+    }
+
+    [[nodiscard]] constexpr bool operator==(std::default_sentinel_t) const {
+      return mValue == 0;
+    }
+  };
+
+  constexpr DivisorView() = default;
+  constexpr explicit DivisorView(uint64_t n);
+
+  [[nodiscard]] constexpr Iterator begin() const { return Iterator(this); }
+  [[nodiscard]] constexpr std::default_sentinel_t end() const { return {}; }
+};
+
+static_assert(std::ranges::view<DivisorView> &&
+              std::ranges::forward_range<DivisorView>);
+
+namespace detail {
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+/// Modular arithmetic for an odd modulus in Montgomery form, where a value
+/// x is stored as x * 2^64 mod n so products reduce without division.
+class Montgomery {
+private:
+  uint64_t mN;
+  uint64_t mNInv;
+  uint64_t mR2;
+  uint64_t mOne;
+
+public:
+  /// \param n odd modulus greater than 1
+  constexpr explicit Montgomery(uint64_t n) : mN(n), mNInv(n) {
+    // Newton iteration doubles the correct low bits, n * n = 1 mod 8
+    for (int i = 0; i < 5; ++i) {
+      mNInv *= 2 - n * mNInv;
+    }
+    uint64_t const r = static_cast<uint64_t>((uint128_t{1} << 64) % n);
+    mR2 = static_cast<uint64_t>(uint128_t{r} * r % n);
+    mOne = r;
+  }
+
+  /// \return x * 2^-64 mod n for x < n * 2^64
+  [[nodiscard]] constexpr uint64_t reduce(uint128_t x) const {
+    uint64_t const m = static_cast<uint64_t>(x) * mNInv;
+    uint64_t const high = static_cast<uint64_t>(x >> 64);
+    uint64_t const mn = static_cast<uint64_t>((uint128_t{m} * mN) >> 64);
+    return high >= mn ? high - mn : high - mn + mN;
+  }
+
+  /// \return a in Montgomery form
+  [[nodiscard]] constexpr uint64_t toMontgomery(uint64_t a) const {
+    return reduce(uint128_t{a % mN} * mR2);
+  }
+
+  /// \return a * b mod n for a, b in Montgomery form
+  [[nodiscard]] constexpr uint64_t mul(uint64_t a, uint64_t b) const {
+    return reduce(uint128_t{a} * b);
+  }
+
+  /// \return a + b mod n for a, b < n
+  [[nodiscard]] constexpr uint64_t add(uint64_t a, uint64_t b) const {
+    uint64_t const sum = a + b;
+    return sum < a || sum >= mN ? sum - mN : sum;
+  }
+
+  /// \return a^e mod n for a in Montgomery form
+  [[nodiscard]] constexpr uint64_t pow(uint64_t a, uint64_t e) const {
+    uint64_t result = mOne;
+    for (; e != 0; e >>= 1) {
+      if (e & 1) {
+        result = mul(result, a);
+      }
+      a = mul(a, a);
+    }
+    return result;
+  }
+
+  /// \return 1 in Montgomery form
+  [[nodiscard]] constexpr uint64_t one() const { return mOne; }
+};
+
+/// Primes used for trial division before Miller-Rabin.
+inline constexpr uint64_t cSmallPrimes[] = {2,  3,  5,  7,  11, 13,
+                                            17, 19, 23, 29, 31, 37};
+
+/// Miller-Rabin bases which give the correct answer for every n < 2^64.
+inline constexpr uint64_t cWitnesses[] = {2,      325,     9375,
+                                          28178,  450775,  9780504,
+                                          1795265022};
+
+/// Trial division stops at this divisor, larger factors are found with
+/// Pollard-rho.
+inline constexpr uint64_t cTrialLimit = 1024;
+
+/// Deterministic Miller-Rabin test for an odd n > 37.
+constexpr bool millerRabin(uint64_t n) {
+  Montgomery const mont(n);
+  uint64_t const one = mont.one();
+  uint64_t const minusOne = n - one;
+  int const s = std::countr_zero(n - 1);
+  uint64_t const d = (n - 1) >> s;
+  for (uint64_t witness : cWitnesses) {
+    uint64_t const a = mont.toMontgomery(witness);
+    if (a == 0) {
+      continue;
+    }
+    uint64_t x = mont.pow(a, d);
+    if (x == one || x == minusOne) {
+      continue;
+    }
+    bool composite = true;
+    for (int i = 1; i < s && composite; ++i) {
+      x = mont.mul(x, x);
+      composite = x != minusOne;
+    }
+    if (composite) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Finds a nontrivial factor of an odd composite n with Brent's variant of
+/// Pollard-rho. Differences are multiplied together and the gcd is taken
+/// once per batch, backtracking when a batch overshoots to n.
+constexpr uint64_t pollardBrent(uint64_t n) {
+  constexpr uint64_t cBatch = 128;
+  Montgomery const mont(n);
+  auto const diff = [](uint64_t a, uint64_t b) {
+    return a > b ? a - b : b - a;
+  };
+  for (uint64_t c = 1;; ++c) {
+    auto const f = [&](uint64_t y) { return mont.add(mont.mul(y, y), c); };
+    uint64_t y = mont.toMontgomery(c + 1);
+    uint64_t x = y;
+    uint64_t ys = y;
+    uint64_t q = mont.one();
+    uint64_t g = 1;
+    for (uint64_t r = 1; g == 1; r <<= 1) {
+      x = y;
+      for (uint64_t i = 0; i < r; ++i) {
+        y = f(y);
+      }
+      for (uint64_t k = 0; k < r && g == 1; k += cBatch) {
+        ys = y;
+        for (uint64_t i = 0; i < std::min(cBatch, r - k); ++i) {
+          y = f(y);
+          q = mont.mul(q, diff(x, y));
+        }
+        g = std::gcd(q, n);
+      }
+    }
+    if (g == n) {
+      do {
+        ys = f(ys);
+        g = std::gcd(diff(x, ys), n);
+      } while (g == 1);
+    }
+    if (g != n) {
+      return g;
+    }
+  }
+}
+
+/// Appends the prime factors of n, which has no factors below cTrialLimit,
+/// in no particular order.
+template <typename Factors>
+constexpr void factorLarge(uint64_t n, Factors &result) {
+  if (n == 1) {
+    return;
+  }
+  if (n < cTrialLimit * cTrialLimit || millerRabin(n)) {
+    result.push_back(n);
+    return;
+  }
+  uint64_t const d = pollardBrent(n);
+  factorLarge(d, result);
+  factorLarge(n / d, result);
+}
+
+/// Appends the prime factors of n smallest to largest.
+/// \tparam Factors std::vector, FactorList or another container with
+/// push_back
+template <typename Factors>
+constexpr void factorAppend(uint64_t n, Factors &result) {
+  if (n < 2) {
+    return;
+  }
+  for (uint64_t p : TrialWheel::cPrimes) {
+    while (n % p == 0) {
+      n /= p;
+      result.push_back(p);
+    }
+  }
+  uint64_t d = TrialWheel::cStart;
+  std::size_t gap = 0;
+  while (d < cTrialLimit && d * d <= n) {
+    while (n % d == 0) {
+      n /= d;
+      result.push_back(d);
+    }
+    d += TrialWheel::cGaps[gap];
+    gap = (gap + 1) % TrialWheel::cGaps.size();
+  }
+  if (d * d > n) {
+    // no factor up to sqrt(n), so n is 1 or prime
+    if (n != 1) {
+      result.push_back(n);
+    }
+    return;
+  }
+  std::size_t const smallCount = result.size();
+  factorLarge(n, result);
+  std::sort(result.begin() + static_cast<std::ptrdiff_t>(smallCount),
+            result.end());
+}
+
+} // namespace detail
+
+/// Tests if a number is prime, exactly for the full 64 bit range.
+/// \param n number to test
+/// \return true if n is prime
+constexpr bool isPrime(uint64_t n) {
+  for (uint64_t p : detail::cSmallPrimes) {
+    if (n % p == 0) {
+      return n == p;
+    }
+  }
+  if (n < 37 * 37) {
+    return n > 1;
+  }
+  return detail::millerRabin(n);
+}
+
+/// Finds prime factors of a number without allocating, also at compile
+/// time (see primeFactorization).
+/// \param n number to factor
+/// \return prime factors smallest to largest counting multiplicity
+constexpr FactorList primeFactors(uint64_t n) {
+  FactorList result;
+  detail::factorAppend(n, result);
+  return result;
+}
+
+/// Groups the prime factors of n into powers of distinct primes.
+/// \param n number to factor
+/// \return prime powers of n, smallest prime first, none for n < 2
+constexpr PrimePowers primePowers(uint64_t n) {
+  FactorList const factors = primeFactors(n);
+  PrimePowers powers;
+  for (uint64_t factor : factors) {
+    if (powers.mSize == 0 || powers.mData[powers.mSize - 1].mPrime != factor) {
+      powers.mData[powers.mSize++] = PrimePower{factor, 0};
+    }
+    ++powers.mData[powers.mSize - 1].mExponent;
+  }
+  return powers;
+}
+
+/// Counts the positive divisors from the exponents of the factorization.
+/// \param n number to count divisors of
+/// \return number of divisors, 0 for n = 0
+constexpr uint64_t divisorCount(uint64_t n) {
+  if (n == 0) {
+    return 0;
+  }
+  PrimePowers const powers = primePowers(n);
+  uint64_t count = 1;
+  for (std::size_t i = 0; i < powers.mSize; ++i) {
+    count *= powers.mData[i].mExponent + 1;
+  }
+  return count;
+}
+
+/// Sums the positive divisors as the product over prime powers p^e of
+/// 1 + p + ... + p^e.
+/// \param n number to sum divisors of
+/// \return sum of divisors, 0 for n = 0
+/// \throw std::overflow_error if the sum does not fit in 64 bits
+constexpr uint64_t divisorSum(uint64_t n) {
+  if (n == 0) {
+    return 0;
+  }
+  PrimePowers const powers = primePowers(n);
+  detail::uint128_t sum = 1;
+  for (std::size_t i = 0; i < powers.mSize; ++i) {
+    // 1 + p + ... + p^e <= 2 p^e <= 2n fits
+    detail::uint128_t term = 1;
+    detail::uint128_t power = 1;
+    for (uint32_t e = 0; e < powers.mData[i].mExponent; ++e) {
+      power *= powers.mData[i].mPrime;
+      term += power;
+    }
+    if (term > UINT64_MAX) {
+      throw std::overflow_error("divisorSum: result exceeds 64 bits");
+    }
+    // both at most 2^64 - 1 so the product fits in 128 bits
+    sum *= term;
+    if (sum > UINT64_MAX) {
+      throw std::overflow_error("divisorSum: result exceeds 64 bits");
+    }
+  }
+  return static_cast<uint64_t>(sum);
+}
+
+/// Iterates over the divisors of n (see divisors()).
+constexpr DivisorView::DivisorView(uint64_t n)
+    : mPowers(primePowers(n)), mZero(n == 0) {
+  for (std::size_t i = 0; i < mPowers.mSize; ++i) {
+    uint64_t power = 1;
+    for (uint32_t e = 0; e < mPowers.mData[i].mExponent; ++e) {
+      power *= mPowers.mData[i].mPrime;
+    }
+    mFullPowers[i] = power;
+  }
+}
+
+/// Lazily lists the divisors of n without allocating. They come in odometer
+/// order of the exponents, the exponent of the smallest prime changing
+/// fastest, so they are not sorted (use listDivisors for that).
+/// \param n number to list divisors of, 0 has none
+/// \return view of the positive divisors
+constexpr DivisorView divisors(uint64_t n) { return DivisorView(n); }
+
 std::vector<uint64_t> primeFactorization(uint64_t n);
+FactorTable factorRange(uint64_t lo, uint64_t hi, std::size_t threads = 0);
+FactorTable factorBatch(std::span<const uint64_t> values,
+                        std::size_t threads = 0);
+std::size_t listDivisorsInto(uint64_t n, std::span<uint64_t> out);
 std::vector<uint64_t> listDivisors(uint64_t n);
 
 } // namespace _test
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace _test {
+
+namespace detail {
+
+/// Sieve of odd numbers below 2^16 at compile time, entry i is true when
+/// 2i + 1 is composite.
+template <std::size_t cLimit> consteval auto oddCompositeSieve() {
+  static_assert(cLimit <= std::size_t{1} << 16, "prime table is too large");
+  std::array<bool, cLimit / 2> composite{};
+  composite[0] = true; // 1
+  for (std::size_t i = 3; i * i < cLimit; i += 2) {
+    if (!composite[i / 2]) {
+      for (std::size_t j = i * i; j < cLimit; j += 2 * i) {
+        composite[j / 2] = true;
+      }
+    }
+  }
+  return composite;
+}
+
+/// Sieve computed once per limit and shared by the count and the table.
+template <std::size_t cLimit>
+inline constexpr auto cOddComposite = oddCompositeSieve<cLimit>();
+
+/// \return number of primes in a sieve of odd numbers, plus 2
+template <std::size_t N>
+consteval std::size_t countPrimes(const std::array<bool, N> &composite) {
+  std::size_t count = 1;
+  for (bool isComposite : composite) {
+    count += isComposite ? 0 : 1;
+  }
+  return count;
+}
+
+/// \tparam cLimit table end, even and at most 2^16
+/// \return primes below cLimit in increasing order
+template <std::size_t cLimit> consteval auto makePrimeTable() {
+  const auto &composite = cOddComposite<cLimit>;
+  std::array<uint32_t, countPrimes(cOddComposite<cLimit>)> primes{2};
+  std::size_t count = 1;
+  for (std::size_t i = 1; i < composite.size(); ++i) {
+    if (!composite[i]) {
+      primes[count++] = static_cast<uint32_t>(2 * i + 1);
+    }
+  }
+  return primes;
+}
+
+/// \brief Wheel for trial division skipping multiples of the given primes.
+/// Starting from cStart, adding the gaps in cycle visits every number
+/// coprime to cModulus.
+template <uint64_t... cPrimesT> struct Wheel {
+  static constexpr std::array<uint64_t, sizeof...(cPrimesT)> cPrimes{
+      cPrimesT...};
+  static constexpr uint64_t cModulus = (cPrimesT * ...);
+
+  [[nodiscard]] static constexpr bool coprime(uint64_t x) {
+    return ((x % cPrimesT != 0) && ...);
+  }
+
+  /// Smallest number above 1 coprime to the modulus, the next prime.
+  static constexpr uint64_t cStart = []() {
+    uint64_t x = 2;
+    while (!coprime(x)) {
+      ++x;
+    }
+    return x;
+  }();
+
+  static constexpr std::array<uint8_t, ((cPrimesT - 1) * ...)> cGaps = []() {
+    std::array<uint8_t, ((cPrimesT - 1) * ...)> gaps{};
+    std::size_t count = 0;
+    uint64_t previous = cStart;
+    for (uint64_t x = cStart + 1; x <= cStart + cModulus; ++x) {
+      if (coprime(x)) {
+        gaps[count++] = static_cast<uint8_t>(x - previous);
+        previous = x;
+      }
+    }
+    return gaps;
+  }();
+};
+
+} // namespace detail
+
+/// Largest supported end of cPrimesBelow.
+inline constexpr uint64_t cPrimeTableLimit = uint64_t{1} << 16;
+
+/// Primes below cLimit made at compile time and stored in the binary. A
+/// table is only computed where it is used, since a large one takes the
+/// compiler a moment.
+template <std::size_t cLimit = cPrimeTableLimit>
+inline constexpr auto cPrimesBelow = detail::makePrimeTable<cLimit>();
+
+/// Wheel modulo 210 used for trial division.
+using TrialWheel = detail::Wheel<2, 3, 5, 7>;
+
+static_assert(TrialWheel::cStart == 11 && TrialWheel::cGaps.size() == 48);
+static_assert([]() {
+  uint64_t sum = 0;
+  for (uint8_t gap : TrialWheel::cGaps) {
+    sum += gap;
+  }
+  return sum == TrialWheel::cModulus;
+}());
+
+} // namespace _test
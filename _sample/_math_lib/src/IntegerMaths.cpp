@@ -1,55 +1,293 @@
 #include <_test/IntegerMaths.hpp>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
 namespace _test {
 
+namespace {
+
+/// Numbers per segment of factorRange, the remaining cofactors fit in L2.
+constexpr uint64_t cSegmentSize = uint64_t{1} << 15;
+
+/// Largest sieving prime of factorRange, larger factors are rare and are
+/// left to Pollard-rho.
+constexpr uint64_t cSieveLimit = uint64_t{1} << 20;
+
+/// Numbers per chunk of factorBatch.
+constexpr std::size_t cBatchChunk = 4096;
+
+/// \return floor(sqrt(n))
+uint64_t isqrt(uint64_t n) {
+  uint64_t r = static_cast<uint64_t>(std::sqrt(static_cast<double>(n)));
+  while (r > 0 && (r > UINT32_MAX || r * r > n)) {
+    --r;
+  }
+  while (r < UINT32_MAX && (r + 1) * (r + 1) <= n) {
+    ++r;
+  }
+  return r;
+}
+
+static_assert(cPrimesBelow<>.size() == 6542 && cPrimesBelow<>.front() == 2 &&
+              cPrimesBelow<>.back() == 65521);
+
+/// \return primes up to and including limit (at most cSieveLimit), taken
+/// from the compile time table when it is large enough
+std::vector<uint32_t> primesUpTo(uint64_t limit) {
+  if (limit < cPrimeTableLimit) {
+    return std::vector<uint32_t>(
+        cPrimesBelow<>.begin(),
+        std::upper_bound(cPrimesBelow<>.begin(), cPrimesBelow<>.end(), limit));
+  }
+  std::vector<bool> composite(limit + 1, false);
+  std::vector<uint32_t> primes;
+  for (uint64_t i = 2; i <= limit; ++i) {
+    if (composite[i]) {
+      continue;
+    }
+    primes.push_back(static_cast<uint32_t>(i));
+    for (uint64_t j = i * i; j <= limit; j += i) {
+      composite[j] = true;
+    }
+  }
+  return primes;
+}
+
+/// Factors of consecutive numbers before they are merged into a table.
+struct FactorChunk {
+  std::vector<std::size_t> counts;
+  std::vector<uint64_t> factors;
+};
+
+/// Factors the numbers start, ..., start + length - 1. Each sieving prime
+/// is divided out of its multiples, recording (index, prime) once per
+/// division, then the records are bucketed by index. Primes are sieved in
+/// increasing order and cofactors are larger than every sieving prime, so
+/// each number's factors come out sorted.
+void sieveSegment(uint64_t start, uint64_t length,
+                  const std::vector<uint32_t> &primes, uint64_t limit,
+                  FactorChunk &out) {
+  std::vector<uint64_t> rest(length);
+  for (uint64_t i = 0; i < length; ++i) {
+    rest[i] = start + i;
+  }
+  std::vector<std::pair<uint32_t, uint64_t>> found;
+  found.reserve(length * 4);
+  for (uint32_t p : primes) {
+    uint64_t const mod = start % p;
+    uint64_t first = mod == 0 ? 0 : p - mod;
+    if (start + first == 0) {
+      first = p; // 0 has no factors
+    }
+    for (uint64_t i = first; i < length; i += p) {
+      do {
+        rest[i] /= p;
+        found.emplace_back(static_cast<uint32_t>(i), p);
+      } while (rest[i] % p == 0);
+    }
+  }
+  std::vector<uint64_t> large;
+  for (uint64_t i = 0; i < length; ++i) {
+    if (rest[i] <= 1) {
+      continue;
+    }
+    if (rest[i] / limit <= limit) {
+      // no factor up to limit and below (limit + 1)^2, so prime
+      found.emplace_back(static_cast<uint32_t>(i), rest[i]);
+      continue;
+    }
+    large.clear();
+    detail::factorLarge(rest[i], large);
+    std::sort(large.begin(), large.end());
+    for (uint64_t factor : large) {
+      found.emplace_back(static_cast<uint32_t>(i), factor);
+    }
+  }
+  // counting sort by index keeps the increasing order of each number
+  out.counts.assign(length, 0);
+  for (auto const &[index, factor] : found) {
+    ++out.counts[index];
+  }
+  std::vector<std::size_t> next(length);
+  std::exclusive_scan(out.counts.begin(), out.counts.end(), next.begin(),
+                      std::size_t{0});
+  out.factors.resize(found.size());
+  for (auto const &[index, factor] : found) {
+    out.factors[next[index]++] = factor;
+  }
+}
+
+/// Calls f(i) for every i < count on up to threads threads (0 for all
+/// cores), each taking the next index when it finishes one.
+void forEachChunk(std::size_t count, std::size_t threads,
+                  const std::function<void(std::size_t)> &f) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, count);
+  std::atomic<std::size_t> next = 0;
+  auto const work = [&]() {
+    for (std::size_t i = next++; i < count; i = next++) {
+      f(i);
+    }
+  };
+  std::vector<std::jthread> pool;
+  for (std::size_t i = 1; i < threads; ++i) {
+    pool.emplace_back(work);
+  }
+  if (threads > 0) {
+    work();
+  }
+}
+
+/// Concatenates chunks of consecutive numbers into one table.
+FactorTable mergeChunks(const std::vector<FactorChunk> &chunks,
+                        std::size_t numbers) {
+  std::vector<std::size_t> offsets;
+  offsets.reserve(numbers + 1);
+  offsets.push_back(0);
+  std::size_t total = 0;
+  for (const FactorChunk &chunk : chunks) {
+    for (std::size_t count : chunk.counts) {
+      total += count;
+      offsets.push_back(total);
+    }
+  }
+  std::vector<uint64_t> factors;
+  factors.reserve(total);
+  for (const FactorChunk &chunk : chunks) {
+    factors.insert(factors.end(), chunk.factors.begin(), chunk.factors.end());
+  }
+  return FactorTable(std::move(offsets), std::move(factors));
+}
+
+/// Counts the divisors of a factorization.
+std::size_t countDivisors(const PrimePowers &powers) {
+  std::size_t count = 1;
+  for (std::size_t i = 0; i < powers.mSize; ++i) {
+    count *= powers.mData[i].mExponent + 1;
+  }
+  return count;
+}
+
+/// Writes the divisors of a factorization from smallest to largest into a
+/// buffer of at least countDivisors(powers). Each prime power multiplies the
+/// divisors found so far, then they are sorted in place.
+std::size_t expandDivisors(const PrimePowers &powers,
+                           std::span<uint64_t> out) {
+  out[0] = 1;
+  std::size_t size = 1;
+  for (std::size_t i = 0; i < powers.mSize; ++i) {
+    std::size_t const previous = size;
+    uint64_t power = 1;
+    for (uint32_t e = 0; e < powers.mData[i].mExponent; ++e) {
+      power *= powers.mData[i].mPrime;
+      for (std::size_t j = 0; j < previous; ++j) {
+        out[size++] = out[j] * power;
+      }
+    }
+  }
+  std::sort(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(size));
+  return size;
+}
+
+} // namespace
+
 /// Finds prime factors of a number, smallest to largest, with multiplicity.
+/// Small factors are removed with a wheel, the rest is split with
+/// Pollard-rho and Miller-Rabin so any 64 bit number takes microseconds.
 /// \param n number to factor
 /// \return prime factors smallest to largest counting multiplicity
 std::vector<uint64_t> primeFactorization(uint64_t n) {
   std::vector<uint64_t> result;
-  if (n < 2) {
-    return result;
-  }
-  while (n % 2 == 0) {
-    n /= 2;
-    result.push_back(2);
-  }
-  uint64_t d = 3;
-  while (d * d <= n) {
-    while (n % d == 0) {
-      n /= d;
-      result.push_back(d);
+  detail::factorAppend(n, result);
+  return result;
+}
+
+/// Factors every number in [lo, hi) with a segmented sieve. The range is
+/// split into cache sized segments which are sieved in parallel, dividing
+/// each number by the sieving primes up to min(sqrt(hi), 2^20) as they are
+/// found; a cofactor which remains is prime or is split with Pollard-rho.
+/// \param lo first number to factor
+/// \param hi end of the range, not factored
+/// \param threads number of threads, 0 for all cores
+/// \return factors of lo, lo + 1, ..., hi - 1
+FactorTable factorRange(uint64_t lo, uint64_t hi, std::size_t threads) {
+  if (hi <= lo) {
+    return FactorTable();
+  }
+  uint64_t const limit = std::min(isqrt(hi - 1), cSieveLimit);
+  std::vector<uint32_t> const primes = primesUpTo(limit);
+  uint64_t const segments = (hi - lo - 1) / cSegmentSize + 1;
+  std::vector<FactorChunk> chunks(segments);
+  forEachChunk(segments, threads, [&](std::size_t segment) {
+    uint64_t const start = lo + segment * cSegmentSize;
+    uint64_t const length = std::min(cSegmentSize, hi - start);
+    sieveSegment(start, length, primes, limit, chunks[segment]);
+  });
+  return mergeChunks(chunks, hi - lo);
+}
+
+/// Factors many numbers into one table without allocating per number.
+/// \param values numbers to factor
+/// \param threads number of threads, 0 for all cores
+/// \return factors of each value in order
+FactorTable factorBatch(std::span<const uint64_t> values, std::size_t threads) {
+  std::size_t const count = (values.size() + cBatchChunk - 1) / cBatchChunk;
+  std::vector<FactorChunk> chunks(count);
+  forEachChunk(count, threads, [&](std::size_t chunk) {
+    std::span<const uint64_t> const part = values.subspan(
+        chunk * cBatchChunk,
+        std::min(cBatchChunk, values.size() - chunk * cBatchChunk));
+    FactorChunk &out = chunks[chunk];
+    out.counts.reserve(part.size());
+    for (uint64_t n : part) {
+      std::size_t const before = out.factors.size();
+      detail::factorAppend(n, out.factors);
+      out.counts.push_back(out.factors.size() - before);
     }
-    d += 2;
+  });
+  return mergeChunks(chunks, values.size());
+}
+
+/// Writes the divisors of n from smallest to largest into a buffer. Each
+/// prime power multiplies the divisors found so far, then they are sorted
+/// in place. A buffer of cMaxDivisors always suffices.
+/// \param n number to list divisors of, 0 has none
+/// \param out buffer for the divisors
+/// \return number of divisors written
+/// \throw std::length_error if out is smaller than divisorCount(n)
+std::size_t listDivisorsInto(uint64_t n, std::span<uint64_t> out) {
+  if (n == 0) {
+    return 0;
   }
-  if (n != 1) {
-    result.push_back(n);
+  PrimePowers const powers = primePowers(n);
+  if (out.size() < countDivisors(powers)) {
+    throw std::length_error("listDivisorsInto: buffer too small");
   }
-  return result;
+  return expandDivisors(powers, out);
 }
 
 /// Finds all positive divisors from smallest to largest.
 /// \param n number to list divisors of
 /// \return positive divisors from smallest to largest
 std::vector<uint64_t> listDivisors(uint64_t n) {
-  std::vector<uint64_t> result;
-  std::vector<uint64_t> resultBack;
-  uint64_t d = 1;
-  while (d * d < n) {
-    if (n % d == 0) {
-      result.push_back(d);
-      resultBack.push_back(n / d);
-    }
-    ++d;
-  }
-  if (d * d == n) {
-    result.push_back(d);
+  if (n == 0) {
+    return {};
   }
-  std::copy(resultBack.rbegin(), resultBack.rend(), std::back_inserter(result));
+  // factored once, this is the slow part for large n
+  PrimePowers const powers = primePowers(n);
+  std::vector<uint64_t> result(countDivisors(powers));
+  expandDivisors(powers, result);
   return result;
 }
 
@@ -68,6 +306,122 @@ TEST_CREATE(smallFactors) {
   TEST_REQUIRE(_test::primeFactorization(1).empty());
 }
 
+TEST_CREATE(fullRangeFactors) {
+  TEST_REQUIRE((_test::primeFactorization(UINT64_MAX) ==
+                std::vector<uint64_t>{3, 5, 17, 257, 641, 65537, 6700417}));
+  TEST_REQUIRE((_test::primeFactorization(18446744073709551557u) ==
+                std::vector<uint64_t>{18446744073709551557u}));
+  TEST_REQUIRE((_test::primeFactorization(18446744030759878681u) ==
+                std::vector<uint64_t>{4294967291, 4294967291}));
+  TEST_REQUIRE((_test::primeFactorization(18446743979220271189u) ==
+                std::vector<uint64_t>{4294967279, 4294967291}));
+  TEST_REQUIRE((_test::primeFactorization(3825123056546413051) ==
+                std::vector<uint64_t>{149491, 747451, 34233211}));
+}
+
+TEST_CREATE(primality) {
+  TEST_REQUIRE(!_test::isPrime(0));
+  TEST_REQUIRE(!_test::isPrime(1));
+  TEST_REQUIRE(_test::isPrime(2));
+  TEST_REQUIRE(_test::isPrime(1369 - 2)); // 37^2 - 2
+  TEST_REQUIRE(!_test::isPrime(561));
+  // strong pseudoprimes to several small bases
+  TEST_REQUIRE(!_test::isPrime(3215031751));
+  TEST_REQUIRE(!_test::isPrime(3825123056546413051));
+  TEST_REQUIRE(_test::isPrime(18446744073709551557u));
+  TEST_REQUIRE(!_test::isPrime(UINT64_MAX));
+}
+
+TEST_PROPERTY(factorsMultiplyBack, tkoz::srtest::gen::uniform<uint64_t>())
+(uint64_t n) {
+  auto const factors = _test::primeFactorization(n);
+  uint64_t product = 1;
+  for (uint64_t factor : factors) {
+    product *= factor;
+  }
+  TEST_REQUIRE_EQ(product, n < 2 ? 1 : n);
+  TEST_REQUIRE(std::is_sorted(factors.begin(), factors.end()));
+  TEST_REQUIRE(std::all_of(factors.begin(), factors.end(), _test::isPrime));
+}
+
+TEST_CREATE(rangeMatchesSingle) {
+  // several segments, including 0 and 1, on several threads
+  const uint64_t hi = 3 * (uint64_t{1} << 15) + 123;
+  const _test::FactorTable table = _test::factorRange(0, hi, 3);
+  TEST_REQUIRE_EQ(table.size(), hi);
+  for (uint64_t n = 0; n < hi; ++n) {
+    const auto factors = table[n];
+    TEST_REQUIRE(std::ranges::equal(factors, _test::primeFactorization(n)));
+  }
+}
+
+TEST_CREATE(rangeNearMax) {
+  const uint64_t lo = UINT64_MAX - 2000;
+  const _test::FactorTable table = _test::factorRange(lo, UINT64_MAX);
+  TEST_REQUIRE_EQ(table.size(), 2000);
+  for (uint64_t i = 0; i < table.size(); ++i) {
+    TEST_REQUIRE(
+        std::ranges::equal(table[i], _test::primeFactorization(lo + i)));
+  }
+  TEST_REQUIRE_EQ(_test::factorRange(5, 5).size(), 0);
+}
+
+TEST_CREATE(batchMatchesSingle) {
+  std::vector<uint64_t> values = {0, 1, 2, UINT64_MAX, 18446743979220271189u};
+  for (uint64_t i = 0; i < 10000; ++i) {
+    values.push_back(i * 2654435761u + 12345);
+  }
+  const _test::FactorTable table = _test::factorBatch(values, 2);
+  TEST_REQUIRE_EQ(table.size(), values.size());
+  TEST_REQUIRE_EQ(table.offsets().back(), table.factors().size());
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    TEST_REQUIRE(
+        std::ranges::equal(table[i], _test::primeFactorization(values[i])));
+  }
+}
+
+TEST_CREATE(divisorsFromFactors) {
+  TEST_REQUIRE(_test::listDivisors(0).empty());
+  TEST_REQUIRE((_test::listDivisors(1) == std::vector<uint64_t>{1}));
+  TEST_REQUIRE(
+      (_test::listDivisors(12) == std::vector<uint64_t>{1, 2, 3, 4, 6, 12}));
+  TEST_REQUIRE((_test::listDivisors(18446744030759878681u) ==
+                std::vector<uint64_t>{1, 4294967291, 18446744030759878681u}));
+  for (uint64_t n = 1; n < 2000; ++n) {
+    std::vector<uint64_t> expected;
+    for (uint64_t d = 1; d <= n; ++d) {
+      if (n % d == 0) {
+        expected.push_back(d);
+      }
+    }
+    TEST_REQUIRE(_test::listDivisors(n) == expected);
+    std::vector<uint64_t> lazy;
+    for (uint64_t d : _test::divisors(n)) {
+      lazy.push_back(d);
+    }
+    std::sort(lazy.begin(), lazy.end());
+    TEST_REQUIRE(lazy == expected);
+  }
+}
+
+TEST_CREATE(divisorQueries) {
+  TEST_REQUIRE_EQ(_test::divisorCount(0), 0);
+  TEST_REQUIRE_EQ(_test::divisorCount(1), 1);
+  TEST_REQUIRE_EQ(_test::divisorCount(897612484786617600), _test::cMaxDivisors);
+  TEST_REQUIRE_EQ(_test::divisorSum(1000), 2340);
+  TEST_REQUIRE_EQ(_test::divisorSum(897612484786617600),
+                  5785230588744499200u);
+  TEST_REQUIRE_THROW(_test::divisorSum(UINT64_MAX), std::overflow_error);
+  std::array<uint64_t, 3> small{};
+  TEST_REQUIRE_THROW(_test::listDivisorsInto(12, small), std::length_error);
+  std::vector<uint64_t> buffer(_test::cMaxDivisors);
+  TEST_REQUIRE_EQ(_test::listDivisorsInto(897612484786617600, buffer),
+                  _test::cMaxDivisors);
+  TEST_REQUIRE(std::is_sorted(buffer.begin(), buffer.end()));
+  TEST_REQUIRE_EQ(buffer.back(), 897612484786617600);
+  TEST_REQUIRE_EQ(std::ranges::distance(_test::divisors(360)), 24);
+}
+
 TEST_CREATE(largeFactors) {
   TEST_REQUIRE(_test::primeFactorization(1000003) ==
                std::vector<uint64_t>{1000003});
@@ -77,4 +431,21 @@ TEST_CREATE(largeFactors) {
       (_test::primeFactorization(994009) == std::vector<uint64_t>{997, 997}));
 }
 
+TEST_CREATE(compileTimeFactors) {
+  // evaluated by the compiler, a failure stops the build
+  static_assert(_test::primeFactors(360) ==
+                _test::FactorList{2, 2, 2, 3, 3, 5});
+  static_assert(_test::primeFactors(1).empty());
+  static_assert(_test::primeFactors(UINT64_MAX) ==
+                _test::FactorList{3, 5, 17, 257, 641, 65537, 6700417});
+  static_assert(_test::isPrime(18446744073709551557u));
+  static_assert(_test::divisorCount(360) == 24);
+  static_assert(_test::divisorSum(28) == 56);
+  constexpr _test::FactorList cFactors = _test::primeFactors(4294967279 * 7);
+  TEST_REQUIRE((std::vector<uint64_t>(cFactors.begin(), cFactors.end()) ==
+                _test::primeFactorization(4294967279 * 7)));
+  TEST_REQUIRE_EQ(_test::cPrimesBelow<100>.size(), 25);
+  TEST_REQUIRE_EQ(_test::cPrimesBelow<100>.back(), 97);
+}
+
 #endif // TEST
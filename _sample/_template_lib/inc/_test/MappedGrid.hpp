@@ -0,0 +1,489 @@
+#pragma once
+
+#include <_test/Vector2d.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap/madvise/msync
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // pread/ftruncate/close/sysconf
+
+namespace _test {
+
+/// Element type stored in a grid file.
+enum class GridElement : uint32_t {
+  INT8 = 1,
+  UINT8,
+  INT16,
+  UINT16,
+  INT32,
+  UINT32,
+  INT64,
+  UINT64,
+  FLOAT32,
+  FLOAT64,
+};
+
+/// \brief Header at the start of a grid file, followed at mPayloadOffset by
+/// mRows rows of mStride elements each (mCols used, the rest padding). Every
+/// field is in the byte order of the writer, which mByteOrder identifies.
+struct GridFileHeader {
+  std::array<char, 8> mMagic{};
+  uint32_t mByteOrder = 0; // cGridByteOrder as written
+  uint32_t mVersion = 0;
+  uint64_t mRows = 0;
+  uint64_t mCols = 0;
+  uint64_t mStride = 0;
+  GridElement mElement{};
+  uint32_t mElementSize = 0;
+  uint64_t mAlignment = 0;
+  uint64_t mPayloadOffset = 0;
+};
+
+static_assert(sizeof(GridFileHeader) == 64 &&
+              std::is_trivially_copyable_v<GridFileHeader>);
+
+/// First bytes of a grid file.
+inline constexpr std::array<char, 8> cGridMagic{'T', 'K', 'G', 'R',
+                                                'I', 'D', '\0', '\0'};
+
+/// Written natively, reads back byte swapped on a machine of the other
+/// byte order.
+inline constexpr uint32_t cGridByteOrder = 0x01020304;
+
+/// Current grid file version.
+inline constexpr uint32_t cGridVersion = 1;
+
+/// How a grid file is mapped.
+enum class MapMode {
+  READ_ONLY,     // shared read-only pages, for MappedGrid<const T>
+  COPY_ON_WRITE, // private pages, writes are never stored in the file
+  READ_WRITE,    // shared writable pages, writes go to the file
+};
+
+namespace detail {
+
+/// \return element code of an arithmetic type
+template <typename T> consteval GridElement gridElement() {
+  static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>,
+                "grid files store arithmetic elements");
+  if constexpr (std::is_floating_point_v<T>) {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8,
+                  "only 32 and 64 bit floating point is supported");
+    return sizeof(T) == 4 ? GridElement::FLOAT32 : GridElement::FLOAT64;
+  } else {
+    constexpr std::array<GridElement, 4> cSigned{
+        GridElement::INT8, GridElement::INT16, GridElement::INT32,
+        GridElement::INT64};
+    constexpr std::array<GridElement, 4> cUnsigned{
+        GridElement::UINT8, GridElement::UINT16, GridElement::UINT32,
+        GridElement::UINT64};
+    constexpr std::size_t cIndex = std::bit_width(sizeof(T)) - 1;
+    return std::is_signed_v<T> ? cSigned[cIndex] : cUnsigned[cIndex];
+  }
+}
+
+/// Throws std::system_error for errno with a message naming the file
+[[noreturn]] inline void throwErrno(const char *what, const std::string &path) {
+  throw std::system_error(errno, std::generic_category(),
+                          std::string(what) + ": " + path);
+}
+
+/// \return header for a grid of the given shape
+template <typename T>
+GridFileHeader makeGridHeader(std::size_t rows, std::size_t cols,
+                              std::size_t stride, std::size_t alignment) {
+  GridFileHeader header;
+  header.mMagic = cGridMagic;
+  header.mByteOrder = cGridByteOrder;
+  header.mVersion = cGridVersion;
+  header.mRows = rows;
+  header.mCols = cols;
+  header.mStride = stride;
+  header.mElement = gridElement<T>();
+  header.mElementSize = sizeof(T);
+  header.mAlignment = alignment;
+  // aligned in the file and mappings are page aligned, so aligned in memory
+  header.mPayloadOffset =
+      (sizeof(GridFileHeader) + alignment - 1) / alignment * alignment;
+  return header;
+}
+
+/// Checks a header read from a file of fileSize bytes holds elements of T.
+/// \throw std::runtime_error if it does not
+template <typename T>
+void checkGridHeader(const GridFileHeader &header, std::size_t fileSize,
+                     const std::string &path) {
+  auto const fail = [&](const char *reason) {
+    throw std::runtime_error("grid file " + path + ": " + reason);
+  };
+  if (header.mMagic != cGridMagic) {
+    fail("not a grid file");
+  }
+  if (header.mByteOrder != cGridByteOrder) {
+    fail("written with the other byte order");
+  }
+  if (header.mVersion != cGridVersion) {
+    fail("unsupported version");
+  }
+  if (header.mElement != gridElement<T>() || header.mElementSize != sizeof(T)) {
+    fail("element type differs");
+  }
+  if (header.mStride < header.mCols ||
+      header.mPayloadOffset < sizeof(GridFileHeader) ||
+      header.mPayloadOffset % alignof(T) != 0) {
+    fail("invalid layout");
+  }
+  uint64_t const maxElements =
+      (fileSize - std::min<uint64_t>(fileSize, header.mPayloadOffset)) /
+      sizeof(T);
+  if (header.mStride != 0 && header.mRows > maxElements / header.mStride) {
+    fail("file is truncated");
+  }
+}
+
+} // namespace detail
+
+/// Writes a grid as a grid file that MappedGrid can open. Padding is
+/// written as zeros.
+/// \param path file to create or replace
+/// \param grid any row-major grid of arithmetic elements
+/// \param padding whether rows in the file start on aligned addresses
+/// \throw std::system_error if the file cannot be written
+template <Grid2d G>
+void writeGrid(const std::string &path, const G &grid,
+               RowPadding padding = RowPadding::NONE) {
+  using T = typename G::value_type;
+  std::size_t const stride =
+      detail::rowStride<sizeof(T), cCacheLineSize>(grid.cols(), padding);
+  GridFileHeader const header = detail::makeGridHeader<T>(
+      grid.rows(), grid.cols(), stride, cCacheLineSize);
+  std::vector<char> prefix(header.mPayloadOffset, '\0');
+  std::memcpy(prefix.data(), &header, sizeof header);
+  std::vector<T> const zeros(stride - grid.cols(), T{});
+  std::FILE *const file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    detail::throwErrno("cannot create", path);
+  }
+  bool ok = std::fwrite(prefix.data(), 1, prefix.size(), file) == prefix.size();
+  for (std::size_t i = 0; ok && i < grid.rows(); ++i) {
+    std::span<const T> const row(grid.row(i));
+    ok = std::fwrite(row.data(), sizeof(T), row.size(), file) == row.size() &&
+         (zeros.empty() || std::fwrite(zeros.data(), sizeof(T), zeros.size(),
+                                       file) == zeros.size());
+  }
+  if (!ok) {
+    int const error = errno;
+    std::fclose(file);
+    errno = error;
+    detail::throwErrno("cannot write", path);
+  }
+  if (std::fclose(file) != 0) {
+    detail::throwErrno("cannot write", path);
+  }
+}
+
+/// \brief Grid file mapped into memory without copying, with the interface
+/// of Basic2dVector. Pages are read on first access, so a grid larger than
+/// memory can be processed tile by tile with forEachRowTile.
+/// \tparam T arithmetic element type, const for a read-only mapping
+template <typename T> class MappedGrid {
+private:
+  void *mMapping = MAP_FAILED;
+  std::size_t mMappingSize = 0;
+  T *mData = nullptr;
+  std::size_t mRows = 0;
+  std::size_t mCols = 0;
+  std::size_t mStride = 0;
+  MapMode mMode = MapMode::READ_ONLY;
+
+  using Element = std::remove_const_t<T>;
+
+  static_assert(!std::is_volatile_v<T>);
+
+  MappedGrid(int fd, const GridFileHeader &header, std::size_t fileSize,
+             MapMode mode, const std::string &path)
+      : mMappingSize(fileSize), mRows(header.mRows), mCols(header.mCols),
+        mStride(header.mStride), mMode(mode) {
+    int const protection =
+        mode == MapMode::READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+    int const flags = mode == MapMode::COPY_ON_WRITE ? MAP_PRIVATE : MAP_SHARED;
+    mMapping = mmap(nullptr, mMappingSize, protection, flags, fd, 0);
+    if (mMapping == MAP_FAILED) {
+      detail::throwErrno("cannot map", path);
+    }
+    mData = reinterpret_cast<T *>(static_cast<char *>(mMapping) +
+                                  header.mPayloadOffset);
+  }
+
+  /// Opens path and returns its descriptor, closed by the caller
+  static int openFile(const std::string &path, int flags) {
+    int const fd = ::open(path.c_str(), flags, 0644);
+    if (fd < 0) {
+      detail::throwErrno("cannot open", path);
+    }
+    return fd;
+  }
+
+  /// Applies advice to the whole pages of rows [begin, end), rounding
+  /// outward when inward is false
+  void adviseRows(std::size_t begin, std::size_t end, int advice,
+                  bool inward) const {
+    if (begin >= end || mMapping == MAP_FAILED) {
+      return;
+    }
+    auto const page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    auto first = reinterpret_cast<uintptr_t>(mData + begin * mStride);
+    auto last = reinterpret_cast<uintptr_t>(mData + end * mStride);
+    if (inward) {
+      first = (first + page - 1) / page * page;
+      last = last / page * page;
+    } else {
+      first = first / page * page;
+      last = (last + page - 1) / page * page;
+    }
+    if (first < last) {
+      madvise(reinterpret_cast<void *>(first), last - first, advice);
+    }
+  }
+
+public:
+  using value_type = Element;
+
+  /// Row major view of all elements
+  using MdspanType =
+      std::mdspan<T, std::dextents<std::size_t, 2>, std::layout_stride>;
+  /// View of one column
+  using ColumnType =
+      std::mdspan<T, std::dextents<std::size_t, 1>, std::layout_stride>;
+
+  /// Constructs as empty
+  MappedGrid() = default;
+
+  /// Maps a grid file.
+  /// \param path grid file written by writeGrid or create
+  /// \param mode READ_ONLY for const T, otherwise COPY_ON_WRITE or
+  /// READ_WRITE
+  /// \throw std::system_error if the file cannot be opened or mapped
+  /// \throw std::runtime_error if it is not a grid file of T
+  [[nodiscard]] static MappedGrid open(const std::string &path,
+                                       MapMode mode = std::is_const_v<T>
+                                           ? MapMode::READ_ONLY
+                                           : MapMode::COPY_ON_WRITE) {
+    if ((mode == MapMode::READ_ONLY) != std::is_const_v<T>) {
+      throw std::invalid_argument(
+          "MappedGrid::open: READ_ONLY is for and only for const elements");
+    }
+    int const fd =
+        openFile(path, mode == MapMode::READ_WRITE ? O_RDWR : O_RDONLY);
+    try {
+      struct stat info;
+      if (fstat(fd, &info) != 0) {
+        detail::throwErrno("cannot stat", path);
+      }
+      auto const fileSize = static_cast<std::size_t>(info.st_size);
+      GridFileHeader header;
+      if (fileSize < sizeof header ||
+          pread(fd, &header, sizeof header, 0) !=
+              static_cast<ssize_t>(sizeof header)) {
+        throw std::runtime_error("grid file " + path + ": no header");
+      }
+      detail::checkGridHeader<Element>(header, fileSize, path);
+      MappedGrid grid(fd, header, fileSize, mode, path);
+      close(fd);
+      return grid;
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+  }
+
+  /// Creates a zero filled grid file and maps it for writing, the file is
+  /// sparse until written so it can be larger than memory.
+  /// \param path file to create or replace
+  /// \param rows number of rows (first index dimension)
+  /// \param cols number of cols (second index dimension)
+  /// \param padding whether to align the start of each row
+  /// \throw std::system_error if the file cannot be created or mapped
+  [[nodiscard]] static MappedGrid create(const std::string &path,
+                                         std::size_t rows, std::size_t cols,
+                                         RowPadding padding = RowPadding::NONE)
+    requires(!std::is_const_v<T>)
+  {
+    std::size_t const stride =
+        detail::rowStride<sizeof(T), cCacheLineSize>(cols, padding);
+    GridFileHeader const header =
+        detail::makeGridHeader<T>(rows, cols, stride, cCacheLineSize);
+    if (stride != 0 &&
+        rows > (std::numeric_limits<std::size_t>::max() -
+                header.mPayloadOffset) / sizeof(T) / stride) {
+      throw std::length_error("MappedGrid::create: grid is too large");
+    }
+    std::size_t const fileSize =
+        header.mPayloadOffset + rows * stride * sizeof(T);
+    int const fd = openFile(path, O_RDWR | O_CREAT | O_TRUNC);
+    try {
+      if (pwrite(fd, &header, sizeof header, 0) !=
+              static_cast<ssize_t>(sizeof header) ||
+          ftruncate(fd, static_cast<off_t>(fileSize)) != 0) {
+        detail::throwErrno("cannot write", path);
+      }
+      MappedGrid grid(fd, header, fileSize, MapMode::READ_WRITE, path);
+      close(fd);
+      return grid;
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+  }
+
+  /// Takes the mapping, leaving other empty
+  MappedGrid(MappedGrid &&other) noexcept
+      : mMapping(std::exchange(other.mMapping, MAP_FAILED)),
+        mMappingSize(std::exchange(other.mMappingSize, 0)),
+        mData(std::exchange(other.mData, nullptr)),
+        mRows(std::exchange(other.mRows, 0)),
+        mCols(std::exchange(other.mCols, 0)),
+        mStride(std::exchange(other.mStride, 0)), mMode(other.mMode) {}
+
+  /// Takes the mapping, leaving other empty
+  MappedGrid &operator=(MappedGrid &&other) noexcept {
+    MappedGrid moved(std::move(other));
+    std::swap(mMapping, moved.mMapping);
+    std::swap(mMappingSize, moved.mMappingSize);
+    std::swap(mData, moved.mData);
+    std::swap(mRows, moved.mRows);
+    std::swap(mCols, moved.mCols);
+    std::swap(mStride, moved.mStride);
+    std::swap(mMode, moved.mMode);
+    return *this;
+  }
+
+  MappedGrid(const MappedGrid &) = delete;
+  MappedGrid &operator=(const MappedGrid &) = delete;
+
+  /// Unmaps, writes of a READ_WRITE mapping reach the file eventually
+  ~MappedGrid() {
+    if (mMapping != MAP_FAILED) {
+      munmap(mMapping, mMappingSize);
+    }
+  }
+
+  /// Writes changes of a READ_WRITE mapping to the file and waits for it.
+  /// \throw std::system_error if syncing fails
+  void flush() const {
+    if (mMode == MapMode::READ_WRITE && mMapping != MAP_FAILED &&
+        msync(mMapping, mMappingSize, MS_SYNC) != 0) {
+      throw std::system_error(errno, std::generic_category(),
+                              "MappedGrid::flush");
+    }
+  }
+
+  /// Asks the kernel to start reading rows [begin, end) ahead of use.
+  void prefetchRows(std::size_t begin, std::size_t end) const {
+    adviseRows(begin, end, MADV_WILLNEED, false);
+  }
+
+  /// Lets the kernel drop the pages of rows [begin, end) from this process.
+  /// Shared pages are read again from the file if used, so this does
+  /// nothing for COPY_ON_WRITE where that would lose private changes.
+  void releaseRows(std::size_t begin, std::size_t end) const {
+    if (mMode != MapMode::COPY_ON_WRITE) {
+      adviseRows(begin, end, MADV_DONTNEED, true);
+    }
+  }
+
+  /// Streams the grid through memory in blocks of rows. The next block is
+  /// prefetched while f processes the current one, which is released
+  /// afterwards, so only about two blocks are resident at once.
+  /// \param tileRows rows per block
+  /// \param f called with the rows [begin, end) of each block in order
+  template <typename F>
+  void forEachRowTile(std::size_t tileRows, const F &f) const {
+    tileRows = std::max<std::size_t>(tileRows, 1);
+    for (std::size_t begin = 0; begin < mRows; begin += tileRows) {
+      std::size_t const end = std::min(begin + tileRows, mRows);
+      prefetchRows(end, std::min(end + tileRows, mRows));
+      f(begin, end);
+      releaseRows(begin, end);
+    }
+  }
+
+  /// Access by 2d index
+  [[nodiscard]] T &operator[](std::size_t row, std::size_t col) const {
+    return mData[row * mStride + col];
+  }
+
+  /// Access by 2d index with bounds checking
+  /// \throw std::out_of_range if the index is outside the grid
+  [[nodiscard]] T &at(std::size_t row, std::size_t col) const {
+    if (row >= mRows || col >= mCols) {
+      throw std::out_of_range("MappedGrid::at: index out of range");
+    }
+    return (*this)[row, col];
+  }
+
+  /// \return number of rows
+  [[nodiscard]] std::size_t rows() const { return mRows; }
+
+  /// \return number of cols
+  [[nodiscard]] std::size_t cols() const { return mCols; }
+
+  /// \return elements from the start of one row to the next, at least cols
+  [[nodiscard]] std::size_t stride() const { return mStride; }
+
+  /// \return how the file is mapped
+  [[nodiscard]] MapMode mode() const { return mMode; }
+
+  /// \return start of the payload, aligned as in the file
+  [[nodiscard]] T *data() const { return mData; }
+
+  /// \return contiguous elements of one row, without padding
+  [[nodiscard]] std::span<T> row(std::size_t index) const {
+    return std::span<T>(mData + index * mStride, mCols);
+  }
+
+  /// \return elements of one column, stride() apart
+  [[nodiscard]] ColumnType col(std::size_t index) const {
+    return ColumnType(mData + index,
+                      {std::dextents<std::size_t, 1>(mRows),
+                       std::array<std::size_t, 1>{
+                           std::max<std::size_t>(mStride, 1)}});
+  }
+
+  /// \return 2d view of all elements, excluding padding
+  [[nodiscard]] MdspanType view() const {
+    return MdspanType(mData, {std::dextents<std::size_t, 2>(mRows, mCols),
+                              std::array<std::size_t, 2>{
+                                  std::max<std::size_t>(mStride, 1), 1}});
+  }
+
+  /// \return copy of the elements in memory
+  [[nodiscard]] Basic2dVector<Element> toVector() const {
+    Basic2dVector<Element> result(mRows, mCols, cDefaultInit);
+    for (std::size_t i = 0; i < mRows; ++i) {
+      std::ranges::copy(row(i), result.row(i).begin());
+    }
+    return result;
+  }
+};
+
+static_assert(Grid2d<MappedGrid<const double>> && Grid2d<MappedGrid<float>>);
+
+} // namespace _test
@@ -1,15 +1,163 @@
 #pragma once
 
-#include <vector>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <limits>
+#include <mdspan>
+#include <memory>
+#include <new>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <utility>
 
 namespace _test {
 
-/// \brief Stores data in a fixed size 2d vector.
-template <typename T> class Basic2dVector {
+/// Tag to construct elements by default initialization, leaving trivial
+/// types such as double uninitialized.
+struct DefaultInit {
+  explicit DefaultInit() = default;
+};
+
+/// Constructs a Basic2dVector without initializing trivial elements.
+inline constexpr DefaultInit cDefaultInit{};
+
+/// Whether rows are padded so each one starts on an aligned address.
+enum class RowPadding { NONE, ALIGNED };
+
+/// Alignment of a cache line, which also suits any SIMD vector up to 512 bit.
+inline constexpr std::size_t cCacheLineSize = 64;
+
+/// \brief Row-major grid such as Basic2dVector, accessed by 2d index or by
+/// contiguous rows.
+template <typename G>
+concept Grid2d = requires(G &grid, std::size_t i) {
+  typename G::value_type;
+  { grid.rows() } -> std::convertible_to<std::size_t>;
+  { grid.cols() } -> std::convertible_to<std::size_t>;
+  { grid.row(i) } -> std::ranges::contiguous_range;
+  grid[i, i];
+};
+
+namespace detail {
+
+/// \return elements from one row to the next for cols elements per row,
+/// rounded up to a multiple of the alignment when padding
+/// \throw std::length_error if the padded row does not fit in size_t
+template <std::size_t cElementSize, std::size_t cAlignment>
+[[nodiscard]] constexpr std::size_t rowStride(std::size_t cols,
+                                              RowPadding padding) {
+  if (padding == RowPadding::NONE || cAlignment % cElementSize != 0) {
+    return cols;
+  }
+  std::size_t const perLine = cAlignment / cElementSize;
+  if (cols > std::numeric_limits<std::size_t>::max() - (perLine - 1)) {
+    throw std::length_error("rowStride: row is too large");
+  }
+  return (cols + perLine - 1) / perLine * perLine;
+}
+
+} // namespace detail
+
+/// \brief Stores data in a fixed size 2d vector. Elements are in one
+/// row-major buffer aligned to cAlignment bytes. Rows can be padded to a
+/// multiple of the alignment, so the distance between rows is stride()
+/// elements rather than cols().
+/// \tparam T element type
+/// \tparam cAlignment buffer alignment in bytes, a power of 2
+template <typename T, std::size_t cAlignment = cCacheLineSize>
+class Basic2dVector {
 private:
-  std::vector<std::vector<T>> mData;
+  static_assert(std::has_single_bit(cAlignment) && cAlignment >= alignof(T),
+                "alignment must be a power of 2 suitable for T");
+
+  T *mData = nullptr;
+  std::size_t mRows = 0;
+  std::size_t mCols = 0;
+  std::size_t mStride = 0;
+
+  /// \return number of elements in the buffer, including padding
+  [[nodiscard]] std::size_t capacity() const { return mRows * mStride; }
+
+  /// Checks that a buffer of rows * stride elements has a size in bytes
+  /// which fits in size_t, so capacity() and allocate() do not wrap
+  /// \throw std::length_error if it does not
+  static void checkSize(std::size_t rows, std::size_t stride) {
+    if (stride != 0 &&
+        rows > std::numeric_limits<std::size_t>::max() / sizeof(T) / stride) {
+      throw std::length_error("Basic2dVector: grid is too large");
+    }
+  }
+
+  /// Allocates an uninitialized buffer for the current shape
+  void allocate() {
+    if (capacity() != 0) {
+      mData = static_cast<T *>(::operator new(
+          capacity() * sizeof(T), std::align_val_t{cAlignment}));
+    }
+  }
+
+  /// Frees the buffer without destroying elements
+  void deallocate() noexcept {
+    if (mData != nullptr) {
+      ::operator delete(mData, std::align_val_t{cAlignment});
+      mData = nullptr;
+    }
+  }
+
+  /// Allocates for the shape and constructs elements with init, freeing the
+  /// buffer if it throws
+  template <typename Init>
+  void create(std::size_t rows, std::size_t cols, RowPadding padding,
+              Init &&init) {
+    std::size_t const stride =
+        detail::rowStride<sizeof(T), cAlignment>(cols, padding);
+    checkSize(rows, stride);
+    mRows = rows;
+    mCols = cols;
+    mStride = stride;
+    allocate();
+    try {
+      init(mData, mData + capacity());
+    } catch (...) {
+      deallocate();
+      throw;
+    }
+  }
+
+  /// \return layout of the grid, strides must be positive even when empty
+  [[nodiscard]] std::layout_stride::mapping<std::dextents<std::size_t, 2>>
+  gridMapping() const {
+    return {std::dextents<std::size_t, 2>(mRows, mCols),
+            std::array<std::size_t, 2>{std::max<std::size_t>(mStride, 1), 1}};
+  }
+
+  /// \return layout of one column
+  [[nodiscard]] std::layout_stride::mapping<std::dextents<std::size_t, 1>>
+  columnMapping() const {
+    return {std::dextents<std::size_t, 1>(mRows),
+            std::array<std::size_t, 1>{std::max<std::size_t>(mStride, 1)}};
+  }
 
 public:
+  using value_type = T;
+
+  /// Row major view of all elements
+  using MdspanType =
+      std::mdspan<T, std::dextents<std::size_t, 2>, std::layout_stride>;
+  /// Row major view of all elements (const)
+  using ConstMdspanType =
+      std::mdspan<const T, std::dextents<std::size_t, 2>, std::layout_stride>;
+  /// View of one column
+  using ColumnType =
+      std::mdspan<T, std::dextents<std::size_t, 1>, std::layout_stride>;
+  /// View of one column (const)
+  using ConstColumnType =
+      std::mdspan<const T, std::dextents<std::size_t, 1>, std::layout_stride>;
+
   /// Constructs as empty
   Basic2dVector() = default;
 
@@ -17,38 +165,153 @@ public:
   /// \param rows number of rows (first index dimension)
   /// \param cols number of cols (second index dimension)
   /// \param fill value to store on initialization
-  Basic2dVector(std::size_t rows, std::size_t cols, const T &fill = T())
-      : mData(rows, std::vector<T>(cols, fill)) {}
+  /// \param padding whether to align the start of each row
+  /// \throw std::length_error if the size in bytes does not fit in size_t
+  Basic2dVector(std::size_t rows, std::size_t cols, const T &fill = T(),
+                RowPadding padding = RowPadding::NONE) {
+    create(rows, cols, padding, [&](T *first, T *last) {
+      std::uninitialized_fill(first, last, fill);
+    });
+  }
+
+  /// Constructs with a fixed size by default initialization, so a large
+  /// grid of a trivial type is not filled before it is written
+  /// \param rows number of rows (first index dimension)
+  /// \param cols number of cols (second index dimension)
+  /// \param padding whether to align the start of each row
+  /// \throw std::length_error if the size in bytes does not fit in size_t
+  Basic2dVector(std::size_t rows, std::size_t cols, DefaultInit,
+                RowPadding padding = RowPadding::NONE) {
+    create(rows, cols, padding, [](T *first, T *last) {
+      std::uninitialized_default_construct(first, last);
+    });
+  }
+
+  /// Copies elements and layout
+  Basic2dVector(const Basic2dVector &other) {
+    checkSize(other.mRows, other.mStride);
+    mRows = other.mRows;
+    mCols = other.mCols;
+    mStride = other.mStride;
+    allocate();
+    try {
+      std::uninitialized_copy_n(other.mData, capacity(), mData);
+    } catch (...) {
+      deallocate();
+      throw;
+    }
+  }
+
+  /// Takes the buffer, leaving other empty
+  Basic2dVector(Basic2dVector &&other) noexcept
+      : mData(std::exchange(other.mData, nullptr)),
+        mRows(std::exchange(other.mRows, 0)),
+        mCols(std::exchange(other.mCols, 0)),
+        mStride(std::exchange(other.mStride, 0)) {}
+
+  /// Copies elements and layout
+  Basic2dVector &operator=(const Basic2dVector &other) {
+    if (this != &other) {
+      Basic2dVector copy(other);
+      swap(copy);
+    }
+    return *this;
+  }
+
+  /// Takes the buffer, leaving other empty
+  Basic2dVector &operator=(Basic2dVector &&other) noexcept {
+    Basic2dVector moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+
+  ~Basic2dVector() {
+    std::destroy_n(mData, capacity());
+    deallocate();
+  }
+
+  /// Exchanges contents with another 2d vector
+  void swap(Basic2dVector &other) noexcept {
+    std::swap(mData, other.mData);
+    std::swap(mRows, other.mRows);
+    std::swap(mCols, other.mCols);
+    std::swap(mStride, other.mStride);
+  }
 
   /// Access by 2d index
   /// \param row first index
   /// \param col second index
   /// \return reference to element at given 2d index
   [[nodiscard]] T &operator[](std::size_t row, std::size_t col) {
-    return mData[row][col];
+    return mData[row * mStride + col];
   }
 
   /// Access by 2d index but return const reference
   [[nodiscard]] const T &operator[](std::size_t row, std::size_t col) const {
-    return mData[row][col];
+    return mData[row * mStride + col];
   }
 
   /// Access by 2d index with bounds checking (non const)
+  /// \throw std::out_of_range if the index is outside the grid
   [[nodiscard]] T &at(std::size_t row, std::size_t col) {
-    return mData.at(row).at(col);
+    if (row >= mRows || col >= mCols) {
+      throw std::out_of_range("Basic2dVector::at: index out of range");
+    }
+    return (*this)[row, col];
   }
 
   /// Access by 2d index with bounds checking (const)
+  /// \throw std::out_of_range if the index is outside the grid
   [[nodiscard]] const T &at(std::size_t row, std::size_t col) const {
-    return mData.at(row).at(col);
+    if (row >= mRows || col >= mCols) {
+      throw std::out_of_range("Basic2dVector::at: index out of range");
+    }
+    return (*this)[row, col];
   }
 
   /// \return number of rows
-  [[nodiscard]] std::size_t rows() const { return mData.size(); }
+  [[nodiscard]] std::size_t rows() const { return mRows; }
 
   /// \return number of cols
-  [[nodiscard]] std::size_t cols() const {
-    return mData.empty() ? 0 : mData.front().size();
+  [[nodiscard]] std::size_t cols() const { return mCols; }
+
+  /// \return elements from the start of one row to the next, at least cols
+  [[nodiscard]] std::size_t stride() const { return mStride; }
+
+  /// \return start of the buffer, aligned to cAlignment
+  [[nodiscard]] T *data() { return mData; }
+
+  /// \return start of the buffer, aligned to cAlignment (const)
+  [[nodiscard]] const T *data() const { return mData; }
+
+  /// \return contiguous elements of one row, without padding
+  [[nodiscard]] std::span<T> row(std::size_t index) {
+    return std::span<T>(mData + index * mStride, mCols);
+  }
+
+  /// \return contiguous elements of one row, without padding (const)
+  [[nodiscard]] std::span<const T> row(std::size_t index) const {
+    return std::span<const T>(mData + index * mStride, mCols);
+  }
+
+  /// \return elements of one column, stride() apart
+  [[nodiscard]] ColumnType col(std::size_t index) {
+    return ColumnType(mData + index, columnMapping());
+  }
+
+  /// \return elements of one column, stride() apart (const)
+  [[nodiscard]] ConstColumnType col(std::size_t index) const {
+    return ConstColumnType(mData + index, columnMapping());
+  }
+
+  /// \return 2d view of all elements, excluding padding
+  [[nodiscard]] MdspanType view() {
+    return MdspanType(mData, gridMapping());
+  }
+
+  /// \return 2d view of all elements, excluding padding (const)
+  [[nodiscard]] ConstMdspanType view() const {
+    return ConstMdspanType(mData, gridMapping());
   }
 };
 
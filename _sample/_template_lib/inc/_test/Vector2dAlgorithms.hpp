@@ -0,0 +1,353 @@
+#pragma once
+
+#include <_test/Vector2d.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace _test {
+
+/// \brief How an algorithm runs. Rows are split into one contiguous block
+/// per thread, so results never depend on the thread count.
+struct Execution {
+  std::size_t mThreads = 1; // 0 for all cores
+};
+
+/// Runs on the calling thread.
+inline constexpr Execution cSequential{1};
+
+/// Runs on all cores.
+inline constexpr Execution cParallel{0};
+
+/// Accuracy of sum().
+enum class Summation {
+  NAIVE,    // in order with a few accumulators, fastest
+  PAIRWISE, // error grows with log(n) instead of n
+  KAHAN,    // compensated, error independent of n
+};
+
+/// Elements per side of the square tiles of transpose() and stencil(), a
+/// tile of doubles read and one written together fit in L1.
+inline constexpr std::size_t cTileSize = 32;
+
+/// \brief Smallest and largest element, see minMax().
+template <typename T> struct MinMax {
+  T mMin;
+  T mMax;
+};
+
+namespace detail {
+
+/// Independent accumulators of the reductions, lane k handles every
+/// element at an index of k mod cLanes. The lanes vectorize without
+/// letting the compiler reassociate floating point math.
+inline constexpr std::size_t cLanes = 8;
+
+/// Elements at the base of a pairwise sum, summed with the lanes.
+inline constexpr std::size_t cPairwiseBlock = 256;
+
+/// Calls f(begin, end) for contiguous blocks covering [0, count), one per
+/// thread of exec. An exception is rethrown once all threads are done.
+template <typename F>
+void forBlocks(std::size_t count, Execution exec, const F &f) {
+  std::size_t threads = exec.mThreads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, count);
+  if (threads <= 1) {
+    if (count > 0) {
+      f(std::size_t{0}, count);
+    }
+    return;
+  }
+  std::vector<std::exception_ptr> errors(threads);
+  {
+    std::vector<std::jthread> pool;
+    pool.reserve(threads - 1);
+    auto const run = [&](std::size_t t) {
+      try {
+        f(count * t / threads, count * (t + 1) / threads);
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    };
+    for (std::size_t t = 1; t < threads; ++t) {
+      pool.emplace_back(run, t);
+    }
+    run(0);
+  }
+  for (const std::exception_ptr &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+/// \return sum in order of lanes, remaining elements added at the end
+template <typename T> T sumNaive(std::span<const T> values) {
+  std::array<T, cLanes> lanes{};
+  std::size_t i = 0;
+  for (; i + cLanes <= values.size(); i += cLanes) {
+    for (std::size_t k = 0; k < cLanes; ++k) {
+      lanes[k] += values[i + k];
+    }
+  }
+  T total{};
+  for (T lane : lanes) {
+    total += lane;
+  }
+  for (; i < values.size(); ++i) {
+    total += values[i];
+  }
+  return total;
+}
+
+/// \return sum of two halves, recursively, down to cPairwiseBlock elements
+template <typename T> T sumPairwise(std::span<const T> values) {
+  if (values.size() <= cPairwiseBlock) {
+    return sumNaive(values);
+  }
+  std::size_t const half = values.size() / 2 / cLanes * cLanes;
+  return sumPairwise(values.first(half)) + sumPairwise(values.subspan(half));
+}
+
+/// \return Kahan sum in each lane, the lanes then summed with Neumaier's
+/// variant so a large lane does not absorb small ones
+template <typename T> T sumKahan(std::span<const T> values) {
+  std::array<T, cLanes> sums{};
+  std::array<T, cLanes> compensations{};
+  std::size_t i = 0;
+  for (; i + cLanes <= values.size(); i += cLanes) {
+    for (std::size_t k = 0; k < cLanes; ++k) {
+      T const y = values[i + k] - compensations[k];
+      T const t = sums[k] + y;
+      compensations[k] = (t - sums[k]) - y;
+      sums[k] = t;
+    }
+  }
+  T sum{};
+  T compensation{};
+  auto const add = [&](T x) {
+    T const t = sum + x;
+    if (std::abs(sum) >= std::abs(x)) {
+      compensation += (sum - t) + x;
+    } else {
+      compensation += (x - t) + sum;
+    }
+    sum = t;
+  };
+  for (std::size_t k = 0; k < cLanes; ++k) {
+    add(sums[k]);
+    add(-compensations[k]);
+  }
+  for (; i < values.size(); ++i) {
+    add(values[i]);
+  }
+  return sum + compensation;
+}
+
+/// \return sum with the given accuracy, exact types are summed naively
+template <typename T> T sumSpan(std::span<const T> values, Summation mode) {
+  if constexpr (std::is_floating_point_v<T>) {
+    if (mode == Summation::PAIRWISE) {
+      return sumPairwise(values);
+    } else if (mode == Summation::KAHAN) {
+      return sumKahan(values);
+    }
+  }
+  return sumNaive(values);
+}
+
+/// \return smallest and largest of nonempty values
+template <typename T> MinMax<T> minMaxSpan(std::span<const T> values) {
+  std::array<T, cLanes> low;
+  std::array<T, cLanes> high;
+  low.fill(values[0]);
+  high.fill(values[0]);
+  std::size_t i = 0;
+  for (; i + cLanes <= values.size(); i += cLanes) {
+    for (std::size_t k = 0; k < cLanes; ++k) {
+      low[k] = values[i + k] < low[k] ? values[i + k] : low[k];
+      high[k] = high[k] < values[i + k] ? values[i + k] : high[k];
+    }
+  }
+  for (; i < values.size(); ++i) {
+    low[0] = values[i] < low[0] ? values[i] : low[0];
+    high[0] = high[0] < values[i] ? values[i] : high[0];
+  }
+  return MinMax<T>{*std::min_element(low.begin(), low.end()),
+                   *std::max_element(high.begin(), high.end())};
+}
+
+/// Throws unless two grids have the same shape
+template <typename A, typename B>
+void requireSameShape(const A &a, const B &b, const char *message) {
+  if (a.rows() != b.rows() || a.cols() != b.cols()) {
+    throw std::invalid_argument(message);
+  }
+}
+
+} // namespace detail
+
+/// Sets every element to f(row, col), row by row.
+/// \param grid grid to write
+/// \param f function of the 2d index returning the element
+/// \param exec threads to split the rows across
+template <Grid2d G, typename F>
+void generate(G &grid, const F &f, Execution exec = cSequential) {
+  detail::forBlocks(grid.rows(), exec, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      auto const row = grid.row(i);
+      for (std::size_t j = 0; j < row.size(); ++j) {
+        row[j] = f(i, j);
+      }
+    }
+  });
+}
+
+/// Sets every element to value.
+template <Grid2d G>
+void fill(G &grid, const typename G::value_type &value,
+          Execution exec = cSequential) {
+  detail::forBlocks(grid.rows(), exec, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      std::ranges::fill(grid.row(i), value);
+    }
+  });
+}
+
+/// Replaces every element x with f(x).
+template <Grid2d G, typename F>
+void transform(G &grid, const F &f, Execution exec = cSequential) {
+  detail::forBlocks(grid.rows(), exec, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      for (auto &x : grid.row(i)) {
+        x = f(x);
+      }
+    }
+  });
+}
+
+/// Sets every element of dst to f of the element of src at the same index.
+/// \throw std::invalid_argument if the shapes differ
+template <Grid2d G, Grid2d H, typename F>
+void transform(G &dst, const H &src, const F &f,
+               Execution exec = cSequential) {
+  detail::requireSameShape(dst, src, "transform: shapes differ");
+  detail::forBlocks(dst.rows(), exec, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      auto const out = dst.row(i);
+      auto const in = src.row(i);
+      for (std::size_t j = 0; j < out.size(); ++j) {
+        out[j] = f(in[j]);
+      }
+    }
+  });
+}
+
+/// Sums all elements. Each row is summed with the given accuracy, then the
+/// row sums are, so the result does not depend on the thread count.
+/// \param grid grid to sum
+/// \param mode accuracy for floating point types
+/// \param exec threads to split the rows across
+/// \return sum of all elements, 0 for an empty grid
+template <Grid2d G, typename T = typename G::value_type>
+T sum(const G &grid, Summation mode = Summation::PAIRWISE,
+      Execution exec = cSequential) {
+  std::vector<T> rowSums(grid.rows());
+  detail::forBlocks(grid.rows(), exec, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      rowSums[i] = detail::sumSpan(std::span<const T>(grid.row(i)), mode);
+    }
+  });
+  return detail::sumSpan(std::span<const T>(rowSums), mode);
+}
+
+/// Finds the smallest and largest element.
+/// \return smallest and largest element
+/// \throw std::invalid_argument if the grid is empty
+template <Grid2d G, typename T = typename G::value_type>
+MinMax<T> minMax(const G &grid, Execution exec = cSequential) {
+  if (grid.rows() == 0 || grid.cols() == 0) {
+    throw std::invalid_argument("minMax: grid is empty");
+  }
+  MinMax<T> const first{grid[0, 0], grid[0, 0]};
+  std::vector<MinMax<T>> rowResults(grid.rows(), first);
+  detail::forBlocks(grid.rows(), exec, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      rowResults[i] = detail::minMaxSpan(std::span<const T>(grid.row(i)));
+    }
+  });
+  MinMax<T> result = rowResults[0];
+  for (const MinMax<T> &row : rowResults) {
+    result.mMin = row.mMin < result.mMin ? row.mMin : result.mMin;
+    result.mMax = result.mMax < row.mMax ? row.mMax : result.mMax;
+  }
+  return result;
+}
+
+/// Transposes in square tiles so that both the rows read and the columns
+/// written stay in cache.
+/// \return grid with rows and columns exchanged
+template <Grid2d G, typename T = typename G::value_type>
+Basic2dVector<T> transpose(const G &grid, Execution exec = cSequential) {
+  Basic2dVector<T> result(grid.cols(), grid.rows(), cDefaultInit);
+  std::size_t const rowTiles = (grid.rows() + cTileSize - 1) / cTileSize;
+  detail::forBlocks(rowTiles, exec, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t ti = begin * cTileSize;
+         ti < std::min(end * cTileSize, grid.rows()); ti += cTileSize) {
+      std::size_t const iEnd = std::min(ti + cTileSize, grid.rows());
+      for (std::size_t tj = 0; tj < grid.cols(); tj += cTileSize) {
+        std::size_t const jEnd = std::min(tj + cTileSize, grid.cols());
+        for (std::size_t i = ti; i < iEnd; ++i) {
+          for (std::size_t j = tj; j < jEnd; ++j) {
+            result[j, i] = grid[i, j];
+          }
+        }
+      }
+    }
+  });
+  return result;
+}
+
+/// Sets dst[i, j] = f(src, i, j) for every index, visiting square tiles so
+/// the neighbors f reads around (i, j) are still in cache. Bounds near the
+/// edges are up to f.
+/// \param dst grid to write, the same shape as src and not src
+/// \param src grid to read
+/// \param f function of src and the 2d index returning the element
+/// \param exec threads to split the row tiles across
+/// \throw std::invalid_argument if the shapes differ or dst is src
+template <Grid2d G, Grid2d H, typename F>
+void stencil(G &dst, const H &src, const F &f, Execution exec = cSequential) {
+  detail::requireSameShape(dst, src, "stencil: shapes differ");
+  if (static_cast<const void *>(&dst) == static_cast<const void *>(&src)) {
+    throw std::invalid_argument("stencil: cannot update in place");
+  }
+  std::size_t const rowTiles = (src.rows() + cTileSize - 1) / cTileSize;
+  detail::forBlocks(rowTiles, exec, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t ti = begin * cTileSize;
+         ti < std::min(end * cTileSize, src.rows()); ti += cTileSize) {
+      std::size_t const iEnd = std::min(ti + cTileSize, src.rows());
+      for (std::size_t tj = 0; tj < src.cols(); tj += cTileSize) {
+        std::size_t const jEnd = std::min(tj + cTileSize, src.cols());
+        for (std::size_t i = ti; i < iEnd; ++i) {
+          for (std::size_t j = tj; j < jEnd; ++j) {
+            dst[i, j] = f(src, i, j);
+          }
+        }
+      }
+    }
+  });
+}
+
+} // namespace _test
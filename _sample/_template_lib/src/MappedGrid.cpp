@@ -0,0 +1,179 @@
+#include <_test/MappedGrid.hpp>
+
+#if TEST
+
+#include <tkoz/SRTest.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h> // getpid
+
+namespace {
+
+/// Grid file in the temporary directory, removed when destroyed
+class TempFile {
+private:
+  std::string mPath;
+
+public:
+  explicit TempFile(const std::string &name)
+      : mPath((std::filesystem::temp_directory_path() /
+               ("srtest-" + std::to_string(getpid()) + "-" + name + ".grid"))
+                  .string()) {}
+  ~TempFile() {
+    std::error_code error;
+    std::filesystem::remove(mPath, error);
+  }
+  TempFile(const TempFile &) = delete;
+  TempFile &operator=(const TempFile &) = delete;
+
+  const std::string &path() const { return mPath; }
+};
+
+/// Rewrites the header of a grid file, optionally cutting the file to size
+void patchHeader(const std::string &path,
+                 const std::function<void(_test::GridFileHeader &)> &patch,
+                 std::size_t size = std::numeric_limits<std::size_t>::max()) {
+  std::vector<char> bytes;
+  {
+    std::ifstream in(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  _test::GridFileHeader header;
+  std::memcpy(&header, bytes.data(), sizeof header);
+  patch(header);
+  std::memcpy(bytes.data(), &header, sizeof header);
+  bytes.resize(std::min(size, bytes.size()));
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+/// Test grid with a distinct value at each index
+_test::Basic2dVector<int32_t> makeGrid(std::size_t rows, std::size_t cols) {
+  _test::Basic2dVector<int32_t> grid(rows, cols);
+  for (std::size_t i = 0; i < rows; ++i) {
+    for (std::size_t j = 0; j < cols; ++j) {
+      grid[i, j] = static_cast<int32_t>(i * 1000 + j);
+    }
+  }
+  return grid;
+}
+
+} // namespace
+
+TEST_CREATE(roundTrip) {
+  TempFile const file("roundTrip");
+  _test::Basic2dVector<int32_t> const grid = makeGrid(9, 21);
+  for (auto padding : {_test::RowPadding::NONE, _test::RowPadding::ALIGNED}) {
+    _test::writeGrid(file.path(), grid, padding);
+    auto const mapped = _test::MappedGrid<const int32_t>::open(file.path());
+    TEST_REQUIRE_EQ(mapped.rows(), grid.rows());
+    TEST_REQUIRE_EQ(mapped.cols(), grid.cols());
+    TEST_REQUIRE(mapped.mode() == _test::MapMode::READ_ONLY);
+    if (padding == _test::RowPadding::ALIGNED) {
+      TEST_REQUIRE_EQ(mapped.stride() * sizeof(int32_t) %
+                          _test::cCacheLineSize,
+                      0);
+      TEST_REQUIRE_EQ(reinterpret_cast<uintptr_t>(mapped.row(1).data()) %
+                          _test::cCacheLineSize,
+                      0);
+    } else {
+      TEST_REQUIRE_EQ(mapped.stride(), grid.cols());
+    }
+    for (std::size_t i = 0; i < grid.rows(); ++i) {
+      for (std::size_t j = 0; j < grid.cols(); ++j) {
+        TEST_REQUIRE_EQ(mapped.at(i, j), (grid[i, j]));
+      }
+    }
+    TEST_REQUIRE_THROW((void)mapped.at(9, 0), std::out_of_range);
+    _test::Basic2dVector<int32_t> const copy = mapped.toVector();
+    TEST_REQUIRE_EQ(copy.rows(), grid.rows());
+    TEST_REQUIRE((copy[8, 20]) == (grid[8, 20]));
+  }
+}
+
+TEST_CREATE(copyOnWriteLeavesFile) {
+  TempFile const file("copyOnWrite");
+  _test::writeGrid(file.path(), makeGrid(3, 4));
+  {
+    auto const mapped = _test::MappedGrid<int32_t>::open(file.path());
+    TEST_REQUIRE(mapped.mode() == _test::MapMode::COPY_ON_WRITE);
+    mapped[1, 2] = -5;
+    TEST_REQUIRE_EQ((mapped[1, 2]), -5);
+  }
+  auto const reopened = _test::MappedGrid<const int32_t>::open(file.path());
+  TEST_REQUIRE_EQ((reopened[1, 2]), 1002);
+  TEST_REQUIRE_THROW((void)_test::MappedGrid<int32_t>::open(
+                         file.path(), _test::MapMode::READ_ONLY),
+                     std::invalid_argument);
+  TEST_REQUIRE_THROW((void)_test::MappedGrid<const int32_t>::open(
+                         file.path(), _test::MapMode::READ_WRITE),
+                     std::invalid_argument);
+}
+
+TEST_CREATE(createFlushReopen) {
+  TempFile const file("create");
+  {
+    auto grid = _test::MappedGrid<double>::create(file.path(), 5, 7,
+                                                  _test::RowPadding::ALIGNED);
+    TEST_REQUIRE(grid.mode() == _test::MapMode::READ_WRITE);
+    TEST_REQUIRE_EQ((grid[4, 6]), 0.0);
+    grid[4, 6] = 2.5;
+    grid[0, 0] = -1.0;
+    grid.flush();
+  }
+  auto const reopened = _test::MappedGrid<const double>::open(file.path());
+  TEST_REQUIRE_EQ(reopened.rows(), 5);
+  TEST_REQUIRE_EQ(reopened.cols(), 7);
+  TEST_REQUIRE_EQ((reopened[4, 6]), 2.5);
+  TEST_REQUIRE_EQ((reopened[0, 0]), -1.0);
+  TEST_REQUIRE_EQ((reopened[2, 3]), 0.0);
+}
+
+TEST_CREATE(rejectedHeaders) {
+  TempFile const file("rejected");
+  auto const require = [&](const std::function<void(_test::GridFileHeader &)>
+                               &patch,
+                           std::size_t size) {
+    _test::writeGrid(file.path(), makeGrid(6, 10));
+    patchHeader(file.path(), patch, size);
+    TEST_REQUIRE_THROW((void)_test::MappedGrid<const int32_t>::open(
+                           file.path()),
+                       std::runtime_error);
+  };
+  auto const keep = [](_test::GridFileHeader &) {};
+  std::size_t const whole = std::numeric_limits<std::size_t>::max();
+  require([](_test::GridFileHeader &h) { h.mMagic[0] = 'X'; }, whole);
+  require([](_test::GridFileHeader &h) { h.mByteOrder = 0x04030201; }, whole);
+  require([](_test::GridFileHeader &h) { ++h.mVersion; }, whole);
+  require(
+      [](_test::GridFileHeader &h) { h.mElement = _test::GridElement::UINT32; },
+      whole);
+  require([](_test::GridFileHeader &h) { h.mStride = h.mCols - 1; }, whole);
+  require([](_test::GridFileHeader &h) { h.mRows = uint64_t(1) << 62; },
+          whole);
+  require(keep, sizeof(_test::GridFileHeader) - 1);
+  // the last row is cut short
+  require(keep, sizeof(_test::GridFileHeader) + 6 * 10 * sizeof(int32_t) - 1);
+
+  // another element type of the same size
+  _test::writeGrid(file.path(), makeGrid(2, 2));
+  TEST_REQUIRE_THROW((void)_test::MappedGrid<const float>::open(file.path()),
+                     std::runtime_error);
+  TEST_REQUIRE_THROW((void)_test::MappedGrid<const int32_t>::open(
+                         file.path() + ".missing"),
+                     std::system_error);
+}
+
+#endif // TEST
@@ -0,0 +1,94 @@
+#include <_test/Vector2d.hpp>
+
+#if TEST
+
+#include <tkoz/SRTest.hpp>
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+
+/// \return true if p is aligned to a cache line
+bool aligned(const void *p) {
+  return reinterpret_cast<std::uintptr_t>(p) % _test::cCacheLineSize == 0;
+}
+
+} // namespace
+
+TEST_CREATE(paddingAndStride) {
+  _test::Basic2dVector<double> padded(3, 5, 1.5, _test::RowPadding::ALIGNED);
+  TEST_REQUIRE_EQ(padded.rows(), 3);
+  TEST_REQUIRE_EQ(padded.cols(), 5);
+  TEST_REQUIRE_EQ(padded.stride(), 8);
+  for (std::size_t i = 0; i < padded.rows(); ++i) {
+    TEST_REQUIRE(aligned(padded.row(i).data()));
+    TEST_REQUIRE_EQ(padded.row(i).size(), 5);
+    for (double x : padded.row(i)) {
+      TEST_REQUIRE_EQ(x, 1.5);
+    }
+  }
+  padded[2, 4] = 7.0;
+  TEST_REQUIRE_EQ(padded.data()[2 * padded.stride() + 4], 7.0);
+  TEST_REQUIRE_EQ(padded.col(4)[2], 7.0);
+  double const viewed = padded.view()[2, 4];
+  TEST_REQUIRE_EQ(viewed, 7.0);
+
+  _test::Basic2dVector<double> unpadded(3, 5);
+  TEST_REQUIRE_EQ(unpadded.stride(), 5);
+  TEST_REQUIRE(aligned(unpadded.data()));
+  // a cache line is not a whole number of elements, so rows are not padded
+  using Triple = std::array<char, 3>;
+  _test::Basic2dVector<Triple> odd(2, 5, Triple{}, _test::RowPadding::ALIGNED);
+  TEST_REQUIRE_EQ(odd.stride(), 5);
+}
+
+TEST_CREATE(copyAndMove) {
+  _test::Basic2dVector<std::string> grid(2, 3, "x", _test::RowPadding::ALIGNED);
+  grid[1, 2] = "y";
+  _test::Basic2dVector<std::string> copy(grid);
+  TEST_REQUIRE_EQ(copy.stride(), grid.stride());
+  TEST_REQUIRE((copy[1, 2] == "y"));
+  copy[0, 0] = "z";
+  TEST_REQUIRE((grid[0, 0] == "x"));
+
+  _test::Basic2dVector<std::string> moved(std::move(copy));
+  TEST_REQUIRE((moved[0, 0] == "z"));
+  TEST_REQUIRE_EQ(copy.rows(), 0);
+  TEST_REQUIRE(copy.data() == nullptr);
+
+  moved = grid;
+  TEST_REQUIRE((moved[0, 0] == "x"));
+  moved = std::move(grid);
+  TEST_REQUIRE((moved[1, 2] == "y"));
+  TEST_REQUIRE_EQ(moved.cols(), 3);
+}
+
+TEST_CREATE(boundsChecked) {
+  _test::Basic2dVector<int> grid(3, 4, 0);
+  grid.at(2, 3) = 5;
+  TEST_REQUIRE_EQ((grid[2, 3]), 5);
+  TEST_REQUIRE_THROW(static_cast<void>(grid.at(3, 0)), std::out_of_range);
+  TEST_REQUIRE_THROW(static_cast<void>(grid.at(0, 4)), std::out_of_range);
+  const _test::Basic2dVector<int> &constGrid = grid;
+  TEST_REQUIRE_THROW(static_cast<void>(constGrid.at(3, 4)),
+                     std::out_of_range);
+
+  // the size in bytes wraps around, as from a negative size on the command
+  // line, so nothing may be allocated
+  auto const huge = std::numeric_limits<std::size_t>::max();
+  TEST_REQUIRE_THROW(
+      _test::Basic2dVector<double>(huge, huge, _test::cDefaultInit),
+      std::length_error);
+  TEST_REQUIRE_THROW(
+      _test::Basic2dVector<double>(2, huge, 0.0, _test::RowPadding::ALIGNED),
+      std::length_error);
+  _test::Basic2dVector<double> const empty(0, huge, _test::cDefaultInit);
+  TEST_REQUIRE_EQ(empty.rows(), 0);
+}
+
+#endif // TEST
@@ -0,0 +1,146 @@
+#include <_test/Vector2dAlgorithms.hpp>
+
+#if TEST
+
+#include <tkoz/SRTest.hpp>
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+/// Element at a 2d index of the test grids, not exactly representable
+double element(std::size_t i, std::size_t j) {
+  return 1.0 / static_cast<double>(i + 2 * j + 1);
+}
+
+/// Thread counts which each split the rows differently
+constexpr std::array<_test::Execution, 4> cExecutions{
+    _test::cSequential, _test::Execution{2}, _test::Execution{5},
+    _test::cParallel};
+
+} // namespace
+
+TEST_CREATE(sumModes) {
+  _test::Basic2dVector<int64_t> ints(37, 300, 3);
+  for (auto mode : {_test::Summation::NAIVE, _test::Summation::PAIRWISE,
+                    _test::Summation::KAHAN}) {
+    TEST_REQUIRE_EQ(_test::sum(ints, mode), 37 * 300 * 3);
+  }
+  TEST_REQUIRE_EQ(_test::sum(_test::Basic2dVector<double>()), 0.0);
+
+  // each 1 is lost when added to 1e16 without compensation
+  std::size_t const ones = 1000;
+  _test::Basic2dVector<double> grid(1, ones + 1, 1.0);
+  grid[0, 0] = 1e16;
+  double const exact = 1e16 + static_cast<double>(ones);
+  TEST_REQUIRE_EQ(_test::sum(grid, _test::Summation::KAHAN), exact);
+  TEST_REQUIRE_LT(_test::sum(grid, _test::Summation::NAIVE), exact);
+  TEST_REQUIRE_CLOSE_ABS(_test::sum(grid, _test::Summation::PAIRWISE), exact,
+                         static_cast<double>(ones));
+}
+
+TEST_CREATE(minMaxAndEmpty) {
+  _test::Basic2dVector<double> grid(40, 33, 0.0, _test::RowPadding::ALIGNED);
+  _test::generate(grid, element);
+  grid[17, 32] = -4.0;
+  grid[39, 0] = 9.0;
+  for (_test::Execution exec : cExecutions) {
+    auto const [low, high] = _test::minMax(grid, exec);
+    TEST_REQUIRE_EQ(low, -4.0);
+    TEST_REQUIRE_EQ(high, 9.0);
+  }
+  _test::Basic2dVector<double> const empty(3, 0);
+  TEST_REQUIRE_THROW(_test::minMax(empty), std::invalid_argument);
+}
+
+TEST_CREATE(transposeTiles) {
+  // not a whole number of tiles in either direction
+  std::size_t const rows = _test::cTileSize * 2 + 7;
+  std::size_t const cols = _test::cTileSize + 13;
+  _test::Basic2dVector<double> grid(rows, cols, 0.0,
+                                    _test::RowPadding::ALIGNED);
+  _test::generate(grid, element);
+  for (_test::Execution exec : cExecutions) {
+    _test::Basic2dVector<double> const result = _test::transpose(grid, exec);
+    TEST_REQUIRE_EQ(result.rows(), cols);
+    TEST_REQUIRE_EQ(result.cols(), rows);
+    for (std::size_t i = 0; i < rows; ++i) {
+      for (std::size_t j = 0; j < cols; ++j) {
+        TEST_REQUIRE_EQ((result[j, i]), (grid[i, j]));
+      }
+    }
+  }
+}
+
+TEST_CREATE(stencilAverage) {
+  std::size_t const rows = _test::cTileSize + 5;
+  std::size_t const cols = _test::cTileSize * 2 + 1;
+  _test::Basic2dVector<double> src(rows, cols);
+  _test::generate(src, element);
+  // average of the element and its neighbors in the grid
+  auto const average = [](const _test::Basic2dVector<double> &g,
+                          std::size_t i, std::size_t j) {
+    double total = g[i, j];
+    int count = 1;
+    if (i > 0) {
+      total += g[i - 1, j];
+      ++count;
+    }
+    if (i + 1 < g.rows()) {
+      total += g[i + 1, j];
+      ++count;
+    }
+    if (j > 0) {
+      total += g[i, j - 1];
+      ++count;
+    }
+    if (j + 1 < g.cols()) {
+      total += g[i, j + 1];
+      ++count;
+    }
+    return total / count;
+  };
+  for (_test::Execution exec : cExecutions) {
+    _test::Basic2dVector<double> dst(rows, cols, -1.0);
+    _test::stencil(dst, src, average, exec);
+    for (std::size_t i = 0; i < rows; ++i) {
+      for (std::size_t j = 0; j < cols; ++j) {
+        TEST_REQUIRE_EQ((dst[i, j]), average(src, i, j));
+      }
+    }
+  }
+  TEST_REQUIRE_THROW(_test::stencil(src, src, average), std::invalid_argument);
+  _test::Basic2dVector<double> other(rows, cols + 1);
+  TEST_REQUIRE_THROW(_test::stencil(other, src, average),
+                     std::invalid_argument);
+}
+
+TEST_CREATE(sameResultsOnAnyThreads) {
+  _test::Basic2dVector<double> reference(301, 203);
+  _test::generate(reference, element);
+  for (auto mode : {_test::Summation::NAIVE, _test::Summation::PAIRWISE,
+                    _test::Summation::KAHAN}) {
+    double const expected = _test::sum(reference, mode);
+    for (_test::Execution exec : cExecutions) {
+      _test::Basic2dVector<double> grid(301, 203, 0.0,
+                                        _test::RowPadding::ALIGNED);
+      _test::generate(grid, element, exec);
+      // bitwise equal, the rows are summed alike and combined in order
+      TEST_REQUIRE_EQ(_test::sum(grid, mode, exec), expected);
+    }
+  }
+  for (_test::Execution exec : cExecutions) {
+    _test::Basic2dVector<double> grid(301, 203);
+    _test::fill(grid, 2.0, exec);
+    _test::transform(grid, [](double x) { return x * 3.0; }, exec);
+    _test::Basic2dVector<double> copy(301, 203);
+    _test::transform(copy, grid, [](double x) { return x + 1.0; }, exec);
+    auto const [low, high] = _test::minMax(copy, exec);
+    TEST_REQUIRE_EQ(low, 7.0);
+    TEST_REQUIRE_EQ(high, 7.0);
+  }
+}
+
+#endif // TEST
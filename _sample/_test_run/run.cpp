@@ -1,2 +1 @@
-#define TKOZ_SRTEST_MAIN
-#include <tkoz/SRTest.hpp>
+#include <tkoz/SRTestMain.hpp>
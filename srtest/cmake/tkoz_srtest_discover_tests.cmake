@@ -0,0 +1,73 @@
+# Run with cmake -P after building a test runner (see
+# tkoz_srtest_discover_tests in srtest/CMakeLists.txt). Lists the tests of
+# RUNNER and writes a CTest file adding them in batches. The other arguments
+# are set by the file CONFIG.
+include("${CONFIG}")
+
+execute_process(
+    COMMAND "${RUNNER}" --list --no-state
+    WORKING_DIRECTORY "${WORKING_DIRECTORY}"
+    OUTPUT_VARIABLE list_output
+    ERROR_VARIABLE list_error
+    RESULT_VARIABLE list_result
+)
+if(NOT list_result EQUAL 0)
+    message(FATAL_ERROR
+        "Failed to list tests of ${RUNNER} (${list_result}):\n${list_error}")
+endif()
+
+# Group the tests by their tags in the order of the list (canonical order, so
+# a batch usually holds tests of the same file). Each line is
+# "line tags file:name".
+set(tag_groups "")
+string(REPLACE "\n" ";" list_lines "${list_output}")
+foreach(line IN LISTS list_lines)
+    if(NOT line MATCHES "^[0-9]+ ([^ ]+) (.+)$")
+        continue()
+    endif()
+    string(REPLACE "," "_" group "${CMAKE_MATCH_1}")
+    if(NOT DEFINED "tests_${group}")
+        list(APPEND tag_groups "${CMAKE_MATCH_1}")
+        set("tests_${group}" "")
+    endif()
+    list(APPEND "tests_${group}" "${CMAKE_MATCH_2}")
+endforeach()
+
+set(content "# Generated by tkoz_srtest_discover_tests.cmake, do not edit\n")
+foreach(tags IN LISTS tag_groups)
+    string(REPLACE "," "_" group "${tags}")
+    set(tests_var "tests_${group}")
+    if(tags STREQUAL "-")
+        set(group "untagged")
+        set(labels "")
+    else()
+        string(REPLACE "," ";" labels "${tags}")
+    endif()
+    list(LENGTH "${tests_var}" count)
+    set(batch 0)
+    set(begin 0)
+    while(begin LESS count)
+        list(SUBLIST "${tests_var}" ${begin} ${BATCH_SIZE} paths)
+        set(name "${TARGET}/${group}/${batch}")
+        # Continue after a failure so every test of the batch is reported
+        set(command "[==[${RUNNER}]==] --no-state -c")
+        foreach(arg IN LISTS EXTRA_ARGS paths)
+            string(APPEND command " [==[${arg}]==]")
+        endforeach()
+        string(APPEND content
+            "add_test([==[${name}]==] ${command})\n"
+            "set_tests_properties([==[${name}]==] PROPERTIES\n"
+            "    WORKING_DIRECTORY [==[${WORKING_DIRECTORY}]==]\n"
+            "    LABELS [==[${labels}]==])\n")
+        math(EXPR batch "${batch} + 1")
+        math(EXPR begin "${begin} + ${BATCH_SIZE}")
+    endwhile()
+endforeach()
+
+# Only touch the file when the tests change so CTest output stays stable
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" old_content)
+endif()
+if(NOT content STREQUAL "${old_content}")
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
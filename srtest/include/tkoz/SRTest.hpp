@@ -10,20 +10,29 @@
 
 #pragma once
 
-#include <bitset>
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cmath>
 #include <compare>
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
 #include <exception>
-#include <memory>
+#include <format>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <ranges>
 #include <source_location>
+#include <span>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <tuple>
 #include <typeinfo>
 #include <utility>
+#include <variant>
 #include <vector>
 
 /// Statically registered test library. The contents of this namespace are not
@@ -37,27 +46,55 @@ namespace tkoz::srtest {
 
 using TestFunction = void (*)();
 
-/// \brief Collection of tags assigned to a test case.
+/// Tags built into the library, as an "x macro" calling X(name) for each.
+#define TKOZ_SRTEST_BUILTIN_TAGS(X) X(FAST) X(SLOW) X(BENCH) X(PROPERTY)
+
+/// Extra tags for a project, defined the same way as the built in tags, for
+/// example -D'TKOZ_SRTEST_USER_TAGS(X)=X(NETWORK) X(GPU)'. It must be the same
+/// for every translation unit of a test runner.
+#ifndef TKOZ_SRTEST_USER_TAGS
+#define TKOZ_SRTEST_USER_TAGS(X)
+#endif
+
+#define TKOZ_SRTEST_INTERNAL_TAG_ENUM(name) name,
+
+/// \brief Collection of tags assigned to a test case, as a bit mask indexed by
+/// \c TagEnum so tag filters are a few bitwise operations per test.
 class TestTags final {
 private:
-  static constexpr std::size_t cMaxTags = 2;
-  std::bitset<cMaxTags> mTagBits;
-  inline TestTags() = default;
+  static constexpr std::size_t cMaxTags = 64;
+  std::uint64_t mTagBits = 0;
+  inline constexpr TestTags() = default;
 
 public:
-  /// Tags available for a test. We intentionally avoid enum class so they are
-  /// conveniently accessible within this class.
+  /// Tags available for a test, the built in tags then the user tags (see
+  /// \c TKOZ_SRTEST_USER_TAGS ). We intentionally avoid enum class so they
+  /// are conveniently accessible within this class.
   /// Note: TAG_COUNT must be at the end. Use automatic enum values only.
-  /// TODO consider the "x macro" design pattern. The main tag list would be
-  /// defined by a macro elsewhere and inserted here with TAG_COUNT after it.
-  enum TagEnum : std::uint16_t { FAST, SLOW, TAG_COUNT };
+  enum TagEnum : std::uint16_t {
+    TKOZ_SRTEST_BUILTIN_TAGS(TKOZ_SRTEST_INTERNAL_TAG_ENUM)
+        TKOZ_SRTEST_USER_TAGS(TKOZ_SRTEST_INTERNAL_TAG_ENUM) TAG_COUNT
+  };
 
-  static_assert(static_cast<std::size_t>(TAG_COUNT) == cMaxTags);
+  static_assert(static_cast<std::size_t>(TAG_COUNT) <= cMaxTags,
+                "too many test tags, at most 64 are supported");
 
   /// Get a string name for a tag.
   /// \return A string name for a tag.
   [[nodiscard]] static auto tagString(TagEnum aTag) -> std::string const &;
 
+  /// Find a tag by its name.
+  /// \param aName The name, as written in the enum.
+  /// \return The tag, or nothing if there is no tag with this name.
+  [[nodiscard]] static auto fromString(std::string_view aName)
+      -> std::optional<TagEnum>;
+
+  /// \return The bit for a tag in \c mask .
+  [[nodiscard]] static inline constexpr auto bit(TagEnum aTag) noexcept
+      -> std::uint64_t {
+    return std::uint64_t{1} << static_cast<std::size_t>(aTag);
+  }
+
   /// Create a compile time object for tags assigned to a test.
   /// \tparam cTagsT The tags specified
   template <TagEnum... cTagsT>
@@ -65,7 +102,7 @@ public:
     static_assert(((cTagsT != TAG_COUNT) && ...),
                   "TAG_COUNT is reserved and not a valid test tag");
     TestTags result;
-    (result.mTagBits.set(static_cast<std::size_t>(cTagsT)), ...);
+    result.mTagBits = (std::uint64_t{0} | ... | bit(cTagsT));
     return result;
   }
 
@@ -76,7 +113,7 @@ public:
   // template <typename... TestTagT>
   //   requires(std::is_same_v<TestTagT, TagEnum> && ...)
   //[[nodiscard]] inline constexpr TestTags(TestTagT... tags) noexcept {
-  //   (mTagBits.set(static_cast<std::size_t>(tags)), ...);
+  //   mTagBits = (std::uint64_t{0} | ... | bit(tags));
   // }
 
   /// Test if a tag is set.
@@ -84,7 +121,12 @@ public:
   /// \return True if \c tag is set.
   [[nodiscard]] inline constexpr auto hasTag(TagEnum aTag) const noexcept
       -> bool {
-    return mTagBits.test(static_cast<std::size_t>(aTag));
+    return (mTagBits & bit(aTag)) != 0;
+  }
+
+  /// \return The tags as a bit mask with the bit of each tag (see \c bit ).
+  [[nodiscard]] inline constexpr auto mask() const noexcept -> std::uint64_t {
+    return mTagBits;
   }
 
   /// List all tags which are set. They are ordered as they appear in the enum
@@ -99,47 +141,88 @@ namespace tests {
 using enum ::tkoz::srtest::TestTags::TagEnum;
 } // namespace tests
 
-/// Remove the repo root path from a test filename.
-/// \param aFullPath The full file path from the \c __FILE__ macro
-/// \return The path with the repo root removed.
-[[nodiscard]] auto testFilePath(std::string_view aFullPath) -> std::string;
+// These are intentionally not constexpr and never defined. Reaching one
+// while evaluating testFilePath makes a compile error naming the problem.
+namespace internal {
+void testPathNotInSourceRoot();
+void testPathWrongExtension();
+void testPathEmpty();
+void testPathContainsColon();
+} // namespace internal
 
-/// \brief The data associated with a single test.
+/// Remove the repo root path and source extension from a test filename. This
+/// is done at compile time so an invalid path is a compile error rather than
+/// a failure during static initialization. The result views the string from
+/// \c std::source_location so it needs no storage of its own.
+/// \param aSrcLoc Location of the test definition.
+/// \return The path with the repo root and extension removed.
+[[nodiscard]] consteval auto testFilePath(std::source_location aSrcLoc)
+    -> std::string_view {
+#if !defined(TKOZ_SRTEST_SOURCE_ROOT) || !defined(TKOZ_SRTEST_SOURCE_EXT)
+#error "Tests must be compiled with the definitions from the tkoz-srtest target"
+#endif
+  std::string_view const lFullPath = aSrcLoc.file_name();
+  std::string_view const lRoot = TKOZ_SRTEST_SOURCE_ROOT;
+  std::string_view const lExt = TKOZ_SRTEST_SOURCE_EXT;
+  if (!lFullPath.starts_with(lRoot)) {
+    internal::testPathNotInSourceRoot();
+  }
+  if (!lFullPath.ends_with(lExt)) {
+    internal::testPathWrongExtension();
+  }
+  if (lFullPath.size() <= lRoot.size() + lExt.size()) {
+    internal::testPathEmpty();
+  }
+  if (lFullPath.find(':') != std::string_view::npos) {
+    internal::testPathContainsColon();
+  }
+  return lFullPath.substr(lRoot.size(),
+                          lFullPath.size() - lRoot.size() - lExt.size());
+}
+
+/// \brief The data associated with a single test. This is a small record
+/// which does not own its strings so the registry can store all tests in one
+/// array. The name refers to a string literal from the test creation macro
+/// and the file refers to the static file name string of its source location
+/// (see \c testFilePath ).
 struct TestCaseInfo final {
   TestCaseInfo() = delete;
 
   /// Create info for a test case.
   /// \param aFunc The function to run the test.
-  /// \param aName The name of the test.
-  /// \param aFile The file containing the test.
+  /// \param aName The name of the test, must outlive the test info.
+  /// \param aFile The file containing the test, must outlive the test info.
   /// \param aLine The line number of the test.
   /// \param aTags The tags assigned to the test.
-  [[nodiscard]] inline TestCaseInfo(TestFunction aFunc, std::string aName,
-                                    std::string const &aFile, std::size_t aLine,
-                                    TestTags aTags)
-      : mFunc(aFunc), mName(std::move(aName)), mFile(testFilePath(aFile)),
-        mLine(aLine), mTags(aTags) {}
+  [[nodiscard]] inline constexpr TestCaseInfo(TestFunction aFunc,
+                                              std::string_view aName,
+                                              std::string_view aFile,
+                                              std::size_t aLine,
+                                              TestTags aTags) noexcept
+      : mFunc(aFunc), mName(aName), mFile(aFile), mLine(aLine), mTags(aTags) {}
 
   TestCaseInfo(TestCaseInfo const &) = default;
   TestCaseInfo(TestCaseInfo &&) = default;
+  TestCaseInfo &operator=(TestCaseInfo const &) = default;
+  TestCaseInfo &operator=(TestCaseInfo &&) = default;
 
   /// Call the test function.
   inline void run() const { mFunc(); }
 
   /// Function object to run the test.
-  TestFunction const mFunc;
+  TestFunction mFunc;
 
   /// Name/identifier for the test.
-  std::string const mName;
+  std::string_view mName;
 
   /// File containing the test
-  std::string const mFile;
+  std::string_view mFile;
 
   /// Line where test is defined
-  std::size_t const mLine;
+  std::size_t mLine;
 
   /// Test tags
-  TestTags const mTags;
+  TestTags mTags;
 
   /// Define the canonical ordering of tests to be first by file, then by the
   /// order they are defined within a file (line number).
@@ -153,10 +236,13 @@ struct TestCaseInfo final {
     -> std::strong_ordering;
 
 /// \brief The registry storing all statically registered tests.
+///
+/// Tests are stored by value in a single array. Their strings are resolved at
+/// compile time so registering a test only allocates when the array grows.
 class TestRegistry final {
 private:
   /// All tests that have been registered.
-  std::vector<std::unique_ptr<TestCaseInfo>> mAllTests;
+  std::vector<TestCaseInfo> mAllTests;
 
   // This class is a singleton.
   TestRegistry() = default;
@@ -171,12 +257,13 @@ public:
   /// \note This guarantees initialization on first use. TestRegistrar objects
   /// should be the only ones to call this during static initialization.
   /// To avoid destruction order issues with static variables, nothing should
-  /// access this after termination of main().
+  /// access this after termination of main(). References to tests are only
+  /// stable once static initialization has finished.
   [[nodiscard]] static auto instance() noexcept -> TestRegistry &;
 
   /// \return All tests contained in the registry.
   [[nodiscard]] inline auto allTests() const noexcept
-      -> std::vector<std::unique_ptr<TestCaseInfo>> const & {
+      -> std::vector<TestCaseInfo> const & {
     return mAllTests;
   }
 
@@ -197,29 +284,29 @@ public:
   }
 
   /// Add a test to the registry.
-  /// \param aFunc Function object for running the test.
-  /// \param aName Name/identifier for the test.
-  /// \param aFile The file containing the test.
-  /// \param aLine Line where the test is defined.
-  /// \param aTags Tags assigned to the test.
-  inline void addTest(TestFunction aFunc, std::string aName, std::string aFile,
-                      std::size_t aLine, TestTags aTags) {
-    mAllTests.push_back(std::make_unique<TestCaseInfo>(
-        aFunc, std::move(aName), std::move(aFile), aLine, aTags));
+  /// \param aTest The test, with strings that outlive the registry.
+  inline void addTest(TestCaseInfo const &aTest) {
+    mAllTests.push_back(aTest);
+  }
+
+  /// Add tests to the registry with a single insertion.
+  /// \param aTests The tests, with strings that outlive the registry.
+  inline void addTests(std::span<TestCaseInfo const> aTests) {
+    mAllTests.insert(mAllTests.end(), aTests.begin(), aTests.end());
   }
+
+  /// Sort the tests in canonical order (see \c TestCaseInfo ). Call this after
+  /// static initialization, it invalidates references to tests. The sort is
+  /// stable so rows of a parameterized test, which share a line, stay in
+  /// order.
+  void sort();
 };
 
 /// Register a test with a function call rather than a static object.
 /// For convenience, usually you would use the TEST_CREATE macro.
-/// \param aFunc A function object used to run the test.
-/// \param aName A string identifier for the test.
-/// \param aFile File containing the test.
-/// \param aLine Line where test is defined.
-/// \param aTags Tags assigned to the test.
-inline void registerTest(TestFunction aFunc, std::string aName,
-                         std::string aFile, std::size_t aLine, TestTags aTags) {
-  TestRegistry::instance().addTest(aFunc, std::move(aName), std::move(aFile),
-                                   aLine, aTags);
+/// \param aTest The test, with strings that outlive the registry.
+inline void registerTest(TestCaseInfo const &aTest) {
+  TestRegistry::instance().addTest(aTest);
 }
 
 /// \brief A class for registering tests. Create a static instance of this
@@ -230,17 +317,112 @@ public:
   TestRegistrar() = delete;
 
   /// This constructor adds a test to the test registry.
-  /// \param aFunc The function object to run the test.
-  /// \param aName A name/identifier for the test.
-  /// \param aFile File where test is defined.
-  /// \param aLine Line where test is defined.
-  /// \param aTags Tags assigned to the test.
-  TestRegistrar(TestFunction aFunc, std::string aName, std::string aFile,
-                std::size_t aLine, TestTags aTags) {
-    registerTest(aFunc, std::move(aName), std::move(aFile), aLine, aTags);
+  /// \param aTest The test, usually a constant made at compile time.
+  explicit TestRegistrar(TestCaseInfo const &aTest) { registerTest(aTest); }
+
+  /// This constructor adds several tests to the test registry at once.
+  /// \param aTests The tests, usually constants made at compile time.
+  explicit TestRegistrar(std::span<TestCaseInfo const> aTests) {
+    TestRegistry::instance().addTests(aTests);
   }
 };
 
+namespace internal {
+
+/// \brief A string literal usable as a template argument.
+template <std::size_t N> struct FixedString final {
+  char mChars[N] = {};
+
+  inline consteval FixedString(char const (&aChars)[N]) noexcept {
+    std::copy_n(aChars, N, mChars);
+  }
+
+  /// \return The string without the null terminator.
+  [[nodiscard]] inline constexpr auto view() const noexcept
+      -> std::string_view {
+    return std::string_view(mChars, N - 1);
+  }
+};
+
+/// \brief Names "name/0", "name/1", ... of the rows of a parameterized test,
+/// stored in a single buffer made at compile time.
+template <FixedString cName, std::size_t cRows> struct ParamNames final {
+  static constexpr auto digits(std::size_t aValue) noexcept -> std::size_t {
+    std::size_t lDigits = 1;
+    for (; aValue >= 10; aValue /= 10) {
+      ++lDigits;
+    }
+    return lDigits;
+  }
+
+  /// Start of each name in cChars, with the end at the back.
+  static constexpr std::array<std::size_t, cRows + 1> cOffsets = []() {
+    std::array<std::size_t, cRows + 1> lOffsets{};
+    for (std::size_t i = 0; i < cRows; ++i) {
+      lOffsets[i + 1] = lOffsets[i] + cName.view().size() + 1 + digits(i);
+    }
+    return lOffsets;
+  }();
+
+  static constexpr std::array<char, cOffsets.back()> cChars = []() {
+    std::array<char, cOffsets.back()> lChars{};
+    for (std::size_t i = 0; i < cRows; ++i) {
+      std::size_t lPos = cOffsets[i];
+      for (char const lChar : cName.view()) {
+        lChars[lPos++] = lChar;
+      }
+      lChars[lPos] = '/';
+      for (std::size_t lValue = i, lEnd = cOffsets[i + 1]; lEnd > lPos + 1;
+           lValue /= 10) {
+        lChars[--lEnd] = static_cast<char>('0' + lValue % 10);
+      }
+    }
+    return lChars;
+  }();
+
+  /// \return The name of a row.
+  [[nodiscard]] static constexpr auto name(std::size_t aRow) noexcept
+      -> std::string_view {
+    return std::string_view(cChars.data() + cOffsets[aRow],
+                            cOffsets[aRow + 1] - cOffsets[aRow]);
+  }
+};
+
+/// Type of the rows of a table for a parameterized test.
+template <typename TableT>
+using ParamRow = std::ranges::range_value_t<std::remove_cvref_t<TableT>>;
+
+/// Test function for one row of a parameterized test.
+template <auto const &cTable, auto cBody, std::size_t cRow>
+inline void runParamRow() {
+  cBody(cTable[cRow]);
+}
+
+/// Make the tests for the rows of a parameterized test, one per row, named
+/// "name/row". This is done at compile time so registering them is a single
+/// copy into the registry.
+/// \tparam cTable The table, an array with static storage.
+/// \tparam cBody Function testing one row.
+/// \tparam cName Name of the test.
+/// \param aFile File of the test (see \c testFilePath ).
+/// \param aLine Line of the test.
+/// \param aTags Tags of every row.
+/// \return The tests.
+template <auto const &cTable, auto cBody, FixedString cName>
+[[nodiscard]] consteval auto paramTests(std::string_view aFile,
+                                        std::size_t aLine, TestTags aTags) {
+  constexpr std::size_t cRows = std::size(cTable);
+  static_assert(cRows > 0, "a parameterized test needs at least one row");
+  using Names = ParamNames<cName, cRows>;
+  return [&]<std::size_t... cRowsT>(std::index_sequence<cRowsT...>) {
+    return std::array<TestCaseInfo, cRows>{
+        TestCaseInfo(&runParamRow<cTable, cBody, cRowsT>, Names::name(cRowsT),
+                     aFile, aLine, aTags)...};
+  }(std::make_index_sequence<cRows>{});
+}
+
+} // namespace internal
+
 /// \brief Error type thrown by test macros. Does not inherit \c std::exception
 /// to force differentiating it.
 class TestFailure final {
@@ -281,6 +463,93 @@ void addMessage(std::string aMessage, bool aFailureOnly);
 /// Clears the thread_local message storage for test results.
 void clearMessages();
 
+/// Operand of a failed soft check, kept by value so it can be formatted when
+/// the test finishes. Operands which are not arithmetic are not kept.
+using CheckValue = std::variant<std::monostate, bool, std::int64_t,
+                                std::uint64_t, float, double>;
+
+/// \param aValue Operand of a soft check.
+/// \return The operand as a \c CheckValue , empty if it is not arithmetic.
+template <typename T>
+[[nodiscard]] inline constexpr auto checkValue(T const &aValue) noexcept
+    -> CheckValue {
+  if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, float> ||
+                std::is_same_v<T, double>) {
+    return aValue;
+  } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+    return static_cast<std::int64_t>(aValue);
+  } else if constexpr (std::is_integral_v<T>) {
+    return static_cast<std::uint64_t>(aValue);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return static_cast<double>(aValue);
+  } else if constexpr (std::is_enum_v<T>) {
+    return checkValue(std::to_underlying(aValue));
+  } else {
+    return std::monostate{};
+  }
+}
+
+/// Record a failed soft check (see \c TEST_CHECK ) in the thread_local check
+/// storage without interrupting the test. All failures are counted but only
+/// the first few are kept, and messages for them are only formatted when the
+/// test finishes, so recording does not allocate.
+/// \param aDescription Description of the check, must be a string literal.
+/// \param aSrcLoc Source location of the check.
+/// \param aLeft First operand of the check, if it has operands.
+/// \param aRight Second operand of the check, if it has operands.
+void recordCheckFailure(char const *aDescription, std::source_location aSrcLoc,
+                        CheckValue aLeft = {}, CheckValue aRight = {}) noexcept;
+
+/// Clears the thread_local check storage for test results.
+void clearCheckFailures() noexcept;
+
+/// \return Number of soft checks which failed on this thread since they were
+/// last cleared.
+[[nodiscard]] auto checkFailureCount() noexcept -> std::size_t;
+
+/// \return Number of heap allocations made on this thread since the current
+/// test started, counted by the runner's global operator new. Always 0 if the
+/// runner is built with TKOZ_SRTEST_NO_ALLOC_HOOKS.
+[[nodiscard]] auto allocationCount() noexcept -> std::uint64_t;
+
+/// Require that the current test has made at most some number of heap
+/// allocations on this thread so far (see \c allocationCount ).
+/// \param aMax Maximum number of allocations.
+/// \param aSrcLoc Source location object (use default value).
+/// \throw TestFailure If there were more allocations, or if allocations are
+/// not counted.
+void requireMaxAllocs(std::uint64_t aMax,
+                      std::source_location aSrcLoc = sourceLocation());
+
+/// Soft check of a condition, the test continues if it is false and fails
+/// when it finishes.
+/// \param aCondition A boolean testable.
+/// \param aDescription Description of the check, must be a string literal.
+/// \param aSrcLoc Source location object (use default value).
+inline void checkCondition(bool aCondition, char const *aDescription,
+                           std::source_location aSrcLoc) noexcept {
+  if (!aCondition) [[unlikely]] {
+    recordCheckFailure(aDescription, aSrcLoc);
+  }
+}
+
+/// Soft check of a comparison, the operands are kept for the message if the
+/// comparison is false (see \c checkCondition ).
+/// \param aLeft The left operand.
+/// \param aRight The right operand.
+/// \param aDescription Description of the check, must be a string literal.
+/// \param aSrcLoc Source location object (use default value).
+/// \tparam CompareT Comparison function object type, such as std::less<>.
+template <typename CompareT, typename LeftT, typename RightT>
+inline void checkCompare(LeftT const &aLeft, RightT const &aRight,
+                         char const *aDescription,
+                         std::source_location aSrcLoc) {
+  if (!static_cast<bool>(CompareT{}(aLeft, aRight))) [[unlikely]] {
+    recordCheckFailure(aDescription, aSrcLoc, checkValue(aLeft),
+                       checkValue(aRight));
+  }
+}
+
 /// Require a condition to be true, fails the test if false.
 /// \param aCondition A boolean testable.
 /// \param aFalseMsg Message to use for the exception when \a aCondition is
@@ -431,6 +700,33 @@ void requireCloseImpl(T, T, T, T, char const *, char const *, char const *,
 template <bool, std::floating_point T>
 void requireNearImpl(T, T, T, char const *, char const *, char const *,
                      std::source_location);
+template <bool, std::floating_point T>
+void requireAllCloseAbsImpl(std::span<T const>, std::span<T const>, T,
+                            char const *, char const *, char const *,
+                            std::source_location);
+template <RelErrDiv, bool, std::floating_point T>
+void requireAllCloseRelImpl(std::span<T const>, std::span<T const>, T,
+                            char const *, char const *, char const *,
+                            std::source_location);
+template <bool, std::floating_point T, typename U>
+void requireAllCloseUlpImpl(std::span<T const>, std::span<T const>, U,
+                            char const *, char const *, char const *,
+                            std::source_location);
+
+/// A contiguous range of float or double values.
+template <typename R>
+concept FpContiguousRange =
+    std::ranges::contiguous_range<R const> &&
+    std::ranges::sized_range<R const> &&
+    (std::is_same_v<std::ranges::range_value_t<R const>, float> ||
+     std::is_same_v<std::ranges::range_value_t<R const>, double>);
+
+/// View a contiguous range as a span of const elements.
+template <FpContiguousRange R>
+[[nodiscard]] inline auto constSpan(R const &aRange) noexcept
+    -> std::span<std::ranges::range_value_t<R const> const> {
+  return {std::ranges::data(aRange), std::ranges::size(aRange)};
+}
 
 } // namespace internal
 
@@ -601,6 +897,530 @@ inline void requireNear(T aActual, T aExpected, T aTolerance,
                                                aToleranceStr, aSrcLoc);
 }
 
+/// Check the absolute error of each element of a contiguous range against the
+/// element at the same index of another. All elements are checked, and on
+/// failure the number of failing elements, the worst error, and the first few
+/// failing indices are reported.
+/// \param aActual The actual computed values.
+/// \param aExpected The expected results, same size as \c aActual .
+/// \param aTolerance The tolerance.
+/// \param aActualStr Stringified expression for actual values.
+/// \param aExpectedStr Stringified expression for expected results.
+/// \param aToleranceStr Stringified expression for tolerance.
+/// \param aSrcLoc Source location object (use default value).
+/// \tparam cIncludeEqualT If the error is allowed to be equal to the bound.
+/// \throw TestFailure If the error tolerance is not satisfied.
+template <bool cIncludeEqualT = true, internal::FpContiguousRange R,
+          internal::FpContiguousRange S>
+  requires std::is_same_v<std::ranges::range_value_t<R const>,
+                          std::ranges::range_value_t<S const>>
+inline void
+requireAllCloseAbs(R const &aActual, S const &aExpected,
+                   std::ranges::range_value_t<R const> aTolerance,
+                   char const *aActualStr, char const *aExpectedStr,
+                   char const *aToleranceStr,
+                   std::source_location aSrcLoc = sourceLocation()) {
+  internal::requireAllCloseAbsImpl<cIncludeEqualT>(
+      internal::constSpan(aActual), internal::constSpan(aExpected), aTolerance,
+      aActualStr, aExpectedStr, aToleranceStr, aSrcLoc);
+}
+
+/// Check the relative error of each element of a contiguous range against the
+/// element at the same index of another. Reports like \c requireAllCloseAbs .
+/// \param aActual The actual computed values.
+/// \param aExpected The expected results, same size as \c aActual .
+/// \param aTolerance The tolerance.
+/// \param aActualStr Stringified expression for actual values.
+/// \param aExpectedStr Stringified expression for expected results.
+/// \param aToleranceStr Stringified expression for tolerance.
+/// \param aSrcLoc Source location object (use default value).
+/// \tparam cDivT The division type to use for computing relative error.
+/// \tparam cIncludeEqualT If the error is allowed to be equal to the bound.
+/// \throw TestFailure If the error tolerance is not satisfied.
+template <RelErrDiv cDivT = RelErrDiv::cMax, bool cIncludeEqualT = true,
+          internal::FpContiguousRange R, internal::FpContiguousRange S>
+  requires std::is_same_v<std::ranges::range_value_t<R const>,
+                          std::ranges::range_value_t<S const>>
+inline void
+requireAllCloseRel(R const &aActual, S const &aExpected,
+                   std::ranges::range_value_t<R const> aTolerance,
+                   char const *aActualStr, char const *aExpectedStr,
+                   char const *aToleranceStr,
+                   std::source_location aSrcLoc = sourceLocation()) {
+  internal::requireAllCloseRelImpl<cDivT, cIncludeEqualT>(
+      internal::constSpan(aActual), internal::constSpan(aExpected), aTolerance,
+      aActualStr, aExpectedStr, aToleranceStr, aSrcLoc);
+}
+
+/// Check the ULP error of each element of a contiguous range against the
+/// element at the same index of another. Reports like \c requireAllCloseAbs .
+/// \param aActual The actual computed values.
+/// \param aExpected The expected results, same size as \c aActual .
+/// \param aTolerance The tolerance.
+/// \param aActualStr Stringified expression for actual values.
+/// \param aExpectedStr Stringified expression for expected results.
+/// \param aToleranceStr Stringified expression for tolerance.
+/// \param aSrcLoc Source location object (use default value).
+/// \tparam cIncludeEqualT If the error is allowed to be equal to the bound.
+/// \throw TestFailure If the error tolerance is not satisfied.
+template <bool cIncludeEqualT = true, internal::FpContiguousRange R,
+          internal::FpContiguousRange S>
+  requires std::is_same_v<std::ranges::range_value_t<R const>,
+                          std::ranges::range_value_t<S const>>
+inline void requireAllCloseUlp(
+    R const &aActual, S const &aExpected,
+    typename internal::FpBits<std::ranges::range_value_t<R const>>::Unsigned
+        aTolerance,
+    char const *aActualStr, char const *aExpectedStr,
+    char const *aToleranceStr,
+    std::source_location aSrcLoc = sourceLocation()) {
+  internal::requireAllCloseUlpImpl<cIncludeEqualT>(
+      internal::constSpan(aActual), internal::constSpan(aExpected), aTolerance,
+      aActualStr, aExpectedStr, aToleranceStr, aSrcLoc);
+}
+
+/// Soft check of the absolute error, see \c checkCondition .
+/// \param aActual The actual computed value.
+/// \param aExpected The expected result.
+/// \param aTolerance The tolerance, an error equal to it is allowed.
+/// \param aDescription Description of the check, must be a string literal.
+/// \param aSrcLoc Source location object (use default value).
+template <std::floating_point T>
+  requires(!std::is_same_v<T, long double>)
+inline void checkCloseAbs(T aActual, T aExpected, T aTolerance,
+                          char const *aDescription,
+                          std::source_location aSrcLoc) noexcept {
+  if (!(fpErrAbs(aActual, aExpected) <= aTolerance)) [[unlikely]] {
+    recordCheckFailure(aDescription, aSrcLoc, checkValue(aActual),
+                       checkValue(aExpected));
+  }
+}
+
+/// Soft check of the relative error (larger magnitude as the divisor), see
+/// \c checkCondition .
+/// \param aActual The actual computed value.
+/// \param aExpected The expected result.
+/// \param aTolerance The tolerance, an error equal to it is allowed.
+/// \param aDescription Description of the check, must be a string literal.
+/// \param aSrcLoc Source location object (use default value).
+template <std::floating_point T>
+  requires(!std::is_same_v<T, long double>)
+inline void checkCloseRel(T aActual, T aExpected, T aTolerance,
+                          char const *aDescription,
+                          std::source_location aSrcLoc) noexcept {
+  // Multiplication instead of division like requireCloseRel
+  if (!(fpErrAbs(aActual, aExpected) <=
+        aTolerance * std::max(std::abs(aActual), std::abs(aExpected))))
+      [[unlikely]] {
+    recordCheckFailure(aDescription, aSrcLoc, checkValue(aActual),
+                       checkValue(aExpected));
+  }
+}
+
+/// Soft check of the ULP error, see \c checkCondition .
+/// \param aActual The actual computed value.
+/// \param aExpected The expected result.
+/// \param aTolerance The tolerance, an error equal to it is allowed.
+/// \param aDescription Description of the check, must be a string literal.
+/// \param aSrcLoc Source location object (use default value).
+template <std::floating_point T>
+  requires(!std::is_same_v<T, long double>)
+inline void checkCloseUlp(T aActual, T aExpected,
+                          typename internal::FpBits<T>::Unsigned aTolerance,
+                          char const *aDescription,
+                          std::source_location aSrcLoc) noexcept {
+  if (!(fpErrUlp(aActual, aExpected) <= aTolerance)) [[unlikely]] {
+    recordCheckFailure(aDescription, aSrcLoc, checkValue(aActual),
+                       checkValue(aExpected));
+  }
+}
+
+/// Prevent the compiler from optimizing away the computation of a value in a
+/// benchmark, without adding any instructions to store it. The value is
+/// treated as read by code the compiler cannot see.
+/// \param aValue The value to keep.
+template <typename T> inline void doNotOptimize(T const &aValue) noexcept {
+#if defined(__GNUG__) || defined(__clang__)
+  if constexpr (std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(T *)) {
+    __asm__ __volatile__("" : : "r,m"(aValue) : "memory");
+  } else {
+    __asm__ __volatile__("" : : "m"(aValue) : "memory");
+  }
+#else
+  static_cast<void>(*static_cast<T const volatile *>(&aValue));
+#endif
+}
+
+/// Prevent the compiler from optimizing away or caching a value in a
+/// benchmark. The value is treated as read and modified by code the compiler
+/// cannot see.
+/// \param aValue The value to keep.
+template <typename T> inline void doNotOptimize(T &aValue) noexcept {
+#if defined(__GNUG__) || defined(__clang__)
+  if constexpr (std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(T *)) {
+    __asm__ __volatile__("" : "+m,r"(aValue) : : "memory");
+  } else {
+    __asm__ __volatile__("" : "+m"(aValue) : : "memory");
+  }
+#else
+  static_cast<void>(*static_cast<T volatile *>(&aValue));
+#endif
+}
+
+/// Force pending writes to memory to be treated as observable in a benchmark.
+inline void clobberMemory() noexcept {
+#if defined(__GNUG__) || defined(__clang__)
+  __asm__ __volatile__("" : : : "memory");
+#endif
+}
+
+/// \brief SplitMix64 pseudorandom generator. It is tiny and fast, and any
+/// seed gives a good sequence, so every property test case gets its own
+/// generator seeded from the run seed and the case index.
+class SplitMix64 final {
+private:
+  std::uint64_t mState;
+
+public:
+  /// \param aSeed Any value.
+  inline constexpr explicit SplitMix64(std::uint64_t aSeed) noexcept
+      : mState(aSeed) {}
+
+  /// \return The next 64 random bits.
+  [[nodiscard]] inline constexpr auto operator()() noexcept -> std::uint64_t {
+    std::uint64_t lValue = (mState += 0x9e3779b97f4a7c15u);
+    lValue = (lValue ^ (lValue >> 30)) * 0xbf58476d1ce4e5b9u;
+    lValue = (lValue ^ (lValue >> 27)) * 0x94d049bb133111ebu;
+    return lValue ^ (lValue >> 31);
+  }
+};
+
+/// Generators of random values for property tests. A generator has a
+/// \c ValueType , makes a value from a \c SplitMix64 , and lists simpler
+/// values to try when shrinking a counterexample, simplest first.
+namespace gen {
+
+/// \brief Uniformly distributed integers in [low, high] or floating point
+/// values in [low, high). Shrinks toward 0, or the bound nearest to it.
+template <typename T>
+  requires(std::integral<T> || std::floating_point<T>)
+struct Uniform final {
+  using ValueType = T;
+  T mLow;
+  T mHigh;
+
+  [[nodiscard]] inline constexpr auto operator()(SplitMix64 &aRng) const
+      -> T {
+    if constexpr (std::integral<T>) {
+      using U = std::make_unsigned_t<T>;
+      U const lRange = static_cast<U>(static_cast<U>(mHigh) -
+                                      static_cast<U>(mLow));
+      std::uint64_t lBits = aRng();
+      if (lRange != std::numeric_limits<U>::max()) {
+        // Reject the top partial interval so every value is equally likely
+        std::uint64_t const lCount = std::uint64_t{lRange} + 1;
+        std::uint64_t const lLimit =
+            std::numeric_limits<std::uint64_t>::max() -
+            std::numeric_limits<std::uint64_t>::max() % lCount;
+        while (lBits >= lLimit) {
+          lBits = aRng();
+        }
+        lBits %= lCount;
+      }
+      return static_cast<T>(static_cast<U>(mLow) + static_cast<U>(lBits));
+    } else {
+      // As many random bits as the significand holds, so the unit is exact
+      T lUnit;
+      if constexpr (std::is_same_v<T, float>) {
+        lUnit = static_cast<T>(aRng() >> 40) * 0x1.0p-24f;
+      } else {
+        lUnit = static_cast<T>(aRng() >> 11) * T{0x1.0p-53};
+      }
+      T const lValue = mLow + (mHigh - mLow) * lUnit;
+      // Rounding can reach mHigh, which is not in the range
+      return lValue < mHigh ? lValue : std::nextafter(mHigh, mLow);
+    }
+  }
+
+  /// \return Simpler values than \c aValue , simplest first.
+  [[nodiscard]] inline auto shrink(T aValue) const -> std::vector<T> {
+    T const lTarget = std::clamp(T{0}, mLow, mHigh);
+    std::vector<T> lResult;
+    if (aValue == lTarget) {
+      return lResult;
+    }
+    lResult.push_back(lTarget);
+    if constexpr (std::integral<T>) {
+      // Values halfway, a quarter of the way, ... from aValue to the target
+      bool const lAbove = aValue > lTarget;
+      using U = std::make_unsigned_t<T>;
+      U lDistance = lAbove ? static_cast<U>(aValue) - static_cast<U>(lTarget)
+                           : static_cast<U>(lTarget) - static_cast<U>(aValue);
+      for (lDistance /= 2; lDistance > 0; lDistance /= 2) {
+        lResult.push_back(static_cast<T>(
+            lAbove ? static_cast<U>(aValue) - lDistance
+                   : static_cast<U>(aValue) + lDistance));
+      }
+    } else {
+      T const lTruncated = std::trunc(aValue);
+      if (lTruncated != aValue && lTruncated >= mLow && lTruncated < mHigh) {
+        lResult.push_back(lTruncated);
+      }
+      T lDistance = aValue - lTarget;
+      for (int i = 0; i < 16; ++i) {
+        lDistance /= T{2};
+        lResult.push_back(aValue - lDistance);
+      }
+    }
+    return lResult;
+  }
+};
+
+/// Uniformly distributed values, integers in [low, high] and floating point
+/// values in [low, high).
+/// \param aLow Lowest value.
+/// \param aHigh Highest value (exclusive for floating point).
+template <typename T>
+  requires(std::integral<T> || std::floating_point<T>)
+[[nodiscard]] inline constexpr auto uniform(T aLow, T aHigh) -> Uniform<T> {
+  return Uniform<T>{aLow, aHigh};
+}
+
+/// Uniformly distributed integers over all values of the type.
+template <std::integral T>
+[[nodiscard]] inline constexpr auto uniform() -> Uniform<T> {
+  return Uniform<T>{std::numeric_limits<T>::min(),
+                    std::numeric_limits<T>::max()};
+}
+
+} // namespace gen
+
+/// A generator for property tests, see \c gen .
+template <typename G>
+concept PropertyGenerator =
+    requires(G const &aGen, SplitMix64 &aRng,
+             typename G::ValueType const &aValue) {
+      { aGen(aRng) } -> std::same_as<typename G::ValueType>;
+      {
+        aGen.shrink(aValue)
+      } -> std::same_as<std::vector<typename G::ValueType>>;
+    };
+
+/// Function type of a property taking one value from each generator.
+template <typename Tuple> struct PropertySignatureImpl;
+template <PropertyGenerator... Gs>
+struct PropertySignatureImpl<std::tuple<Gs...>> {
+  using Type = void(typename Gs::ValueType...);
+};
+template <typename Tuple>
+using PropertySignature =
+    PropertySignatureImpl<std::remove_cv_t<Tuple>>::Type;
+
+/// \brief Settings for property tests from the command line.
+struct PropertyConfig final {
+  /// Seed of the run, each case derives its own seed from it.
+  std::uint64_t mSeed = 0;
+  /// Number of cases to try.
+  std::uint64_t mCases = 0;
+  /// Number of threads to try cases on.
+  std::size_t mThreads = 1;
+};
+
+/// \brief Outcome of trying property cases, see \c searchProperty .
+struct PropertySearch final {
+  /// Lowest index of a failing case, if any case failed.
+  std::optional<std::uint64_t> mFailingCase;
+  /// Number of cases which were tried.
+  std::uint64_t mCasesRun = 0;
+  /// Wall time of trying the cases.
+  double mSeconds = 0.0;
+  /// Number of threads which tried cases.
+  std::size_t mThreads = 1;
+};
+
+namespace internal {
+
+/// \return Settings for property tests from the command line.
+[[nodiscard]] auto propertyConfig() -> PropertyConfig;
+
+/// Try cases with indices [0, aConfig.mCases) on aConfig.mThreads threads
+/// until one fails. Workers take blocks of increasing indices and stop when
+/// they pass the lowest failure found so far, so the failing case found is
+/// the lowest one regardless of the number of threads and their timing.
+/// \param aConfig The settings.
+/// \param aPasses Runs a case by index, returns false if it fails. Called
+/// concurrently from several threads.
+/// \return The lowest failing case and statistics.
+[[nodiscard]] auto
+searchProperty(PropertyConfig const &aConfig,
+               std::function<bool(std::uint64_t)> const &aPasses)
+    -> PropertySearch;
+
+/// \return Seed of the generator for a case of a property test.
+[[nodiscard]] inline constexpr auto propertyCaseSeed(std::uint64_t aSeed,
+                                                     std::uint64_t aCase)
+    -> std::uint64_t {
+  return SplitMix64(aSeed + aCase)();
+}
+
+/// Generate the arguments of a case from its seed.
+template <typename Tuple>
+[[nodiscard]] inline auto propertyArgs(Tuple const &aGens,
+                                       std::uint64_t aCaseSeed) {
+  SplitMix64 lRng(aCaseSeed);
+  // Braced initialization to generate arguments from left to right
+  return std::apply(
+      [&lRng](auto const &...aGen) {
+        return std::tuple<typename std::remove_cvref_t<
+            decltype(aGen)>::ValueType...>{aGen(lRng)...};
+      },
+      aGens);
+}
+
+/// Run a property with some arguments. A thrown exception or a failed soft
+/// check counts as a failure.
+/// \return True if the property holds.
+template <typename F, typename Args>
+[[nodiscard]] inline auto propertyHolds(F *aProperty, Args const &aArgs)
+    -> bool {
+  clearCheckFailures();
+  try {
+    std::apply(aProperty, aArgs);
+  } catch (...) {
+    clearCheckFailures();
+    return false;
+  }
+  bool const lHolds = checkFailureCount() == 0;
+  clearCheckFailures();
+  return lHolds;
+}
+
+/// Greedily replace arguments with simpler values from the generators while
+/// the property still fails.
+/// \return Number of replacements made.
+template <typename Tuple, typename F, typename Args>
+inline auto shrinkCounterexample(Tuple const &aGens, F *aProperty,
+                                 Args &aArgs) -> std::size_t {
+  constexpr std::size_t cMaxSteps = 1000;
+  std::size_t lSteps = 0;
+  auto const fShrinkOne = [&]<std::size_t cIndex>() -> bool {
+    for (auto const &lCandidate :
+         std::get<cIndex>(aGens).shrink(std::get<cIndex>(aArgs))) {
+      Args lTrial = aArgs;
+      std::get<cIndex>(lTrial) = lCandidate;
+      if (!propertyHolds(aProperty, lTrial)) {
+        aArgs = std::move(lTrial);
+        return true;
+      }
+    }
+    return false;
+  };
+  while (lSteps < cMaxSteps) {
+    bool const lShrunk = [&]<std::size_t... cIndices>(
+                             std::index_sequence<cIndices...>) {
+      return (fShrinkOne.template operator()<cIndices>() || ...);
+    }(std::make_index_sequence<std::tuple_size_v<Args>>{});
+    if (!lShrunk) {
+      break;
+    }
+    ++lSteps;
+  }
+  return lSteps;
+}
+
+/// \return The arguments as a string, each formatted if possible.
+template <typename Args>
+[[nodiscard]] inline auto propertyArgsString(Args const &aArgs)
+    -> std::string {
+  return std::apply(
+      [](auto const &...aArg) {
+        std::string lResult;
+        auto const fAppend = [&lResult](auto const &aValue) {
+          lResult += lResult.empty() ? "(" : ", ";
+          if constexpr (std::formattable<std::remove_cvref_t<decltype(aValue)>,
+                                         char>) {
+            lResult += std::format("{}", aValue);
+          } else {
+            lResult += "?";
+          }
+        };
+        (fAppend(aArg), ...);
+        return lResult.empty() ? std::string("()") : lResult + ")";
+      },
+      aArgs);
+}
+
+} // namespace internal
+
+/// Run a property test: try random cases in parallel until one fails, then
+/// shrink the lowest failing case and run it once more on this thread so it
+/// fails the test with its own message. The seed to reproduce it is added to
+/// the test messages.
+/// \param aGens The generators, one for each argument of the property.
+/// \param aProperty The property, fails by failing a require or check.
+template <PropertyGenerator... Gs>
+inline void runProperty(std::tuple<Gs...> const &aGens,
+                        PropertySignature<std::tuple<Gs...>> *aProperty) {
+  PropertyConfig const lConfig = internal::propertyConfig();
+  PropertySearch const lSearch = internal::searchProperty(
+      lConfig, [&aGens, aProperty, &lConfig](std::uint64_t aCase) {
+        return internal::propertyHolds(
+            aProperty,
+            internal::propertyArgs(
+                aGens, internal::propertyCaseSeed(lConfig.mSeed, aCase)));
+      });
+  std::string const lStats =
+      std::format("{} cases in {:.3f} s ({:.0f} cases/s) on {} threads, "
+                  "seed {:#x}",
+                  lSearch.mCasesRun, lSearch.mSeconds,
+                  lSearch.mSeconds > 0.0
+                      ? static_cast<double>(lSearch.mCasesRun) /
+                            lSearch.mSeconds
+                      : 0.0,
+                  lSearch.mThreads, lConfig.mSeed);
+  if (!lSearch.mFailingCase.has_value()) {
+    addMessage("Property held for " + lStats, false);
+    return;
+  }
+  auto const lOriginal = internal::propertyArgs(
+      aGens, internal::propertyCaseSeed(lConfig.mSeed, *lSearch.mFailingCase));
+  auto lArgs = lOriginal;
+  std::size_t const lSteps =
+      internal::shrinkCounterexample(aGens, aProperty, lArgs);
+  clearMessages();
+  addMessage(std::format("Property failed at case {} after {}, reproduce "
+                         "with --seed {:#x}",
+                         *lSearch.mFailingCase, lStats, lConfig.mSeed),
+             false);
+  addMessage(std::format("Counterexample {} shrunk in {} steps from {}",
+                         internal::propertyArgsString(lArgs), lSteps,
+                         internal::propertyArgsString(lOriginal)),
+             false);
+  clearCheckFailures();
+  std::apply(aProperty, lArgs);
+  if (checkFailureCount() == 0) {
+    throwFailure("counterexample passed when run again, the property may "
+                 "depend on state other than its arguments");
+  }
+}
+
+namespace internal {
+
+/// The value of a fixture (see \c TEST_FIXTURE ). It is built by the first
+/// call, which is thread safe since it is a function local static, and
+/// destroyed at process exit in the reverse order of construction. If
+/// building it throws, the calling test fails and the next call tries again.
+/// \tparam cMake Function which builds the value.
+/// \return The value.
+template <auto cMake>
+[[nodiscard]] inline auto fixture()
+    -> std::remove_cvref_t<decltype(cMake())> & {
+  static std::remove_cvref_t<decltype(cMake())> sValue = cMake();
+  return sValue;
+}
+
+} // namespace internal
+
 } // namespace tkoz::srtest
 
 /// Helper macros to expand macros properly.
@@ -623,15 +1443,45 @@ inline void requireNear(T aActual, T aExpected, T aTolerance,
   struct [[maybe_unused]] _tkoz_srtest_names_unique__##name {};                \
   [[maybe_unused]] static ::tkoz::srtest::TestRegistrar                        \
       TKOZ_SRTEST_INTERNAL_CONCAT_4(_tkoz_srtest_registrar__, name, __,        \
-                                    counter)(                                  \
+                                    counter)(::tkoz::srtest::TestCaseInfo(     \
           TKOZ_SRTEST_INTERNAL_CONCAT_4(_tkoz_srtest_testfunc__, name, __,     \
                                         counter),                              \
-          #name, __FILE__, __LINE__,                                           \
-          ::tkoz::srtest::TestTags::create<__VA_ARGS__>());                    \
+          #name,                                                               \
+          ::tkoz::srtest::testFilePath(std::source_location::current()),       \
+          __LINE__, ::tkoz::srtest::TestTags::create<__VA_ARGS__>()));         \
   }                                                                            \
   static void ::tkoz::srtest::tests::TKOZ_SRTEST_INTERNAL_CONCAT_4(            \
       _tkoz_srtest_testfunc__, name, __, counter)()
 
+// A parameterized test is a body taking a row of the table, and an array of
+// tests made at compile time with one function per row which calls the body.
+#define TKOZ_SRTEST_INTERNAL_CREATE_PARAMS(name, table, counter, ...)          \
+  namespace tkoz::srtest::tests {                                              \
+  [[maybe_unused]] static void                                                 \
+      TKOZ_SRTEST_INTERNAL_CONCAT_4(_tkoz_srtest_paramfunc__, name, __,        \
+                                    counter)(                                  \
+          ::tkoz::srtest::internal::ParamRow<decltype(table)> const &param);   \
+  struct [[maybe_unused]] _tkoz_srtest_names_unique__##name {};                \
+  static constexpr auto TKOZ_SRTEST_INTERNAL_CONCAT_4(                         \
+      _tkoz_srtest_paramtests__, name, __, counter) =                          \
+      ::tkoz::srtest::internal::paramTests<                                    \
+          table,                                                               \
+          &TKOZ_SRTEST_INTERNAL_CONCAT_4(_tkoz_srtest_paramfunc__, name, __,   \
+                                         counter),                             \
+          #name>(                                                              \
+          ::tkoz::srtest::testFilePath(std::source_location::current()),       \
+          __LINE__, ::tkoz::srtest::TestTags::create<__VA_ARGS__>());          \
+  [[maybe_unused]] static ::tkoz::srtest::TestRegistrar                        \
+      TKOZ_SRTEST_INTERNAL_CONCAT_4(_tkoz_srtest_registrar__, name, __,        \
+                                    counter){                                  \
+          std::span<::tkoz::srtest::TestCaseInfo const>(                       \
+              TKOZ_SRTEST_INTERNAL_CONCAT_4(_tkoz_srtest_paramtests__, name,   \
+                                            __, counter))};                    \
+  }                                                                            \
+  static void ::tkoz::srtest::tests::TKOZ_SRTEST_INTERNAL_CONCAT_4(            \
+      _tkoz_srtest_paramfunc__, name, __, counter)(                            \
+      ::tkoz::srtest::internal::ParamRow<decltype(table)> const &param)
+
 ////////////////////////////////////////////////////////////////////////////////
 // These macros actually define the public interface for the test library.
 ////////////////////////////////////////////////////////////////////////////////
@@ -648,6 +1498,84 @@ inline void requireNear(T aActual, T aExpected, T aTolerance,
 #define TEST_CREATE_SLOW(name, ...)                                            \
   TEST_CREATE(name, SLOW __VA_OPT__(, ) __VA_ARGS__)
 
+/// Create one test per row of a table, followed by a curly brace {} block
+/// which tests one row given as \c param . The table is a constexpr array
+/// (std::array or built in) with static storage. Rows are named "name/0",
+/// "name/1", ... so each can be selected as "file:name/3" or all of them as
+/// "file:name", and they are scheduled as separate tests. The tests are made
+/// at compile time, so a table adds no per row work to static initialization.
+/// Usage: TEST_CREATE_PARAMS(testName, cTable, FAST) { f(param.mInput); }
+#define TEST_CREATE_PARAMS(name, table, ...)                                   \
+  TKOZ_SRTEST_INTERNAL_CREATE_PARAMS(name, table,                              \
+                                     __COUNTER__ __VA_OPT__(, ) __VA_ARGS__)
+
+/// Create a benchmark with the provided name (not quoted) and a curly brace {}
+/// block following for the operation to measure. The runner calls the block
+/// repeatedly and reports the time per call, so it should do one operation.
+/// Use TEST_DO_NOT_OPTIMIZE on results so the work is not optimized away.
+/// Usage: TEST_BENCHMARK(benchName) { TEST_DO_NOT_OPTIMIZE(f(x)); }
+#define TEST_BENCHMARK(name, ...)                                              \
+  TEST_CREATE(name, BENCH __VA_OPT__(, ) __VA_ARGS__)
+
+// A property test is a test which calls the property function with the tuple
+// of generators. The property function is declared from the generators with
+// a function type so its parameter list can follow the macro.
+#define TKOZ_SRTEST_INTERNAL_PROPERTY(name, counter, ...)                      \
+  namespace tkoz::srtest::tests {                                              \
+  [[maybe_unused]] static auto const TKOZ_SRTEST_INTERNAL_CONCAT_4(            \
+      _tkoz_srtest_propgens__, name, __, counter) = std::tuple(__VA_ARGS__);   \
+  [[maybe_unused]] static ::tkoz::srtest::PropertySignature<decltype(          \
+      TKOZ_SRTEST_INTERNAL_CONCAT_4(_tkoz_srtest_propgens__, name, __,         \
+                                    counter))>                                 \
+      TKOZ_SRTEST_INTERNAL_CONCAT_4(_tkoz_srtest_propfunc__, name, __,         \
+                                    counter);                                  \
+  }                                                                            \
+  TEST_CREATE(name, PROPERTY) {                                                \
+    ::tkoz::srtest::runProperty(                                               \
+        ::tkoz::srtest::tests::TKOZ_SRTEST_INTERNAL_CONCAT_4(                  \
+            _tkoz_srtest_propgens__, name, __, counter),                       \
+        &::tkoz::srtest::tests::TKOZ_SRTEST_INTERNAL_CONCAT_4(                 \
+            _tkoz_srtest_propfunc__, name, __, counter));                      \
+  }                                                                            \
+  static void ::tkoz::srtest::tests::TKOZ_SRTEST_INTERNAL_CONCAT_4(            \
+      _tkoz_srtest_propfunc__, name, __, counter)
+
+/// Create a property test with the provided name (not quoted) and generators
+/// (see \c ::tkoz::srtest::gen ), followed by a parameter list with one
+/// parameter for each generator and a curly brace {} block which checks the
+/// property with TEST_REQUIRE_* or TEST_CHECK_*. Random cases are tried on
+/// several threads (--property-cases, --property-threads) and a failing case
+/// is shrunk and reported with the seed to reproduce it (--seed).
+/// Usage: TEST_PROPERTY(name, ::tkoz::srtest::gen::uniform(1, 100))(int n) {}
+#define TEST_PROPERTY(name, ...)                                               \
+  TKOZ_SRTEST_INTERNAL_PROPERTY(name, __COUNTER__, __VA_ARGS__)
+
+/// Create a fixture shared by tests in this file: expensive setup such as
+/// lookup tables or a loaded dataset. Follow it with a curly brace {} block
+/// which returns the value (the type is deduced from the return statement).
+/// Tests get the value with TEST_USE_FIXTURE(name) and it is built when a
+/// test first uses it, so fixtures which no selected test uses are never
+/// built. The value is shared by concurrent tests, so tests which modify it
+/// must synchronize. With --isolate each worker process builds its own.
+/// Usage: TEST_FIXTURE(name) { return std::vector<int>(1000, 1); }
+#define TEST_FIXTURE(name)                                                     \
+  namespace tkoz::srtest::fixtures {                                           \
+  static auto _tkoz_srtest_fixture__##name();                                  \
+  }                                                                            \
+  static auto ::tkoz::srtest::fixtures::_tkoz_srtest_fixture__##name()
+
+/// Get the value of a fixture created with TEST_FIXTURE earlier in this file,
+/// building it on first use. There is one value per process.
+#define TEST_USE_FIXTURE(name)                                                 \
+  ::tkoz::srtest::internal::fixture<                                           \
+      &::tkoz::srtest::fixtures::_tkoz_srtest_fixture__##name>()
+
+/// Keep a value in a benchmark from being optimized away.
+#define TEST_DO_NOT_OPTIMIZE(value) ::tkoz::srtest::doNotOptimize(value)
+
+/// Keep writes to memory in a benchmark from being optimized away.
+#define TEST_CLOBBER_MEMORY() ::tkoz::srtest::clobberMemory()
+
 /// Require a condition to be true, fail the test if false.
 #define TEST_REQUIRE(cond)                                                     \
   ::tkoz::srtest::requireCondition(static_cast<bool>(cond),                    \
@@ -751,6 +1679,42 @@ inline void requireNear(T aActual, T aExpected, T aTolerance,
   ::tkoz::srtest::requireCloseUlp((actual), (expected), (tolerance), #actual,  \
                                   #expected, #tolerance)
 
+/// Require each element of contiguous range \c actual to be near the element
+/// at the same index in \c expected (absolute error). All elements are checked
+/// and the failure reports how many failed, the worst, and the first few.
+/// Note: absolute error equal to the given bound is allowed.
+#define TEST_REQUIRE_ALL_CLOSE_ABS(actual, expected, tolerance)                \
+  ::tkoz::srtest::requireAllCloseAbs((actual), (expected), (tolerance),        \
+                                     #actual, #expected, #tolerance)
+
+/// Like \c TEST_REQUIRE_ALL_CLOSE_ABS for relative error, with \c expected
+/// as the divisor.
+#define TEST_REQUIRE_ALL_CLOSE_REL_EXP(actual, expected, tolerance)            \
+  ::tkoz::srtest::requireAllCloseRel<::tkoz::srtest::RelErrDiv::cExp>(         \
+      (actual), (expected), (tolerance), #actual, #expected, #tolerance)
+
+/// Like \c TEST_REQUIRE_ALL_CLOSE_ABS for relative error, with the larger
+/// magnitude as the divisor.
+#define TEST_REQUIRE_ALL_CLOSE_REL_MAX(actual, expected, tolerance)            \
+  ::tkoz::srtest::requireAllCloseRel<::tkoz::srtest::RelErrDiv::cMax>(         \
+      (actual), (expected), (tolerance), #actual, #expected, #tolerance)
+
+/// Like \c TEST_REQUIRE_ALL_CLOSE_ABS for relative error, with the average
+/// magnitude as the divisor.
+#define TEST_REQUIRE_ALL_CLOSE_REL_AVG(actual, expected, tolerance)            \
+  ::tkoz::srtest::requireAllCloseRel<::tkoz::srtest::RelErrDiv::cAvg>(         \
+      (actual), (expected), (tolerance), #actual, #expected, #tolerance)
+
+/// Like \c TEST_REQUIRE_ALL_CLOSE_REL_MAX , the recommended relative error.
+#define TEST_REQUIRE_ALL_CLOSE_REL(actual, expected, tolerance)                \
+  TEST_REQUIRE_ALL_CLOSE_REL_MAX(actual, expected, tolerance)
+
+/// Like \c TEST_REQUIRE_ALL_CLOSE_ABS for ULP error.
+/// Note: ULP error equal to the given bound is allowed.
+#define TEST_REQUIRE_ALL_CLOSE_ULP(actual, expected, tolerance)                \
+  ::tkoz::srtest::requireAllCloseUlp((actual), (expected), (tolerance),        \
+                                     #actual, #expected, #tolerance)
+
 /// Require \c actual to be near \c expected with provided absolute and relative
 /// tolerances. This is the same method used by \c math.isclose in Python.
 /// The Python default is 1e-9 relative tolerance and 0 absolute tolerance which
@@ -769,6 +1733,85 @@ inline void requireNear(T aActual, T aExpected, T aTolerance,
   ::tkoz::srtest::requireNear((actual), (expected), (tolerance), #actual,      \
                               #expected, #tolerance)
 
+/// Require that the test has made at most \c n heap allocations on this
+/// thread since it started. Allocations on other threads are not counted.
+#define TEST_REQUIRE_MAX_ALLOCS(n)                                             \
+  ::tkoz::srtest::requireMaxAllocs((n), ::tkoz::srtest::sourceLocation())
+
+/// Check a condition without stopping the test. Failed checks are reported
+/// and fail the test when it finishes. Passing checks cost one branch, so
+/// these are meant for loops which check many values and should report all
+/// failures instead of stopping at the first one.
+#define TEST_CHECK(cond)                                                       \
+  ::tkoz::srtest::checkCondition(static_cast<bool>(cond),                      \
+                                 "check failed: " #cond,                       \
+                                 ::tkoz::srtest::sourceLocation())
+
+/// Check expressions to be equal without stopping the test.
+#define TEST_CHECK_EQ(a, b)                                                    \
+  ::tkoz::srtest::checkCompare<std::equal_to<>>(                               \
+      (a), (b), "check failed: (" #a ") == (" #b ")",                          \
+      ::tkoz::srtest::sourceLocation())
+
+/// Check expressions to be not equal without stopping the test.
+#define TEST_CHECK_NE(a, b)                                                    \
+  ::tkoz::srtest::checkCompare<std::not_equal_to<>>(                           \
+      (a), (b), "check failed: (" #a ") != (" #b ")",                          \
+      ::tkoz::srtest::sourceLocation())
+
+/// Check expressions to compare less than without stopping the test.
+#define TEST_CHECK_LT(a, b)                                                    \
+  ::tkoz::srtest::checkCompare<std::less<>>(                                   \
+      (a), (b), "check failed: (" #a ") < (" #b ")",                           \
+      ::tkoz::srtest::sourceLocation())
+
+/// Check expressions to compare less than or equal to without stopping the
+/// test.
+#define TEST_CHECK_LE(a, b)                                                    \
+  ::tkoz::srtest::checkCompare<std::less_equal<>>(                             \
+      (a), (b), "check failed: (" #a ") <= (" #b ")",                          \
+      ::tkoz::srtest::sourceLocation())
+
+/// Check expressions to compare greater than without stopping the test.
+#define TEST_CHECK_GT(a, b)                                                    \
+  ::tkoz::srtest::checkCompare<std::greater<>>(                                \
+      (a), (b), "check failed: (" #a ") > (" #b ")",                           \
+      ::tkoz::srtest::sourceLocation())
+
+/// Check expressions to compare greater than or equal to without stopping the
+/// test.
+#define TEST_CHECK_GE(a, b)                                                    \
+  ::tkoz::srtest::checkCompare<std::greater_equal<>>(                          \
+      (a), (b), "check failed: (" #a ") >= (" #b ")",                          \
+      ::tkoz::srtest::sourceLocation())
+
+/// Check 2 floating point numbers to be nearly equal (absolute error) without
+/// stopping the test. Absolute error equal to the given bound is allowed.
+#define TEST_CHECK_CLOSE_ABS(actual, expected, tolerance)                      \
+  ::tkoz::srtest::checkCloseAbs(                                               \
+      (actual), (expected), (tolerance),                                       \
+      "check failed: absolute error of " #actual " and " #expected             \
+      " at most " #tolerance,                                                  \
+      ::tkoz::srtest::sourceLocation())
+
+/// Check 2 floating point numbers to be nearly equal (relative error with the
+/// larger magnitude as the divisor) without stopping the test.
+#define TEST_CHECK_CLOSE_REL(actual, expected, tolerance)                      \
+  ::tkoz::srtest::checkCloseRel(                                               \
+      (actual), (expected), (tolerance),                                       \
+      "check failed: relative error of " #actual " and " #expected             \
+      " at most " #tolerance,                                                  \
+      ::tkoz::srtest::sourceLocation())
+
+/// Check 2 floating point numbers to be nearly equal (ULP error) without
+/// stopping the test. ULP error equal to the given bound is allowed.
+#define TEST_CHECK_CLOSE_ULP(actual, expected, tolerance)                      \
+  ::tkoz::srtest::checkCloseUlp(                                               \
+      (actual), (expected), (tolerance),                                       \
+      "check failed: ULP error of " #actual " and " #expected                  \
+      " at most " #tolerance,                                                  \
+      ::tkoz::srtest::sourceLocation())
+
 /// Cause a test failure unconditionally with the provided message.
 #define TEST_FAILURE(msg)                                                      \
   ::tkoz::srtest::throwFailure((msg), ::tkoz::srtest::sourceLocation())
@@ -4,6 +4,14 @@
 /// Simply include it once for a test runner executable.
 /// Most likely, that source file would just contain a single line:
 /// #include <tkoz/SRTestMain.hpp>
+///
+/// When the runner links the compiled tkoz-srtest-runner library, which
+/// defines TKOZ_SRTEST_COMPILED, main and the runner come from the library
+/// and this header only includes SRTest.hpp.
+
+#if defined(TKOZ_SRTEST_COMPILED) && !defined(TKOZ_SRTEST_BUILDING_LIBRARY)
+#include "SRTest.hpp"
+#else
 
 // Use old style header include guards instead of pragma once
 // so we can warn client code about proper usage.
@@ -12,29 +20,162 @@
 
 #include "SRTest.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bit>
-#include <bitset>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <cmath>
 #include <compare>
 #include <concepts>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <exception>
+#include <filesystem>
 #include <format>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
+#include <random>
 #include <ranges>
 #include <source_location>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
 #include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <variant>
 #include <vector>
 
 #if defined(__GNUG__) || defined(__clang__)
 #include <cxxabi.h> // Current exception info on GCC/Clang
 #endif
 
+#if defined(__unix__) || defined(__APPLE__)
+#define TKOZ_SRTEST_HAS_FORK 1
+#include <fcntl.h>    // Opening the --report-out file
+#include <poll.h>     // Waiting on results from worker processes
+#include <pthread.h>  // Output locks held across fork
+#include <signal.h>   // SIGPIPE from dead workers, flushing on crashes
+#include <sys/file.h>     // Locking the state file while it is saved
+#include <sys/resource.h> // Peak RSS for --instrument
+#include <sys/wait.h> // Exit status of worker processes
+#include <unistd.h>   // fork/pipe/read/write
+#else
+#define TKOZ_SRTEST_HAS_FORK 0
+#endif
+
+#if defined(__linux__)
+#define TKOZ_SRTEST_HAS_PERF 1
+#include <linux/perf_event.h> // Hardware counters for --instrument
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#else
+#define TKOZ_SRTEST_HAS_PERF 0
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__)
+#define TKOZ_SRTEST_HAS_PROFILER 1
+#include <dlfcn.h>    // Symbols of --profile samples
+#include <execinfo.h> // Stacks of --profile samples
+#include <time.h>     // Thread CPU timers driving --profile
+#include <ucontext.h> // Instruction interrupted by a --profile sample
+#else
+#define TKOZ_SRTEST_HAS_PROFILER 0
+#endif
+
+#ifndef TKOZ_SRTEST_NO_ALLOC_HOOKS
+#define TKOZ_SRTEST_ALLOC_HOOKS 1
+#else
+#define TKOZ_SRTEST_ALLOC_HOOKS 0
+#endif
+
+namespace tkoz::srtest::internal {
+
+/// \brief Heap allocations counted by the global operator new hooks.
+struct AllocCounts final {
+  std::uint64_t mCount = 0;
+  std::uint64_t mBytes = 0;
+};
+
+/// Allocations made on this thread since the current test started.
+inline thread_local AllocCounts gAllocCounts;
+
+} // namespace tkoz::srtest::internal
+
+#if TKOZ_SRTEST_ALLOC_HOOKS
+// Replacements of the global allocation functions which count allocations on
+// each thread for --instrument and TEST_REQUIRE_MAX_ALLOCS. The array and
+// nothrow forms call these by default. Define TKOZ_SRTEST_NO_ALLOC_HOOKS to
+// keep the standard ones, for example if the tests replace them.
+
+void *operator new(std::size_t aSize) {
+  ++tkoz::srtest::internal::gAllocCounts.mCount;
+  tkoz::srtest::internal::gAllocCounts.mBytes += aSize;
+  void *const lPtr = std::malloc(aSize == 0 ? 1 : aSize);
+  if (lPtr == nullptr) [[unlikely]] {
+    throw std::bad_alloc();
+  }
+  return lPtr;
+}
+
+void *operator new(std::size_t aSize, std::align_val_t aAlign) {
+  ++tkoz::srtest::internal::gAllocCounts.mCount;
+  tkoz::srtest::internal::gAllocCounts.mBytes += aSize;
+  // aligned_alloc requires a size which is a multiple of the alignment
+  std::size_t const lAlign = static_cast<std::size_t>(aAlign);
+  std::size_t const lSize =
+      aSize == 0 ? lAlign : (aSize + lAlign - 1) / lAlign * lAlign;
+  void *const lPtr = std::aligned_alloc(lAlign, lSize);
+  if (lPtr == nullptr) [[unlikely]] {
+    throw std::bad_alloc();
+  }
+  return lPtr;
+}
+
+// GCC sees free() of memory from operator new when these are inlined into
+// library code and warns, although both are the replacements above.
+#if defined(__GNUG__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *aPtr) noexcept { std::free(aPtr); }
+
+void operator delete(void *aPtr, std::align_val_t) noexcept {
+  std::free(aPtr);
+}
+
+void operator delete(void *aPtr, std::size_t) noexcept { std::free(aPtr); }
+
+void operator delete(void *aPtr, std::size_t, std::align_val_t) noexcept {
+  std::free(aPtr);
+}
+
+#if defined(__GNUG__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // TKOZ_SRTEST_ALLOC_HOOKS
+
 // Definitions for things in SRTest.hpp
 namespace tkoz::srtest {
 
@@ -43,42 +184,29 @@ auto TestTags::tagString(TagEnum aTag) -> std::string const & {
     throw std::invalid_argument(
         "TAG_COUNT is reserved and not a valid test tag");
   }
-  static std::vector<std::string> const sStrings = {"FAST", "SLOW"};
+#define TKOZ_SRTEST_INTERNAL_TAG_STRING(name) #name,
+  static std::vector<std::string> const sStrings = {
+      TKOZ_SRTEST_BUILTIN_TAGS(TKOZ_SRTEST_INTERNAL_TAG_STRING)
+          TKOZ_SRTEST_USER_TAGS(TKOZ_SRTEST_INTERNAL_TAG_STRING)};
+#undef TKOZ_SRTEST_INTERNAL_TAG_STRING
   return sStrings.at(static_cast<std::size_t>(aTag));
 }
 
-auto TestTags::allTags() const noexcept -> std::vector<TagEnum> {
-  return std::ranges::to<std::vector<TagEnum>>(
-      std::views::iota(std::size_t{0}, cMaxTags) |
-      std::views::filter(
-          [this](std::size_t i) -> bool { return mTagBits.test(i); }) |
-      std::views::transform(
-          [](std::size_t i) -> TagEnum { return static_cast<TagEnum>(i); }));
+auto TestTags::fromString(std::string_view aName) -> std::optional<TagEnum> {
+  for (std::size_t i = 0; i < TAG_COUNT; ++i) {
+    if (aName == tagString(static_cast<TagEnum>(i))) {
+      return static_cast<TagEnum>(i);
+    }
+  }
+  return std::nullopt;
 }
 
-// TODO this is called in static initialization and could throw
-// Maybe store full path and validate at run time instead
-auto testFilePath(std::string_view aFullPath) -> std::string {
-  static std::string const cRoot = TKOZ_SRTEST_SOURCE_ROOT;
-  static std::string const cExt = TKOZ_SRTEST_SOURCE_EXT;
-  if (!aFullPath.starts_with(cRoot)) {
-    throw std::runtime_error(std::format(
-        "test path does not begin with source root: {}", aFullPath));
-  }
-  if (!aFullPath.ends_with(cExt)) {
-    throw std::runtime_error(
-        std::format("test path does not end with \"{}\": {}", cExt, aFullPath));
-  }
-  if (aFullPath.size() <= cRoot.size() + 4) {
-    throw std::runtime_error(
-        std::format("test path appears to be empty: {}", aFullPath));
-  }
-  if (aFullPath.contains(':')) {
-    throw std::runtime_error(
-        std::format("test path contains a colon: {}", aFullPath));
+auto TestTags::allTags() const noexcept -> std::vector<TagEnum> {
+  std::vector<TagEnum> lResult;
+  for (std::uint64_t lBits = mTagBits; lBits != 0; lBits &= lBits - 1) {
+    lResult.push_back(static_cast<TagEnum>(std::countr_zero(lBits)));
   }
-  return std::string(aFullPath.substr(
-      cRoot.size(), aFullPath.size() - cRoot.size() - cExt.size()));
+  return lResult;
 }
 
 auto operator<=>(TestCaseInfo const &aLeft, TestCaseInfo const &aRight) noexcept
@@ -96,6 +224,10 @@ auto TestRegistry::instance() noexcept -> TestRegistry & {
   return sTestRegistry;
 }
 
+void TestRegistry::sort() {
+  std::stable_sort(mAllTests.begin(), mAllTests.end());
+}
+
 void throwFailure(std::string_view aMessage, std::source_location aSrcLoc) {
   throw TestFailure(std::format("failure at {}:{}{}{}", aSrcLoc.file_name(),
                                 aSrcLoc.line(), aMessage.empty() ? "" : ": ",
@@ -112,6 +244,54 @@ void addMessage(std::string aMessage, bool aFailureOnly) {
 
 void clearMessages() { gTestMessages.clear(); }
 
+// Per thread storage for failed soft checks. Every failure is counted, only
+// the first few are kept with the static description, location and operands.
+inline constexpr std::size_t cMaxRecordedChecks = 16;
+struct CheckFailures final {
+  struct Check final {
+    char const *mDescription = nullptr;
+    std::source_location mSrcLoc;
+    CheckValue mLeft;
+    CheckValue mRight;
+  };
+  std::size_t mFailed = 0;
+  std::array<Check, cMaxRecordedChecks> mRecorded;
+};
+inline thread_local CheckFailures gCheckFailures;
+
+void recordCheckFailure(char const *aDescription, std::source_location aSrcLoc,
+                        CheckValue aLeft, CheckValue aRight) noexcept {
+  if (gCheckFailures.mFailed < cMaxRecordedChecks) {
+    gCheckFailures.mRecorded[gCheckFailures.mFailed] = {aDescription, aSrcLoc,
+                                                        aLeft, aRight};
+  }
+  ++gCheckFailures.mFailed;
+}
+
+void clearCheckFailures() noexcept { gCheckFailures.mFailed = 0; }
+
+auto checkFailureCount() noexcept -> std::size_t {
+  return gCheckFailures.mFailed;
+}
+
+auto allocationCount() noexcept -> std::uint64_t {
+  return internal::gAllocCounts.mCount;
+}
+
+void requireMaxAllocs(std::uint64_t aMax, std::source_location aSrcLoc) {
+  if (!TKOZ_SRTEST_ALLOC_HOOKS) {
+    throwFailure("allocations are not counted, the runner is built with "
+                 "TKOZ_SRTEST_NO_ALLOC_HOOKS",
+                 aSrcLoc);
+  }
+  std::uint64_t const lCount = allocationCount();
+  if (lCount > aMax) [[unlikely]] {
+    throwFailure(
+        std::format("{} allocations, expected at most {}", lCount, aMax),
+        aSrcLoc);
+  }
+}
+
 void requireCondition(bool aCondition, std::string_view aFalseMsg,
                       std::source_location aSrcLoc) {
   if (!aCondition) [[unlikely]] {
@@ -500,6 +680,276 @@ template void requireNearImpl<false, double>(double, double, double,
                                              char const *,
                                              std::source_location);
 
+// Elements are compared in blocks with a narrow failure counter and no
+// branches so the loop vectorizes. Anything else about the failures is only
+// computed in a second pass once the fast pass found one.
+inline constexpr std::size_t cAllCloseBlockSize = 1024;
+inline constexpr std::size_t cAllCloseMaxIndices = 8;
+
+// Count elements for which aWithin is false.
+template <std::floating_point T, typename F>
+[[nodiscard]] inline auto countNotWithin(std::span<T const> aActual,
+                                         std::span<T const> aExpected,
+                                         F const &aWithin) noexcept
+    -> std::size_t {
+  std::size_t lFailed = 0;
+  T const *const lActual = aActual.data();
+  T const *const lExpected = aExpected.data();
+  for (std::size_t lStart = 0; lStart < aActual.size();
+       lStart += cAllCloseBlockSize) {
+    std::size_t const lEnd =
+        std::min(aActual.size(), lStart + cAllCloseBlockSize);
+    std::uint32_t lBlockFailed = 0;
+    for (std::size_t i = lStart; i < lEnd; ++i) {
+      lBlockFailed +=
+          static_cast<std::uint32_t>(!aWithin(lActual[i], lExpected[i]));
+    }
+    lFailed += lBlockFailed;
+  }
+  return lFailed;
+}
+
+// After a failure, find the worst error and the first failing indices and
+// throw with all of it. The error function gives the value which is compared
+// to the tolerance, NaN errors count as the worst.
+template <std::floating_point T, typename F, typename E, typename G>
+[[noreturn]] void
+throwAllCloseFailure(std::span<T const> aActual, std::span<T const> aExpected,
+                     std::size_t aFailed, std::string_view aErrorName,
+                     std::string_view aToleranceText, F const &aWithin,
+                     E const &aError, G const &aErrorString,
+                     char const *aActualStr, char const *aExpectedStr,
+                     std::source_location aSrcLoc) {
+  std::size_t lWorstIndex = 0;
+  bool lFound = false;
+  std::string lIndices;
+  std::size_t lNumIndices = 0;
+  auto lWorst = aError(aActual[0], aExpected[0]);
+  for (std::size_t i = 0; i < aActual.size(); ++i) {
+    if (aWithin(aActual[i], aExpected[i])) {
+      continue;
+    }
+    auto const lError = aError(aActual[i], aExpected[i]);
+    if (!lFound || lError > lWorst || (lError != lError && lWorst == lWorst)) {
+      lWorst = lError;
+      lWorstIndex = i;
+      lFound = true;
+    }
+    if (lNumIndices < cAllCloseMaxIndices) {
+      lIndices += lNumIndices == 0 ? "" : ", ";
+      lIndices += std::to_string(i);
+    } else if (lNumIndices == cAllCloseMaxIndices) {
+      lIndices += ", ...";
+    }
+    ++lNumIndices;
+  }
+  throwFailure(std::format("expected all of {} to be near {} "
+                           "with {} error at most {} "
+                           "but {} of {} elements failed, "
+                           "worst {} error {} at index {} ({} vs {}), "
+                           "failing indices: {}",
+                           aActualStr, aExpectedStr, aErrorName,
+                           aToleranceText, aFailed, aActual.size(), aErrorName,
+                           aErrorString(lWorst), lWorstIndex,
+                           fpString(aActual[lWorstIndex]),
+                           fpString(aExpected[lWorstIndex]), lIndices),
+               aSrcLoc);
+}
+
+// Require the sizes of ranges compared elementwise to match.
+inline void requireSameSize(std::size_t aActualSize, std::size_t aExpectedSize,
+                            char const *aActualStr, char const *aExpectedStr,
+                            std::source_location aSrcLoc) {
+  if (aActualSize != aExpectedSize) [[unlikely]] {
+    throwFailure(std::format("expected {} (size {}) and {} (size {}) to "
+                             "have the same size",
+                             aActualStr, aActualSize, aExpectedStr,
+                             aExpectedSize),
+                 aSrcLoc);
+  }
+}
+
+template <bool cIncludeEqualT, std::floating_point T>
+void requireAllCloseAbsImpl(std::span<T const> aActual,
+                            std::span<T const> aExpected, T aTolerance,
+                            char const *aActualStr, char const *aExpectedStr,
+                            char const *aToleranceStr,
+                            std::source_location aSrcLoc) {
+  requireSameSize(aActual.size(), aExpected.size(), aActualStr, aExpectedStr,
+                  aSrcLoc);
+  auto const fWithin = [aTolerance](T aA, T aE) noexcept {
+    T const lError = fpErrAbs(aA, aE);
+    if constexpr (cIncludeEqualT) {
+      return lError <= aTolerance;
+    } else {
+      return lError < aTolerance;
+    }
+  };
+  std::size_t const lFailed = countNotWithin(aActual, aExpected, fWithin);
+  if (lFailed > 0) [[unlikely]] {
+    throwAllCloseFailure(
+        aActual, aExpected, lFailed, "absolute",
+        std::format("{} ({})", aToleranceStr, fpString(aTolerance)), fWithin,
+        [](T aA, T aE) { return fpErrAbs(aA, aE); },
+        [](T aError) { return fpString(aError); }, aActualStr, aExpectedStr,
+        aSrcLoc);
+  }
+}
+
+template void requireAllCloseAbsImpl<true, float>(std::span<float const>,
+                                                  std::span<float const>,
+                                                  float, char const *,
+                                                  char const *, char const *,
+                                                  std::source_location);
+template void requireAllCloseAbsImpl<true, double>(std::span<double const>,
+                                                   std::span<double const>,
+                                                   double, char const *,
+                                                   char const *, char const *,
+                                                   std::source_location);
+template void requireAllCloseAbsImpl<false, float>(std::span<float const>,
+                                                   std::span<float const>,
+                                                   float, char const *,
+                                                   char const *, char const *,
+                                                   std::source_location);
+template void requireAllCloseAbsImpl<false, double>(std::span<double const>,
+                                                    std::span<double const>,
+                                                    double, char const *,
+                                                    char const *, char const *,
+                                                    std::source_location);
+
+template <RelErrDiv cDivT, bool cIncludeEqualT, std::floating_point T>
+void requireAllCloseRelImpl(std::span<T const> aActual,
+                            std::span<T const> aExpected, T aTolerance,
+                            char const *aActualStr, char const *aExpectedStr,
+                            char const *aToleranceStr,
+                            std::source_location aSrcLoc) {
+  requireSameSize(aActual.size(), aExpected.size(), aActualStr, aExpectedStr,
+                  aSrcLoc);
+  // Same multiplication form as requireCloseRelImpl to avoid division
+  auto const fWithin = [aTolerance](T aA, T aE) noexcept {
+    T lLhs = fpErrAbs(aA, aE);
+    T lRhs = aTolerance;
+    if constexpr (cDivT == RelErrDiv::cExp) {
+      lRhs *= std::abs(aE);
+    } else if constexpr (cDivT == RelErrDiv::cMax) {
+      lRhs *= std::max(std::abs(aA), std::abs(aE));
+    } else if constexpr (cDivT == RelErrDiv::cAvg) {
+      lLhs *= T{2.0};
+      lRhs *= std::abs(aA) + std::abs(aE);
+    } else {
+      static_assert(false, "unexpected relative error divisor type");
+    }
+    if constexpr (cIncludeEqualT) {
+      return lLhs <= lRhs;
+    } else {
+      return lLhs < lRhs;
+    }
+  };
+  std::size_t const lFailed = countNotWithin(aActual, aExpected, fWithin);
+  if (lFailed > 0) [[unlikely]] {
+    throwAllCloseFailure(
+        aActual, aExpected, lFailed, "relative",
+        std::format("{} ({})", aToleranceStr, fpString(aTolerance)), fWithin,
+        [](T aA, T aE) { return fpErrRel<cDivT>(aA, aE); },
+        [](T aError) { return fpString(aError); }, aActualStr, aExpectedStr,
+        aSrcLoc);
+  }
+}
+
+template void requireAllCloseRelImpl<RelErrDiv::cExp, true, float>(
+    std::span<float const>, std::span<float const>, float, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cExp, true, double>(
+    std::span<double const>, std::span<double const>, double, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cExp, false, float>(
+    std::span<float const>, std::span<float const>, float, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cExp, false, double>(
+    std::span<double const>, std::span<double const>, double, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cMax, true, float>(
+    std::span<float const>, std::span<float const>, float, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cMax, true, double>(
+    std::span<double const>, std::span<double const>, double, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cMax, false, float>(
+    std::span<float const>, std::span<float const>, float, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cMax, false, double>(
+    std::span<double const>, std::span<double const>, double, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cAvg, true, float>(
+    std::span<float const>, std::span<float const>, float, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cAvg, true, double>(
+    std::span<double const>, std::span<double const>, double, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cAvg, false, float>(
+    std::span<float const>, std::span<float const>, float, char const *,
+    char const *, char const *, std::source_location);
+template void requireAllCloseRelImpl<RelErrDiv::cAvg, false, double>(
+    std::span<double const>, std::span<double const>, double, char const *,
+    char const *, char const *, std::source_location);
+
+template <bool cIncludeEqualT, std::floating_point T, typename U>
+void requireAllCloseUlpImpl(std::span<T const> aActual,
+                            std::span<T const> aExpected, U aTolerance,
+                            char const *aActualStr, char const *aExpectedStr,
+                            char const *aToleranceStr,
+                            std::source_location aSrcLoc) {
+  static_assert(std::is_same_v<U, typename FpBits<T>::Unsigned>);
+  static_assert(std::numeric_limits<T>::is_iec559,
+                "ULP distance assumes IEEE 754 representation");
+  requireSameSize(aActual.size(), aExpected.size(), aActualStr, aExpectedStr,
+                  aSrcLoc);
+  using BitsT = FpBits<T>::Signed;
+  // Branchless form of fpErrUlpImpl: the same mapping of the bits to ordered
+  // integers written with selects, which also gives 0 for equal infinities.
+  auto const fError = [](T aA, T aE) noexcept -> U {
+    BitsT lBitsA = std::bit_cast<BitsT>(aA);
+    BitsT lBitsE = std::bit_cast<BitsT>(aE);
+    lBitsA = lBitsA < BitsT{0} ? std::numeric_limits<BitsT>::min() - lBitsA
+                               : lBitsA;
+    lBitsE = lBitsE < BitsT{0} ? std::numeric_limits<BitsT>::min() - lBitsE
+                               : lBitsE;
+    U const lDist = lBitsA > lBitsE
+                        ? static_cast<U>(lBitsA) - static_cast<U>(lBitsE)
+                        : static_cast<U>(lBitsE) - static_cast<U>(lBitsA);
+    bool const lNan = aA != aA || aE != aE;
+    return lNan ? std::numeric_limits<U>::max() : lDist;
+  };
+  auto const fWithin = [aTolerance, &fError](T aA, T aE) noexcept {
+    if constexpr (cIncludeEqualT) {
+      return fError(aA, aE) <= aTolerance;
+    } else {
+      return fError(aA, aE) < aTolerance;
+    }
+  };
+  std::size_t const lFailed = countNotWithin(aActual, aExpected, fWithin);
+  if (lFailed > 0) [[unlikely]] {
+    throwAllCloseFailure(
+        aActual, aExpected, lFailed, "ULP",
+        std::format("{} ({})", aToleranceStr, aTolerance), fWithin, fError,
+        [](U aError) { return std::to_string(aError); }, aActualStr,
+        aExpectedStr, aSrcLoc);
+  }
+}
+
+template void requireAllCloseUlpImpl<true, float, std::uint32_t>(
+    std::span<float const>, std::span<float const>, std::uint32_t,
+    char const *, char const *, char const *, std::source_location);
+template void requireAllCloseUlpImpl<true, double, std::uint64_t>(
+    std::span<double const>, std::span<double const>, std::uint64_t,
+    char const *, char const *, char const *, std::source_location);
+template void requireAllCloseUlpImpl<false, float, std::uint32_t>(
+    std::span<float const>, std::span<float const>, std::uint32_t,
+    char const *, char const *, char const *, std::source_location);
+template void requireAllCloseUlpImpl<false, double, std::uint64_t>(
+    std::span<double const>, std::span<double const>, std::uint64_t,
+    char const *, char const *, char const *, std::source_location);
+
 } // namespace internal
 
 } // namespace tkoz::srtest
@@ -574,6 +1024,279 @@ static constexpr const char *cBgBMagenta = "\033[105m";
 static constexpr const char *cBgBCyan = "\033[106m";
 static constexpr const char *cBgBWhite = "\033[107m";
 
+/// \brief Format of the per test results, selected with --reporter.
+enum class ReporterKind : std::uint8_t { CONSOLE, JUNIT, JSONL, TAP };
+
+/// \brief Format of the test list, selected with --format.
+enum class ListFormat : std::uint8_t { TEXT, JSON };
+
+namespace internal {
+
+/// Parse a duration with a unit: ns, us, ms, s or min, such as "250ms" or
+/// "1.5s".
+/// \param aValue The text.
+/// \param aDuration Set to the duration if it is valid.
+/// \return False if the text is not a valid duration.
+[[nodiscard]] inline auto parseDuration(std::string_view aValue,
+                                        std::chrono::nanoseconds &aDuration)
+    -> bool {
+  static constexpr std::pair<std::string_view, double> cUnits[] = {
+      {"ns", 1.0}, {"us", 1e3}, {"ms", 1e6}, {"min", 60e9}, {"s", 1e9}};
+  for (auto const &[lUnit, lNanos] : cUnits) {
+    if (!aValue.ends_with(lUnit)) {
+      continue;
+    }
+    std::string_view const lNumber =
+        aValue.substr(0, aValue.size() - lUnit.size());
+    double lCount = 0.0;
+    auto const [lEnd, lError] = std::from_chars(
+        lNumber.data(), lNumber.data() + lNumber.size(), lCount);
+    if (lNumber.empty() || lError != std::errc{} ||
+        lEnd != lNumber.data() + lNumber.size() || !(lCount >= 0.0) ||
+        lCount * lNanos > 1e18) {
+      return false;
+    }
+    aDuration = std::chrono::nanoseconds(
+        static_cast<std::chrono::nanoseconds::rep>(lCount * lNanos));
+    return true;
+  }
+  return false;
+}
+
+} // namespace internal
+
+/// \brief Time budgets from --budget, the longest a test should take. A
+/// budget for a single test overrides those of its tags, and a test with
+/// several tags which have budgets gets the smallest one.
+class TimeBudgets final {
+private:
+  std::array<std::optional<std::chrono::nanoseconds>, TestTags::TAG_COUNT>
+      mTags;
+  std::unordered_map<std::string, std::chrono::nanoseconds> mTests;
+
+public:
+  /// \brief A budget which applies to a test.
+  struct Budget final {
+    std::chrono::nanoseconds mLimit;
+    /// Where the budget comes from, a tag name or "test".
+    std::string_view mSource;
+  };
+
+  /// Add or replace a budget.
+  /// \param aSpec "TAG=DURATION" or "file:name=DURATION", see
+  /// \c internal::parseDuration for durations.
+  /// \return False if the specification is not valid.
+  [[nodiscard]] inline auto add(std::string_view aSpec) -> bool {
+    std::size_t const lEquals = aSpec.rfind('=');
+    std::chrono::nanoseconds lLimit{};
+    if (lEquals == std::string_view::npos || lEquals == 0 ||
+        !internal::parseDuration(aSpec.substr(lEquals + 1), lLimit)) {
+      return false;
+    }
+    std::string_view const lTarget = aSpec.substr(0, lEquals);
+    if (lTarget.find(':') != std::string_view::npos) {
+      mTests.insert_or_assign(std::string(lTarget), lLimit);
+      return true;
+    }
+    if (auto const lTag = TestTags::fromString(lTarget)) {
+      mTags[*lTag] = lLimit;
+      return true;
+    }
+    return false;
+  }
+
+  /// \return The budget of a test, if it has one.
+  [[nodiscard]] inline auto find(TestCaseInfo const &aTest) const
+      -> std::optional<Budget> {
+    if (!mTests.empty()) {
+      auto const lIter =
+          mTests.find(std::format("{}:{}", aTest.mFile, aTest.mName));
+      if (lIter != mTests.end()) {
+        return Budget{lIter->second, "test"};
+      }
+    }
+    std::optional<Budget> lResult;
+    for (TestTags::TagEnum const lTag : aTest.mTags.allTags()) {
+      auto const &lLimit = mTags[lTag];
+      if (lLimit.has_value() &&
+          (!lResult.has_value() || *lLimit < lResult->mLimit)) {
+        lResult = Budget{*lLimit, TestTags::tagString(lTag)};
+      }
+    }
+    return lResult;
+  }
+};
+
+/// \brief Selects tests by a tag expression from --tags, such as
+/// "FAST & !NETWORK". Tag names are combined with ! (not), & (and), | (or)
+/// and parentheses, with the usual precedence. The expression is compiled to
+/// a disjunction of clauses, each a mask of tags which are required and a
+/// mask of tags which are forbidden, so matching a test is a few bitwise
+/// operations without any string comparison.
+class TagFilter final {
+private:
+  struct Clause final {
+    std::uint64_t mRequired = 0;
+    std::uint64_t mForbidden = 0;
+  };
+  using Clauses = std::vector<Clause>;
+
+  /// Limit on clauses so a pathological expression is an error instead of
+  /// exponential growth.
+  static constexpr std::size_t cMaxClauses = 4096;
+
+  Clauses mClauses = {Clause{}};
+
+  /// \brief Recursive descent parser producing clauses directly.
+  struct Parser final {
+    std::string_view mText;
+    std::size_t mPos = 0;
+    std::string mError;
+
+    inline void skipSpace() noexcept {
+      while (mPos < mText.size() &&
+             (mText[mPos] == ' ' || mText[mPos] == '\t')) {
+        ++mPos;
+      }
+    }
+
+    [[nodiscard]] inline auto accept(char aChar) noexcept -> bool {
+      skipSpace();
+      if (mPos < mText.size() && mText[mPos] == aChar) {
+        ++mPos;
+        return true;
+      }
+      return false;
+    }
+
+    [[nodiscard]] inline auto fail(std::string aError) -> Clauses {
+      if (mError.empty()) {
+        mError = std::move(aError);
+      }
+      return {};
+    }
+
+    // a & b, each pair of clauses is combined and contradictions dropped
+    [[nodiscard]] inline auto both(Clauses const &aLeft, Clauses const &aRight)
+        -> Clauses {
+      Clauses lResult;
+      for (Clause const &lLeft : aLeft) {
+        for (Clause const &lRight : aRight) {
+          Clause const lClause{lLeft.mRequired | lRight.mRequired,
+                               lLeft.mForbidden | lRight.mForbidden};
+          if ((lClause.mRequired & lClause.mForbidden) == 0) {
+            lResult.push_back(lClause);
+          }
+        }
+      }
+      if (lResult.size() > cMaxClauses) {
+        return fail("tag expression is too complex");
+      }
+      return lResult;
+    }
+
+    // !a by De Morgan, each clause becomes an or of its negated tags
+    [[nodiscard]] inline auto negate(Clauses const &aClauses) -> Clauses {
+      Clauses lResult = {Clause{}};
+      for (Clause const &lClause : aClauses) {
+        Clauses lNegated;
+        for (std::uint64_t lBits = lClause.mRequired; lBits != 0;
+             lBits &= lBits - 1) {
+          lNegated.push_back(Clause{0, lBits & -lBits});
+        }
+        for (std::uint64_t lBits = lClause.mForbidden; lBits != 0;
+             lBits &= lBits - 1) {
+          lNegated.push_back(Clause{lBits & -lBits, 0});
+        }
+        lResult = both(lResult, lNegated);
+      }
+      return lResult;
+    }
+
+    [[nodiscard]] inline auto unary() -> Clauses {
+      if (accept('!')) {
+        return negate(unary());
+      }
+      if (accept('(')) {
+        Clauses lInner = anyOf();
+        if (!accept(')')) {
+          return fail(std::format("expected ')' at position {}", mPos));
+        }
+        return lInner;
+      }
+      skipSpace();
+      std::size_t const lStart = mPos;
+      while (mPos < mText.size() &&
+             (std::isalnum(static_cast<unsigned char>(mText[mPos])) ||
+              mText[mPos] == '_')) {
+        ++mPos;
+      }
+      std::string_view const lName = mText.substr(lStart, mPos - lStart);
+      if (lName.empty()) {
+        return fail(std::format("expected a tag at position {}", lStart));
+      }
+      auto const lTag = TestTags::fromString(lName);
+      if (!lTag.has_value()) {
+        return fail(std::format("\"{}\" is not a tag", lName));
+      }
+      return {Clause{TestTags::bit(*lTag), 0}};
+    }
+
+    [[nodiscard]] inline auto allOf() -> Clauses {
+      Clauses lResult = unary();
+      while (mError.empty() && accept('&')) {
+        lResult = both(lResult, unary());
+      }
+      return lResult;
+    }
+
+    [[nodiscard]] inline auto anyOf() -> Clauses {
+      Clauses lResult = allOf();
+      while (mError.empty() && accept('|')) {
+        Clauses const lRight = allOf();
+        lResult.insert(lResult.end(), lRight.begin(), lRight.end());
+        if (lResult.size() > cMaxClauses) {
+          return fail("tag expression is too complex");
+        }
+      }
+      return lResult;
+    }
+  };
+
+public:
+  /// A filter which matches every test.
+  TagFilter() = default;
+
+  /// Compile a tag expression.
+  /// \param aExpression The expression.
+  /// \return An error message if the expression is not valid.
+  [[nodiscard]] inline auto parse(std::string_view aExpression)
+      -> std::optional<std::string> {
+    Parser lParser{aExpression, 0, {}};
+    Clauses lClauses = lParser.anyOf();
+    lParser.skipSpace();
+    if (lParser.mError.empty() && lParser.mPos != aExpression.size()) {
+      lParser.mError =
+          std::format("unexpected '{}' at position {}",
+                      aExpression[lParser.mPos], lParser.mPos);
+    }
+    if (!lParser.mError.empty()) {
+      return lParser.mError;
+    }
+    mClauses = std::move(lClauses);
+    return std::nullopt;
+  }
+
+  /// \return True if a test with these tags is selected.
+  [[nodiscard]] inline auto matches(TestTags aTags) const noexcept -> bool {
+    std::uint64_t const lMask = aTags.mask();
+    return std::ranges::any_of(mClauses, [lMask](Clause const &aClause) {
+      return (lMask & aClause.mRequired) == aClause.mRequired &&
+             (lMask & aClause.mForbidden) == 0;
+    });
+  }
+};
+
 /// Command parser. Pass \c argc and \c argv to its constructor.
 /// If there is a problem parsing or the help message should be displayed,
 /// it handles that and calls \c std::exit . Otherwise, its options are
@@ -581,23 +1304,17 @@ static constexpr const char *cBgBWhite = "\033[107m";
 ///
 /// TODO
 /// - filter (-f/--filter ?)
-/// - fail immediately or keep running tests (-c/--continue ?)
 /// - verbose (-v/--verbose)
 /// - quiet (-q/--quiet)
 /// - repeat tests (-r/--repeat N)
 /// - repeat single test or repeat sequence of selected tests
 /// - random test order
-/// - timeout per test or overall
 /// - output results (text/json?)
 /// - colored output control
-/// - test type/tag (fast/slow currently)
 /// - list tags
-/// - list selected tests (-l/--list)
-/// - list all tests (maybe --list --all)
 /// - list all files
 /// - select all tests (--all)
 /// - dry run to show what would run and order (-d/--dry-run)
-/// - threads for parallelism
 class CmdArgs {
 private:
   // Program name
@@ -610,6 +1327,209 @@ private:
   bool mEmpty = false;
   // -h/--help
   bool mHelp = false;
+  // -j/--jobs N, number of tests to run concurrently
+  std::size_t mJobs = 1;
+  // --state FILE, last outcome and duration of tests, empty if disabled with
+  // --no-state
+  std::string mStateFile = ".srtest-state";
+  // --last-failed, run only tests which failed last time
+  bool mLastFailed = false;
+  // --failed-first, run tests which failed last time first
+  bool mFailedFirst = false;
+  // -c/--continue-on-failure, keep running tests after a failure
+  bool mContinueOnFailure = false;
+  // --shard K/N, 1 based index and count of shards
+  std::size_t mShardIndex = 1;
+  std::size_t mShardCount = 1;
+  // --isolate, run tests in worker processes
+  bool mIsolate = false;
+  // --bench-time MS, minimum time of each benchmark repetition
+  std::size_t mBenchTimeMs = 10;
+  // --bench-reps N, number of measured benchmark repetitions
+  std::size_t mBenchReps = 20;
+  // --baseline FILE, benchmark results to compare against
+  std::string mBaseline;
+  // --save-baseline FILE, where to write benchmark results
+  std::string mSaveBaseline;
+  // --max-regress P%, allowed slowdown of a benchmark median in percent
+  double mMaxRegress = 5.0;
+  // --reporter NAME, format of the per test results
+  ReporterKind mReporter = ReporterKind::CONSOLE;
+  // --report-out FILE, where non console reporters write
+  std::string mReportOut;
+  // --report-fd N, file descriptor where non console reporters write
+  std::optional<int> mReportFd;
+  // --seed N, seed for property tests, random if not specified
+  std::optional<std::uint64_t> mSeed;
+  // --property-cases N, number of cases for each property test
+  std::size_t mPropertyCases = 1000;
+  // --property-threads N, threads for each property test, 0 for all cores
+  std::optional<std::size_t> mPropertyThreads;
+  // --instrument, measure allocations, peak RSS and hardware counters
+  bool mInstrument = false;
+  // --profile, sample the stacks of each test and report the hot symbols
+  bool mProfile = false;
+  // --profile-hz N, samples per second of CPU time of the test thread
+  std::size_t mProfileHz = 1000;
+  // --profile-top N, number of symbols listed for each profiled test
+  std::size_t mProfileTop = 10;
+  // --profile-folded FILE, where to write folded stacks for flame graphs
+  std::string mProfileFolded;
+  // --budget SPEC, time budgets for tags and tests, FAST tests get 1 second
+  // unless it is replaced
+  TimeBudgets mBudgets = []() {
+    TimeBudgets lBudgets;
+    static_cast<void>(lBudgets.add("FAST=1s"));
+    return lBudgets;
+  }();
+  // --budget-fail, a test which exceeds its budget fails
+  bool mBudgetFail = false;
+  // --timeout DURATION, hard limit for the duration of each test
+  std::optional<std::chrono::nanoseconds> mTimeout;
+  // --slowest N, number of slowest tests listed at the end
+  std::size_t mSlowest = 5;
+  // --tags EXPR, select only tests with matching tags
+  TagFilter mTagFilter;
+  std::string mTagExpression;
+  // --list, write the selected tests (all without paths) instead of running
+  bool mList = false;
+  // --format NAME, format of --list
+  ListFormat mListFormat = ListFormat::TEXT;
+
+  // Parse a count which must be made of only digits. Returns false if the
+  // value is not a valid count.
+  [[nodiscard]] static inline auto parseCount(std::string_view aValue,
+                                              std::size_t &aCount) noexcept
+      -> bool {
+    auto const [lEnd, lError] =
+        std::from_chars(aValue.data(), aValue.data() + aValue.size(), aCount);
+    return !aValue.empty() && lError == std::errc{} &&
+           lEnd == aValue.data() + aValue.size();
+  }
+
+  // Parse the value for --shard in the form K/N with 1 <= K <= N. Returns
+  // false if the value is not valid.
+  [[nodiscard]] inline auto parseShard(std::string_view aValue) noexcept
+      -> bool {
+    std::size_t const lSlashPos = aValue.find('/');
+    std::size_t lIndex = 0;
+    std::size_t lCount = 0;
+    if (lSlashPos == std::string_view::npos ||
+        !parseCount(aValue.substr(0, lSlashPos), lIndex) ||
+        !parseCount(aValue.substr(lSlashPos + 1), lCount) || lIndex == 0 ||
+        lIndex > lCount) {
+      return false;
+    }
+    mShardIndex = lIndex;
+    mShardCount = lCount;
+    return true;
+  }
+
+  // Match a long option which takes a value, either as "--name=value" or as
+  // "--name value" where the value is the next argument. The argument index
+  // is advanced past a separate value. Returns false if the option does not
+  // match. A missing value results in an empty string.
+  [[nodiscard]] static inline auto
+  longOptionValue(std::string_view aArg, std::string_view aName,
+                  int &aArgIndex, int argc, char **argv,
+                  std::string_view &aValue) noexcept -> bool {
+    if (!aArg.starts_with(aName)) {
+      return false;
+    }
+    std::string_view const lRest = aArg.substr(aName.size());
+    if (lRest.empty()) {
+      aValue = aArgIndex + 1 < argc ? argv[++aArgIndex] : "";
+      return true;
+    }
+    if (lRest.front() == '=') {
+      aValue = lRest.substr(1);
+      return true;
+    }
+    return false;
+  }
+
+  // Parse the value for --max-regress as a nonnegative percentage with an
+  // optional trailing '%'. Returns false if the value is not valid.
+  [[nodiscard]] inline auto parseMaxRegress(std::string_view aValue) noexcept
+      -> bool {
+    if (aValue.ends_with('%')) {
+      aValue.remove_suffix(1);
+    }
+    double lPercent = 0.0;
+    auto const [lEnd, lError] =
+        std::from_chars(aValue.data(), aValue.data() + aValue.size(), lPercent);
+    if (aValue.empty() || lError != std::errc{} ||
+        lEnd != aValue.data() + aValue.size() || !(lPercent >= 0.0)) {
+      return false;
+    }
+    mMaxRegress = lPercent;
+    return true;
+  }
+
+  // Parse the value for --seed, decimal or hexadecimal with 0x. Returns false
+  // if it is not a valid seed.
+  [[nodiscard]] inline auto parseSeed(std::string_view aValue) noexcept
+      -> bool {
+    int lBase = 10;
+    if (aValue.starts_with("0x") || aValue.starts_with("0X")) {
+      aValue.remove_prefix(2);
+      lBase = 16;
+    }
+    std::uint64_t lSeed = 0;
+    auto const [lEnd, lError] = std::from_chars(
+        aValue.data(), aValue.data() + aValue.size(), lSeed, lBase);
+    if (aValue.empty() || lError != std::errc{} ||
+        lEnd != aValue.data() + aValue.size()) {
+      return false;
+    }
+    mSeed = lSeed;
+    return true;
+  }
+
+  // Parse the value for --reporter. Returns false if it is not a reporter.
+  [[nodiscard]] inline auto parseReporter(std::string_view aValue) noexcept
+      -> bool {
+    static constexpr std::pair<std::string_view, ReporterKind> cReporters[] = {
+        {"console", ReporterKind::CONSOLE},
+        {"junit", ReporterKind::JUNIT},
+        {"jsonl", ReporterKind::JSONL},
+        {"tap", ReporterKind::TAP}};
+    for (auto const &[lName, lKind] : cReporters) {
+      if (aValue == lName) {
+        mReporter = lKind;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Parse the value for --format. Returns false if it is not a list format.
+  [[nodiscard]] inline auto parseListFormat(std::string_view aValue) noexcept
+      -> bool {
+    if (aValue == "text") {
+      mListFormat = ListFormat::TEXT;
+    } else if (aValue == "json") {
+      mListFormat = ListFormat::JSON;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // Parse the value for -j/--jobs. A value of 0 means use all hardware
+  // threads. Returns false if the value is not a valid count.
+  [[nodiscard]] inline auto parseJobs(std::string_view aValue) noexcept
+      -> bool {
+    std::size_t lJobs = 0;
+    if (!parseCount(aValue, lJobs)) {
+      return false;
+    }
+    if (lJobs == 0) {
+      lJobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    mJobs = lJobs;
+    return true;
+  }
 
 public:
   CmdArgs() = default;
@@ -630,52 +1550,354 @@ public:
       std::string lArg(argv[lArgIndex]);
       if (lArg.starts_with("--")) {
         // Long option
+        std::string_view lValue;
         if (lArg == "--help") {
           mHelp = true;
-        } else {
-          mFailureMessage = std::format("\"{}\" is not a valid option", lArg);
-          break;
-        }
-      } else if (lArg.starts_with('-')) {
-        // Short option(s)
-        if (lArg.size() < 2) {
-          mFailureMessage = "\"-\" is not a valid option";
-          break;
-        }
-        // Multiple options can be specified like "-abc"
-        for (std::size_t lOptIndex = 1; lOptIndex < lArg.size(); ++lOptIndex) {
-          switch (lArg[lOptIndex]) {
-          case 'h':
-            mHelp = true;
-            break;
-          default:
+        } else if (longOptionValue(lArg, "--jobs", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (!parseJobs(lValue)) {
             mFailureMessage =
-                std::format("\"-{}\" is not a valid option", lArg[lOptIndex]);
-            goto loop_end;
+                std::format("\"{}\" is not a valid job count", lValue);
+            break;
           }
-        }
-      } else {
-        // Positional arguments are test paths
-        mPaths.emplace_back(std::move(lArg));
-      }
-    }
-  // Goto might not be the greatest idea but if we find a problem then we
-  // want to end parsing with the first error message.
-  loop_end:
-  }
-
-  // Print help message to the ostream with provided program name and optionally
-  // exit with code 1.
+        } else if (longOptionValue(lArg, "--state", lArgIndex, argc, argv,
+                                   lValue) ||
+                   longOptionValue(lArg, "--timing-cache", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (lValue.empty()) {
+            mFailureMessage = "--state requires a file path";
+            break;
+          }
+          mStateFile = lValue;
+        } else if (lArg == "--no-state" || lArg == "--no-timing-cache") {
+          mStateFile.clear();
+        } else if (lArg == "--last-failed") {
+          mLastFailed = true;
+        } else if (lArg == "--failed-first") {
+          mFailedFirst = true;
+        } else if (lArg == "--continue-on-failure") {
+          mContinueOnFailure = true;
+        } else if (longOptionValue(lArg, "--shard", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (!parseShard(lValue)) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid shard, expected K/N with 1 <= K <= N",
+                lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--bench-time", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (!parseCount(lValue, mBenchTimeMs) || mBenchTimeMs == 0) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid benchmark time in ms", lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--bench-reps", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (!parseCount(lValue, mBenchReps) || mBenchReps == 0) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid benchmark repetition count", lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--baseline", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (lValue.empty()) {
+            mFailureMessage = "--baseline requires a file";
+            break;
+          }
+          mBaseline = lValue;
+        } else if (longOptionValue(lArg, "--save-baseline", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (lValue.empty()) {
+            mFailureMessage = "--save-baseline requires a file";
+            break;
+          }
+          mSaveBaseline = lValue;
+        } else if (longOptionValue(lArg, "--max-regress", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (!parseMaxRegress(lValue)) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid regression percentage", lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--seed", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (!parseSeed(lValue)) {
+            mFailureMessage =
+                std::format("\"{}\" is not a valid seed", lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--property-cases", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (!parseCount(lValue, mPropertyCases) || mPropertyCases == 0) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid property case count", lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--property-threads", lArgIndex,
+                                   argc, argv, lValue)) {
+          std::size_t lThreads = 0;
+          if (!parseCount(lValue, lThreads)) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid property thread count", lValue);
+            break;
+          }
+          mPropertyThreads = lThreads;
+        } else if (longOptionValue(lArg, "--reporter", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (!parseReporter(lValue)) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a reporter (console, junit, jsonl, tap)",
+                lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--report-out", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (lValue.empty()) {
+            mFailureMessage = "--report-out requires a file";
+            break;
+          }
+          mReportOut = lValue;
+        } else if (longOptionValue(lArg, "--report-fd", lArgIndex, argc,
+                                   argv, lValue)) {
+          std::size_t lFd = 0;
+          if (!parseCount(lValue, lFd) ||
+              lFd > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid file descriptor", lValue);
+            break;
+          }
+          mReportFd = static_cast<int>(lFd);
+        } else if (lArg == "--instrument") {
+          mInstrument = true;
+        } else if (lArg == "--profile") {
+          mProfile = true;
+        } else if (longOptionValue(lArg, "--profile-hz", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (!parseCount(lValue, mProfileHz) || mProfileHz == 0 ||
+              mProfileHz > 1000000) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid sampling rate (1 to 1000000)", lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--profile-top", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (!parseCount(lValue, mProfileTop)) {
+            mFailureMessage =
+                std::format("\"{}\" is not a valid symbol count", lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--profile-folded", lArgIndex, argc,
+                                   argv, lValue)) {
+          if (lValue.empty()) {
+            mFailureMessage = "--profile-folded requires a file";
+            break;
+          }
+          mProfileFolded = lValue;
+          mProfile = true;
+        } else if (lArg == "--budget-fail") {
+          mBudgetFail = true;
+        } else if (longOptionValue(lArg, "--budget", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (!mBudgets.add(lValue)) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid budget, expected TAG=DURATION or "
+                "file:name=DURATION",
+                lValue);
+            break;
+          }
+        } else if (longOptionValue(lArg, "--timeout", lArgIndex, argc, argv,
+                                   lValue)) {
+          std::chrono::nanoseconds lTimeout{};
+          if (!internal::parseDuration(lValue, lTimeout) ||
+              lTimeout.count() == 0) {
+            mFailureMessage = std::format(
+                "\"{}\" is not a valid timeout (such as 500ms or 10s)",
+                lValue);
+            break;
+          }
+          mTimeout = lTimeout;
+        } else if (longOptionValue(lArg, "--tags", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (auto const lError = mTagFilter.parse(lValue)) {
+            mFailureMessage =
+                std::format("invalid --tags \"{}\": {}", lValue, *lError);
+            break;
+          }
+          mTagExpression = lValue;
+        } else if (longOptionValue(lArg, "--slowest", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (!parseCount(lValue, mSlowest)) {
+            mFailureMessage =
+                std::format("\"{}\" is not a valid test count", lValue);
+            break;
+          }
+        } else if (lArg == "--list") {
+          mList = true;
+        } else if (longOptionValue(lArg, "--format", lArgIndex, argc, argv,
+                                   lValue)) {
+          if (!parseListFormat(lValue)) {
+            mFailureMessage =
+                std::format("\"{}\" is not a valid list format", lValue);
+            break;
+          }
+        } else if (lArg == "--isolate") {
+          if (!TKOZ_SRTEST_HAS_FORK) {
+            mFailureMessage = "--isolate is not supported on this platform";
+            break;
+          }
+          mIsolate = true;
+        } else {
+          mFailureMessage = std::format("\"{}\" is not a valid option", lArg);
+          break;
+        }
+      } else if (lArg.starts_with('-')) {
+        // Short option(s)
+        if (lArg.size() < 2) {
+          mFailureMessage = "\"-\" is not a valid option";
+          break;
+        }
+        // Multiple options can be specified like "-abc"
+        for (std::size_t lOptIndex = 1; lOptIndex < lArg.size(); ++lOptIndex) {
+          switch (lArg[lOptIndex]) {
+          case 'h':
+            mHelp = true;
+            break;
+          case 'c':
+            mContinueOnFailure = true;
+            break;
+          case 'j': {
+            // The count is the rest of this arg (-j8) or the next arg (-j 8)
+            std::string_view lValue;
+            if (lOptIndex + 1 < lArg.size()) {
+              lValue = std::string_view(lArg).substr(lOptIndex + 1);
+            } else if (lArgIndex + 1 < argc) {
+              lValue = argv[++lArgIndex];
+            }
+            if (!parseJobs(lValue)) {
+              mFailureMessage =
+                  std::format("\"{}\" is not a valid job count", lValue);
+              goto loop_end;
+            }
+            lOptIndex = lArg.size();
+            break;
+          }
+          default:
+            mFailureMessage =
+                std::format("\"-{}\" is not a valid option", lArg[lOptIndex]);
+            goto loop_end;
+          }
+        }
+      } else {
+        // Positional arguments are test paths
+        mPaths.emplace_back(std::move(lArg));
+      }
+    }
+    if (mFailureMessage.empty() && !mReportOut.empty() &&
+        mReportFd.has_value()) {
+      mFailureMessage = "--report-out and --report-fd are exclusive";
+    }
+    if (mFailureMessage.empty() && !TKOZ_SRTEST_HAS_FORK &&
+        (!mReportOut.empty() || mReportFd.has_value())) {
+      mFailureMessage = "--report-out and --report-fd are not supported on"
+                        " this platform";
+    }
+    if (mFailureMessage.empty() && !TKOZ_SRTEST_HAS_PROFILER && mProfile) {
+      mFailureMessage = "--profile is not supported on this platform";
+    }
+  // Goto might not be the greatest idea but if we find a problem then we
+  // want to end parsing with the first error message.
+  loop_end:
+  }
+
+  // Print help message to the ostream with provided program name and optionally
+  // exit with code 1.
   void printHelp(std::ostream &aStream) const {
-    aStream << "TKoz SRTest -- Statically registered test library" << std::endl;
-    aStream << std::format("Usage: {} [-h] [paths...]", mProgramName)
-            << std::endl;
+    aStream << "TKoz SRTest -- Statically registered test library" << '\n';
+    aStream << std::format("Usage: {} [-h] [-c] [-j N] [paths...]",
+                           mProgramName)
+            << '\n';
     aStream << "Test paths are in the form: path/to/dir/sourceFile:testName"
-            << std::endl;
-    aStream << "(start from repository root, do not include .cpp)" << std::endl;
-    aStream << std::endl;
-    aStream << "Options:" << std::endl;
-    aStream << "  -h/--help Print help message and exit" << std::endl;
+            << '\n';
+    aStream << "(start from repository root, do not include .cpp)" << '\n';
+    aStream << "(rows of TEST_CREATE_PARAMS tests are testName/0, testName/1)"
+            << '\n';
+    aStream << '\n';
+    aStream << "Options:" << '\n';
+    aStream << "  -h/--help Print help message and exit" << '\n';
+    aStream << "  -j/--jobs N Run up to N tests concurrently (0 for all cores),"
+            << '\n';
+    aStream << "    benchmarks run alone after the other tests" << '\n';
+    aStream << "  -c/--continue-on-failure Keep running tests after a failure"
+            << '\n';
+    aStream << "  --list Write the selected tests (all without paths) to"
+            << " stdout and exit" << '\n';
+    aStream << "  --format NAME Format of --list: text (default), json"
+            << '\n';
+    aStream << "    text lines are \"line tags file:name\", tags \"-\" if"
+            << " none" << '\n';
+    aStream << "  --state FILE Last outcome and duration of each test"
+            << " (default .srtest-state)" << '\n';
+    aStream << "  --no-state Do not read or write the state file" << '\n';
+    aStream << "  --last-failed Run only tests which failed last time, or all"
+            << " if none failed" << '\n';
+    aStream << "  --failed-first Run tests which failed last time first"
+            << '\n';
+    aStream << "  --shard K/N Run only the Kth of N equal parts of the"
+            << " selected tests" << '\n';
+    aStream << "  --isolate Run tests in worker processes (see -j), a crashing"
+            << " or failing test" << '\n';
+    aStream << "    does not stop other tests" << '\n';
+    aStream << "  --bench-time MS Minimum time per benchmark repetition"
+            << " (default 10)" << '\n';
+    aStream << "  --bench-reps N Measured repetitions per benchmark"
+            << " (default 20)" << '\n';
+    aStream << "  --baseline FILE Fail benchmarks which are slower than in"
+            << " FILE" << '\n';
+    aStream << "  --save-baseline FILE Write benchmark results to FILE"
+            << '\n';
+    aStream << "  --max-regress P% Allowed slowdown for --baseline"
+            << " (default 5%)" << '\n';
+    aStream << "  --seed N Seed for property tests, decimal or 0x hex"
+            << " (default random)" << '\n';
+    aStream << "  --property-cases N Cases tried per property test"
+            << " (default 1000)" << '\n';
+    aStream << "  --property-threads N Threads per property test, 0 for all"
+            << " cores" << '\n';
+    aStream << "    (default the cores divided by the -j jobs)" << '\n';
+    aStream << "  --instrument Report allocations, peak RSS growth and"
+            << " hardware counters" << '\n';
+    aStream << "    of each test (counted on the test thread)" << '\n';
+    aStream << "  --profile Sample the stacks of each test and list its"
+            << " hottest symbols" << '\n';
+    aStream << "    (CPU time of the test thread, link with -rdynamic for"
+            << " symbol names)" << '\n';
+    aStream << "  --profile-hz N Samples per second of CPU time"
+            << " (default 1000)" << '\n';
+    aStream << "  --profile-top N Symbols listed for each test (default 10)"
+            << '\n';
+    aStream << "  --profile-folded FILE Write folded stacks for flame graphs"
+            << " (implies --profile)" << '\n';
+    aStream << "  --tags EXPR Run only tests whose tags match, such as"
+            << " \"FAST & !(SLOW | BENCH)\"" << '\n';
+    aStream << "  --budget SPEC Time budget TAG=DURATION or"
+            << " file:name=DURATION, such as" << '\n';
+    aStream << "    SLOW=30s, units ns/us/ms/s/min (default FAST=1s)"
+            << '\n';
+    aStream << "  --budget-fail Fail tests which exceed their budget instead"
+            << " of warning" << '\n';
+    aStream << "  --timeout DURATION Stop a test which runs longer, with"
+            << " --isolate only" << '\n';
+    aStream << "    the test is killed, otherwise the run stops" << '\n';
+    aStream << "  --slowest N List the N slowest tests at the end"
+            << " (default 5)" << '\n';
+    aStream << "  --reporter NAME Format of test results: console (default),"
+            << " junit, jsonl, tap" << '\n';
+    aStream << "  --report-out FILE Write results of a non console reporter"
+            << " to FILE" << '\n';
+    aStream << "  --report-fd N Write results of a non console reporter to"
+            << " descriptor N" << '\n';
+    aStream << "    (default stdout)" << '\n';
   }
 
   /// \return Name of the executable if it can be determined.
@@ -706,48 +1928,412 @@ public:
 
   /// \return True if help (-h/--help) was specified.
   [[nodiscard]] auto help() const noexcept -> bool { return mHelp; }
+
+  /// \return Number of tests to run concurrently (-j/--jobs), at least 1.
+  [[nodiscard]] auto jobs() const noexcept -> std::size_t { return mJobs; }
+
+  /// \return Path of the state file, empty if disabled (--state).
+  [[nodiscard]] auto stateFile() const noexcept -> std::string const & {
+    return mStateFile;
+  }
+
+  /// \return True to run only tests which failed last time (--last-failed).
+  [[nodiscard]] auto lastFailed() const noexcept -> bool {
+    return mLastFailed;
+  }
+
+  /// \return True to run tests which failed last time first
+  /// (--failed-first).
+  [[nodiscard]] auto failedFirst() const noexcept -> bool {
+    return mFailedFirst;
+  }
+
+  /// \return True to keep running after a failure (-c/--continue-on-failure).
+  [[nodiscard]] auto continueOnFailure() const noexcept -> bool {
+    return mContinueOnFailure;
+  }
+
+  /// \return The 1 based shard index K from --shard K/N.
+  [[nodiscard]] auto shardIndex() const noexcept -> std::size_t {
+    return mShardIndex;
+  }
+
+  /// \return The shard count N from --shard K/N.
+  [[nodiscard]] auto shardCount() const noexcept -> std::size_t {
+    return mShardCount;
+  }
+
+  /// \return True if tests run in worker processes (--isolate).
+  [[nodiscard]] auto isolate() const noexcept -> bool { return mIsolate; }
+
+  /// \return Minimum time of each benchmark repetition (--bench-time).
+  [[nodiscard]] auto benchTime() const noexcept -> std::chrono::milliseconds {
+    return std::chrono::milliseconds(mBenchTimeMs);
+  }
+
+  /// \return Number of measured benchmark repetitions (--bench-reps).
+  [[nodiscard]] auto benchReps() const noexcept -> std::size_t {
+    return mBenchReps;
+  }
+
+  /// \return Baseline file to compare against, empty if none (--baseline).
+  [[nodiscard]] auto baseline() const noexcept -> std::string const & {
+    return mBaseline;
+  }
+
+  /// \return Baseline file to write, empty if none (--save-baseline).
+  [[nodiscard]] auto saveBaseline() const noexcept -> std::string const & {
+    return mSaveBaseline;
+  }
+
+  /// \return Allowed benchmark slowdown in percent (--max-regress).
+  [[nodiscard]] auto maxRegress() const noexcept -> double {
+    return mMaxRegress;
+  }
+
+  /// \return Format of the per test results (--reporter).
+  [[nodiscard]] auto reporter() const noexcept -> ReporterKind {
+    return mReporter;
+  }
+
+  /// \return File for non console reporters, empty if none (--report-out).
+  [[nodiscard]] auto reportOut() const noexcept -> std::string const & {
+    return mReportOut;
+  }
+
+  /// \return File descriptor for non console reporters (--report-fd).
+  [[nodiscard]] auto reportFd() const noexcept -> std::optional<int> {
+    return mReportFd;
+  }
+
+  /// \return Seed for property tests, if specified (--seed).
+  [[nodiscard]] auto seed() const noexcept -> std::optional<std::uint64_t> {
+    return mSeed;
+  }
+
+  /// \return Number of cases for each property test (--property-cases).
+  [[nodiscard]] auto propertyCases() const noexcept -> std::size_t {
+    return mPropertyCases;
+  }
+
+  /// \return Threads for each property test, 0 for all, if given
+  /// (--property-threads).
+  [[nodiscard]] auto propertyThreads() const noexcept
+      -> std::optional<std::size_t> {
+    return mPropertyThreads;
+  }
+
+  /// \return True if resources used by tests are measured (--instrument).
+  [[nodiscard]] auto instrument() const noexcept -> bool {
+    return mInstrument;
+  }
+
+  /// \return True if the stacks of tests are sampled (--profile).
+  [[nodiscard]] auto profile() const noexcept -> bool { return mProfile; }
+
+  /// \return Samples per second of CPU time (--profile-hz).
+  [[nodiscard]] auto profileHz() const noexcept -> std::size_t {
+    return mProfileHz;
+  }
+
+  /// \return Number of symbols listed for each test (--profile-top).
+  [[nodiscard]] auto profileTop() const noexcept -> std::size_t {
+    return mProfileTop;
+  }
+
+  /// \return File for folded stacks, empty if not written
+  /// (--profile-folded).
+  [[nodiscard]] auto profileFolded() const noexcept -> std::string const & {
+    return mProfileFolded;
+  }
+
+  /// \return Time budgets of tags and tests (--budget).
+  [[nodiscard]] auto budgets() const noexcept -> TimeBudgets const & {
+    return mBudgets;
+  }
+
+  /// \return True if exceeding a budget fails a test (--budget-fail).
+  [[nodiscard]] auto budgetFail() const noexcept -> bool {
+    return mBudgetFail;
+  }
+
+  /// \return Hard limit for the duration of each test (--timeout).
+  [[nodiscard]] auto timeout() const noexcept
+      -> std::optional<std::chrono::nanoseconds> {
+    return mTimeout;
+  }
+
+  /// \return Filter selecting tests by tags (--tags).
+  [[nodiscard]] auto tagFilter() const noexcept -> TagFilter const & {
+    return mTagFilter;
+  }
+
+  /// \return The tag expression, empty if none (--tags).
+  [[nodiscard]] auto tagExpression() const noexcept -> std::string const & {
+    return mTagExpression;
+  }
+
+  /// \return Number of slowest tests listed at the end (--slowest).
+  [[nodiscard]] auto slowest() const noexcept -> std::size_t {
+    return mSlowest;
+  }
+
+  /// \return True to list tests instead of running them (--list).
+  [[nodiscard]] auto list() const noexcept -> bool { return mList; }
+
+  /// \return Format of the test list (--format).
+  [[nodiscard]] auto listFormat() const noexcept -> ListFormat {
+    return mListFormat;
+  }
 };
 
-/// The stream to write test runner information to. This is intended to be
-/// terminal output viewed by developers.
+/// The stream to write the help message to.
 std::ostream &gInfoStream = std::cerr;
 
 /// The command line argument information. At the start of the program, call
 /// \c CmdArgs::parse to setup this data.
 CmdArgs gCmdArgs;
 
-// Perform a basic filter on all registered tests to determine what to run.
-//
-// TODO Create some sort of tree of the path structure to make lookup by file
-// or directory path more efficient.
-auto testsToRun(std::vector<std::string> const &aPaths)
-    -> std::vector<tkoz::srtest::TestCaseInfo *> {
-  auto const &sRegistry = tkoz::srtest::TestRegistry::instance();
-  std::vector<tkoz::srtest::TestCaseInfo *> lResult;
-  for (std::string const &lPath : aPaths) {
-    std::size_t lSepPos = lPath.find(':');
-    if (lSepPos == std::string::npos) {
-      // Add all tests in files which begin with the specified path
-      for (auto const &lTest : sRegistry) {
-        if (!lTest->mFile.starts_with(lPath)) {
-          continue;
+auto internal::propertyConfig() -> PropertyConfig {
+  // Pick a random seed once so all property tests in a run share it and one
+  // --seed reproduces any of them
+  static std::uint64_t const sSeed = []() {
+    if (gCmdArgs.seed().has_value()) {
+      return *gCmdArgs.seed();
+    }
+    std::random_device lDevice;
+    return (std::uint64_t{lDevice()} << 32) ^ std::uint64_t{lDevice()} ^
+           static_cast<std::uint64_t>(
+               std::chrono::steady_clock::now().time_since_epoch().count());
+  }();
+  std::size_t const lCores = std::max(1u, std::thread::hardware_concurrency());
+  std::size_t lThreads = gCmdArgs.propertyThreads().value_or(0);
+  if (!gCmdArgs.propertyThreads().has_value()) {
+    // Share the cores with the other tests running concurrently (-j), which
+    // may be property tests too
+    lThreads = std::max<std::size_t>(1, lCores / gCmdArgs.jobs());
+  } else if (lThreads == 0) {
+    lThreads = lCores;
+  }
+  return PropertyConfig{sSeed, gCmdArgs.propertyCases(), lThreads};
+}
+
+auto internal::searchProperty(
+    PropertyConfig const &aConfig,
+    std::function<bool(std::uint64_t)> const &aPasses) -> PropertySearch {
+  // Blocks are large enough to make the shared counter cheap and small enough
+  // that workers stop soon after a failure
+  constexpr std::uint64_t cBlockSize = 256;
+  constexpr std::uint64_t cNoFailure =
+      std::numeric_limits<std::uint64_t>::max();
+  std::atomic<std::uint64_t> lNextCase = 0;
+  std::atomic<std::uint64_t> lFailingCase = cNoFailure;
+  std::atomic<std::uint64_t> lCasesRun = 0;
+  auto const fWorker = [&]() {
+    std::uint64_t lRun = 0;
+    while (true) {
+      std::uint64_t const lBegin = lNextCase.fetch_add(cBlockSize);
+      if (lBegin >= aConfig.mCases ||
+          lBegin >= lFailingCase.load(std::memory_order_relaxed)) {
+        break;
+      }
+      std::uint64_t const lEnd = std::min(lBegin + cBlockSize, aConfig.mCases);
+      for (std::uint64_t i = lBegin; i < lEnd; ++i) {
+        // Cases after a lower failure can not change the result
+        if (i >= lFailingCase.load(std::memory_order_relaxed)) {
+          break;
         }
-        auto const lIter =
-            lTest->mFile.begin() +
-            static_cast<std::string::difference_type>(lPath.size());
-        if (lIter == lTest->mFile.end() || *lIter == '/') {
-          lResult.push_back(lTest.get());
+        ++lRun;
+        if (!aPasses(i)) {
+          std::uint64_t lLowest = lFailingCase.load();
+          while (i < lLowest && !lFailingCase.compare_exchange_weak(lLowest, i))
+            ;
+          break;
         }
       }
-    } else {
-      // Path and test name must match
-      std::string lTestFile = lPath.substr(0, lSepPos);
-      std::string lTestName = lPath.substr(lSepPos + 1);
-      for (auto const &lTest : sRegistry)
-        if (lTest->mFile == lTestFile && lTest->mName == lTestName) {
-          lResult.push_back(lTest.get());
+    }
+    lCasesRun += lRun;
+  };
+  std::size_t const lThreads = static_cast<std::size_t>(std::min<std::uint64_t>(
+      aConfig.mThreads, (aConfig.mCases + cBlockSize - 1) / cBlockSize));
+  auto const lStart = std::chrono::steady_clock::now();
+  if (lThreads <= 1) {
+    fWorker();
+  } else {
+    // Checks and messages are thread_local so the workers do not interfere
+    std::vector<std::jthread> lWorkers;
+    lWorkers.reserve(lThreads);
+    for (std::size_t i = 0; i < lThreads; ++i) {
+      lWorkers.emplace_back(fWorker);
+    }
+  }
+  PropertySearch lResult;
+  lResult.mThreads = std::max<std::size_t>(lThreads, 1);
+  lResult.mSeconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - lStart)
+                         .count();
+  lResult.mCasesRun = lCasesRun.load();
+  if (lFailingCase.load() != cNoFailure) {
+    lResult.mFailingCase = lFailingCase.load();
+  }
+  return lResult;
+}
+
+/// \brief Index over registered tests for selecting tests by path. Tests are
+/// kept sorted in their canonical order (by file, then line) so each file and
+/// directory is a contiguous range found by binary search, and a second order
+/// by file then name finds single tests. Build it once after static
+/// registration, since it does not see tests registered later.
+class TestIndex final {
+private:
+  /// All tests in canonical order.
+  std::vector<TestCaseInfo const *> mTests;
+  /// Positions into mTests ordered by file then name.
+  std::vector<std::size_t> mByName;
+
+  // Projection for binary searching mTests by file.
+  [[nodiscard]] static inline auto fileOf(TestCaseInfo const *aTest) noexcept
+      -> std::string_view {
+    return aTest->mFile;
+  }
+
+  // Range of positions in mTests with files in [aLow, aHigh).
+  [[nodiscard]] inline auto fileRange(std::string_view aLow,
+                                      std::string_view aHigh) const noexcept
+      -> std::pair<std::size_t, std::size_t> {
+    auto const lBegin = std::ranges::lower_bound(mTests, aLow, {}, fileOf);
+    auto const lEnd = std::ranges::lower_bound(lBegin, mTests.end(), aHigh,
+                                               {}, fileOf);
+    return {static_cast<std::size_t>(lBegin - mTests.begin()),
+            static_cast<std::size_t>(lEnd - mTests.begin())};
+  }
+
+public:
+  TestIndex() = delete;
+
+  /// Build the index.
+  /// \param aRegistry The registry containing all tests, already sorted with
+  /// \c TestRegistry::sort .
+  explicit inline TestIndex(TestRegistry const &aRegistry) {
+    mTests.reserve(aRegistry.size());
+    for (auto const &lTest : aRegistry) {
+      mTests.push_back(&lTest);
+    }
+    mByName.resize(mTests.size());
+    for (std::size_t i = 0; i < mByName.size(); ++i) {
+      mByName[i] = i;
+    }
+    std::ranges::sort(mByName, [this](std::size_t aLeft, std::size_t aRight) {
+      return std::tie(mTests[aLeft]->mFile, mTests[aLeft]->mName) <
+             std::tie(mTests[aRight]->mFile, mTests[aRight]->mName);
+    });
+  }
+
+  /// \return All tests in canonical order.
+  [[nodiscard]] inline auto tests() const noexcept
+      -> std::vector<TestCaseInfo const *> const & {
+    return mTests;
+  }
+
+  /// Find the tests matching a path, one of:
+  /// - "dir/sub" for all tests in files within a directory
+  /// - "dir/sub/file" for all tests in a file
+  /// - "dir/sub/file:name" for a single test, or every row of a parameterized
+  ///   test (see \c TEST_CREATE_PARAMS )
+  /// - "dir/sub/file:name/3" for a single row of a parameterized test
+  ///
+  /// The cost is logarithmic in the number of tests plus the matches.
+  /// \param aPath A test path.
+  /// \param aVisit Called with the position of each match in \c tests() ,
+  /// in canonical order.
+  template <typename VisitT>
+  inline void match(std::string_view aPath, VisitT &&aVisit) const {
+    std::size_t const lSepPos = aPath.find(':');
+    if (lSepPos != std::string_view::npos) {
+      std::string_view const lFile = aPath.substr(0, lSepPos);
+      std::string_view const lName = aPath.substr(lSepPos + 1);
+      auto const fKey = [this](std::size_t i) {
+        return std::pair(std::string_view(mTests[i]->mFile),
+                         std::string_view(mTests[i]->mName));
+      };
+      auto const lIter =
+          std::ranges::lower_bound(mByName, std::pair(lFile, lName), {}, fKey);
+      if (lIter != mByName.end() && mTests[*lIter]->mFile == lFile &&
+          mTests[*lIter]->mName == lName) {
+        aVisit(*lIter);
+        return;
+      }
+      // Rows "name/N" are in ["name/", "name0") like files in a directory
+      std::string lRowsBegin(lName);
+      lRowsBegin.push_back('/');
+      std::string lRowsEnd(lName);
+      lRowsEnd.push_back('0');
+      auto const lRowsFirst = std::ranges::lower_bound(
+          lIter, mByName.end(), std::pair(lFile, std::string_view(lRowsBegin)),
+          {}, fKey);
+      auto const lRowsLast = std::ranges::lower_bound(
+          lRowsFirst, mByName.end(),
+          std::pair(lFile, std::string_view(lRowsEnd)), {}, fKey);
+      // Positions are canonical (row) order, names sort "name/10" first
+      std::vector<std::size_t> lRows(lRowsFirst, lRowsLast);
+      std::ranges::sort(lRows);
+      for (std::size_t const lPosition : lRows) {
+        aVisit(lPosition);
+      }
+      return;
+    }
+    // A file exactly matching the path sorts before anything inside a
+    // directory with that path, but other names like "path.x" can sort in
+    // between, so find the two ranges separately.
+    auto const lFile = std::ranges::equal_range(mTests, aPath, {}, fileOf);
+    for (auto lIter = lFile.begin(); lIter != lFile.end(); ++lIter) {
+      aVisit(static_cast<std::size_t>(lIter - mTests.begin()));
+    }
+    // Files in the directory are all in ["path/", "path0") since '0' is the
+    // character after '/'.
+    std::string lDirBegin(aPath);
+    lDirBegin.push_back('/');
+    std::string lDirEnd(aPath);
+    lDirEnd.push_back('0');
+    auto const [lFirst, lLast] = fileRange(lDirBegin, lDirEnd);
+    for (std::size_t i = lFirst; i < lLast; ++i) {
+      aVisit(i);
+    }
+  }
+
+  /// Select all tests matching any of the given paths (see \c match ).
+  /// Tests are ordered by the first path matching them and a test matched by
+  /// several paths is only selected once.
+  /// \param aPaths The test paths.
+  /// \return The selected tests.
+  [[nodiscard]] inline auto select(std::vector<std::string> const &aPaths) const
+      -> std::vector<TestCaseInfo const *> {
+    std::vector<TestCaseInfo const *> lResult;
+    std::vector<bool> lSelected(mTests.size(), false);
+    for (std::string const &lPath : aPaths) {
+      match(lPath, [&](std::size_t aPosition) {
+        if (!lSelected[aPosition]) {
+          lSelected[aPosition] = true;
+          lResult.push_back(mTests[aPosition]);
         }
+      });
     }
+    return lResult;
+  }
+};
+
+/// Keep only the tests in one shard. Shards take every Nth test so tests from
+/// the same file are spread out and shards have similar counts.
+/// \param aTests The selected tests.
+/// \param aIndex The 1 based shard index.
+/// \param aCount The number of shards.
+/// \return The tests in the shard, in the same order.
+[[nodiscard]] inline auto shardTests(std::vector<TestCaseInfo const *> aTests,
+                                     std::size_t aIndex, std::size_t aCount)
+    -> std::vector<TestCaseInfo const *> {
+  std::vector<TestCaseInfo const *> lResult;
+  for (std::size_t i = aIndex - 1; i < aTests.size(); i += aCount) {
+    lResult.push_back(aTests[i]);
   }
   return lResult;
 }
@@ -769,12 +2355,211 @@ auto testsToRun(std::vector<std::string> const &aPaths)
   return lResult;
 }
 
+/// \brief Destination of test runner output on a file descriptor. Reports are
+/// appended to a large buffer under a lock and written with one system call
+/// when the buffer fills up, when output has been pending for a while, and at
+/// exit. A background thread writes pending output while a long test runs.
+/// One thread at a time writes, without holding the lock, and output added
+/// meanwhile is only appended, so a slow terminal or pipe does not stall
+/// threads adding output. Only \c flush and \c redirect wait for the write.
+class OutputSink final {
+private:
+  using SinkClock = std::chrono::steady_clock;
+  static constexpr std::size_t cCapacity = std::size_t{1} << 16;
+  static constexpr std::chrono::milliseconds cMaxDelay{50};
+
+  int mFd;
+  // Guards everything except mWriting, which only the writing thread uses.
+  std::mutex mMutex;
+  std::string mBuffer;
+  // Output being written by the thread which set mWriteInFlight.
+  std::string mWriting;
+  bool mWriteInFlight = false;
+  SinkClock::time_point mLastWrite = SinkClock::now();
+  // Notified when a write finishes.
+  std::condition_variable mWriteDone;
+  std::condition_variable_any mWake;
+  std::jthread mFlusher;
+
+  // Write all bytes, giving up on errors other than interrupts.
+  static inline void writeOut(int aFd, std::string_view aText) noexcept {
+#if TKOZ_SRTEST_HAS_FORK
+    while (!aText.empty()) {
+      ::ssize_t const lWritten = ::write(aFd, aText.data(), aText.size());
+      if (lWritten < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      aText.remove_prefix(static_cast<std::size_t>(lWritten));
+    }
+#else
+    std::FILE *const lFile = aFd == 1 ? stdout : stderr;
+    std::fwrite(aText.data(), 1, aText.size(), lFile);
+    std::fflush(lFile);
+#endif
+  }
+
+  // Write the buffer, and again while it filled up during the write. aLock
+  // must hold mMutex with no write in flight, it is released during the
+  // write and held again after.
+  inline void writeLocked(std::unique_lock<std::mutex> &aLock) noexcept {
+    mWriteInFlight = true;
+    do {
+      mWriting.swap(mBuffer);
+      mLastWrite = SinkClock::now();
+      int const lFd = mFd;
+      aLock.unlock();
+      writeOut(lFd, mWriting);
+      mWriting.clear();
+      aLock.lock();
+    } while (mBuffer.size() >= cCapacity);
+    mWriteInFlight = false;
+    mWriteDone.notify_all();
+  }
+
+  // Write everything pending, waiting for a write in flight first.
+  inline void flushLocked(std::unique_lock<std::mutex> &aLock) noexcept {
+    mWriteDone.wait(aLock, [this] { return !mWriteInFlight; });
+    if (!mBuffer.empty()) {
+      writeLocked(aLock);
+    }
+  }
+
+public:
+  OutputSink() = delete;
+  /// \param aFd File descriptor to write to (1 for stdout, 2 for stderr).
+  inline explicit OutputSink(int aFd) : mFd(aFd) {
+    mBuffer.reserve(cCapacity);
+    mWriting.reserve(cCapacity);
+  }
+  OutputSink(OutputSink const &) = delete;
+  OutputSink(OutputSink &&) = delete;
+  OutputSink &operator=(OutputSink const &) = delete;
+  OutputSink &operator=(OutputSink &&) = delete;
+
+  inline ~OutputSink() {
+    if (mFlusher.joinable()) {
+      mFlusher.request_stop();
+      mFlusher.join();
+    }
+    flush();
+  }
+
+  /// Start the thread which writes output pending for too long, so progress
+  /// is visible while a test runs. Output is only written at publish time
+  /// and at exit without it.
+  inline void startFlusher() {
+    mFlusher = std::jthread([this](std::stop_token aStop) {
+      std::unique_lock lLock(mMutex);
+      while (!aStop.stop_requested()) {
+        static_cast<void>(
+            mWake.wait_for(lLock, aStop, cMaxDelay, [] { return false; }));
+        if (!mWriteInFlight && !mBuffer.empty() &&
+            SinkClock::now() - mLastWrite >= cMaxDelay) {
+          writeLocked(lLock);
+        }
+      }
+    });
+  }
+
+  /// Add output as one contiguous block.
+  /// \param aText The output.
+  inline void publish(std::string_view aText) {
+    std::unique_lock lLock(mMutex);
+    mBuffer.append(aText);
+    // A thread writing now writes this too if the buffer fills up, or the
+    // next publish or the flusher does
+    if (!mWriteInFlight &&
+        (mBuffer.size() >= cCapacity ||
+         SinkClock::now() - mLastWrite >= cMaxDelay)) {
+      writeLocked(lLock);
+    }
+  }
+
+  /// Write pending output and send all further output to another file
+  /// descriptor.
+  /// \param aFd The new file descriptor.
+  inline void redirect(int aFd) {
+    std::unique_lock lLock(mMutex);
+    flushLocked(lLock);
+    mFd = aFd;
+  }
+
+  /// Write all pending output now.
+  inline void flush() {
+    std::unique_lock lLock(mMutex);
+    flushLocked(lLock);
+  }
+
+  /// Write pending output from a signal handler. The lock is not taken since
+  /// the interrupted thread may hold it, so this is only a best effort for a
+  /// process which is about to die.
+  inline void flushFromSignal() noexcept {
+    writeOut(mFd, mWriting);
+    writeOut(mFd, mBuffer);
+  }
+
+  /// Take the lock before fork once no write is in flight, so the child
+  /// does not start with the lock held or a write pending by a thread which
+  /// does not exist in it (see \c installForkHandlers ).
+  inline void lockForFork() noexcept {
+    std::unique_lock lLock(mMutex);
+    mWriteDone.wait(lLock, [this] { return !mWriteInFlight; });
+    lLock.release();
+  }
+
+  /// Release the lock after fork, in the parent and in the child.
+  inline void unlockAfterFork() noexcept { mMutex.unlock(); }
+};
+
+/// All test runner output for developers goes here (stderr).
+inline OutputSink gOutput(2);
+
+/// Output of non console reporters goes here (stdout unless redirected with
+/// --report-out or --report-fd).
+inline OutputSink gReportOutput(1);
+
+/// Output of the current thread which is not published to \c gOutput yet.
+inline thread_local std::string gReportBuffer;
+
+/// Nesting depth of \c ReportBlock on the current thread.
+inline thread_local std::size_t gReportDepth = 0;
+
+/// Publish the pending output of the current thread.
+inline void publishReport() {
+  if (!gReportBuffer.empty()) {
+    gOutput.publish(gReportBuffer);
+    gReportBuffer.clear();
+  }
+}
+
+/// \brief Keeps the output lines of the current thread together and publishes
+/// them as one block when the outermost block ends, so reports of tests
+/// finishing concurrently are never interleaved. Outside a block each line is
+/// published when it ends.
+class ReportBlock final {
+public:
+  inline ReportBlock() noexcept { ++gReportDepth; }
+  ReportBlock(ReportBlock const &) = delete;
+  ReportBlock(ReportBlock &&) = delete;
+  ReportBlock &operator=(ReportBlock const &) = delete;
+  ReportBlock &operator=(ReportBlock &&) = delete;
+  inline ~ReportBlock() {
+    if (--gReportDepth == 0) {
+      publishReport();
+    }
+  }
+};
+
 /// Test runner output. Write a sequence of values.
 /// No separators are included. No new line is included.
 template <typename... Ts>
   requires(sizeof...(Ts) > 0)
 void infoWrite(Ts &&...aValues) {
-  ((gInfoStream << aValues), ...);
+  auto lOut = std::back_inserter(gReportBuffer);
+  ((lOut = std::format_to(lOut, "{}", aValues)), ...);
 }
 
 /// Test runner output. Write a sequence of values in color.
@@ -782,9 +2567,9 @@ void infoWrite(Ts &&...aValues) {
 template <typename... Ts>
   requires(sizeof...(Ts) > 0)
 void infoWriteColored(const char *aColor, Ts &&...aValues) {
-  gInfoStream << aColor;
+  gReportBuffer += aColor;
   infoWrite(aValues...);
-  gInfoStream << tkoz::srtest::cFmtReset;
+  gReportBuffer += tkoz::srtest::cFmtReset;
 }
 
 /// Test runner output. Write a sequence of values and a new line.
@@ -793,7 +2578,10 @@ template <typename... Ts> void infoWriteLine(Ts &&...aValues) {
   if constexpr (sizeof...(Ts) > 0) {
     infoWrite(aValues...);
   }
-  gInfoStream << std::endl;
+  gReportBuffer.push_back('\n');
+  if (gReportDepth == 0) {
+    publishReport();
+  }
 }
 
 /// Test runner output. Write a sequence of values in color with a new line.
@@ -803,15 +2591,2783 @@ void infoWriteColoredLine(const char *aColor, Ts &&...aValues) {
   if constexpr (sizeof...(Ts) > 0) {
     infoWriteColored(aColor, aValues...);
   }
-  gInfoStream << std::endl;
+  infoWriteLine();
 }
 
-} // namespace tkoz::srtest
-// End of definitions for things the main runner uses
-
-int main(int argc, char **argv) {
-  using namespace tkoz::srtest;
-  gCmdArgs.parse(argc, argv);
+#if TKOZ_SRTEST_HAS_FORK
+/// Write all pending output before the process dies from a fatal signal, then
+/// die from it as before. Includes the unfinished report of the thread which
+/// caused the signal, such as the line announcing the crashing test.
+inline void flushOnFatalSignal(int aSignal) {
+  gOutput.flushFromSignal();
+  gReportOutput.flushFromSignal();
+  if (gReportDepth > 0 && !gReportBuffer.empty()) {
+    std::string_view lText = gReportBuffer;
+    while (!lText.empty()) {
+      ::ssize_t const lWritten = ::write(STDERR_FILENO, lText.data(),
+                                         lText.size());
+      if (lWritten <= 0) {
+        break;
+      }
+      lText.remove_prefix(static_cast<std::size_t>(lWritten));
+    }
+  }
+  ::signal(aSignal, SIG_DFL);
+  ::raise(aSignal);
+}
+#endif
+
+/// Hold the output locks across any fork, such as for --isolate workers,
+/// since the flusher thread or the watchdog may hold them at that moment.
+inline void installForkHandlers() {
+#if TKOZ_SRTEST_HAS_FORK
+  static_cast<void>(::pthread_atfork(
+      [] {
+        gOutput.lockForFork();
+        gReportOutput.lockForFork();
+      },
+      [] {
+        gReportOutput.unlockAfterFork();
+        gOutput.unlockAfterFork();
+      },
+      [] {
+        gReportOutput.unlockAfterFork();
+        gOutput.unlockAfterFork();
+      }));
+#endif
+}
+
+/// Install \c flushOnFatalSignal for signals which end the process.
+inline void installFatalSignalHandlers() {
+#if TKOZ_SRTEST_HAS_FORK
+  for (int const lSignal : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+    ::signal(lSignal, flushOnFatalSignal);
+  }
+#endif
+}
+
+// We should have a monotonicity guarantee for timing performance so it is
+// better to use steady_clock instead of high_resolution_clock.
+using Clock = std::chrono::steady_clock;
+static_assert(Clock::is_steady);
+using TimePoint = decltype(Clock::now());
+using TimeDelta =
+    decltype(std::declval<TimePoint>() - std::declval<TimePoint>());
+
+/// Format a duration for test runner output.
+/// \param aDelta The duration.
+/// \return The duration in milliseconds, microseconds, and nanoseconds.
+[[nodiscard]] inline auto timingsString(TimeDelta const &aDelta)
+    -> std::string {
+  using namespace std::chrono;
+  return std::format("{} / {} / {}", duration_cast<milliseconds>(aDelta),
+                     duration_cast<microseconds>(aDelta),
+                     duration_cast<nanoseconds>(aDelta));
+}
+
+/// \brief Measurements of a benchmark (a test with the BENCH tag).
+struct BenchmarkStats final {
+  /// Number of calls of the benchmark in each repetition.
+  std::uint64_t mIterations = 0;
+  /// Nanoseconds per call for each repetition, sorted.
+  std::vector<double> mNanosPerOp;
+
+  /// \return Fastest repetition in nanoseconds per call.
+  [[nodiscard]] inline auto min() const noexcept -> double {
+    return mNanosPerOp.empty() ? 0.0 : mNanosPerOp.front();
+  }
+
+  /// \return Median repetition in nanoseconds per call.
+  [[nodiscard]] inline auto median() const noexcept -> double {
+    std::size_t const lSize = mNanosPerOp.size();
+    if (lSize == 0) {
+      return 0.0;
+    }
+    return lSize % 2 == 1
+               ? mNanosPerOp[lSize / 2]
+               : (mNanosPerOp[lSize / 2 - 1] + mNanosPerOp[lSize / 2]) / 2.0;
+  }
+
+  /// A high percentile would only be the slowest repetition with the few
+  /// repetitions of a benchmark, so the slowest is reported as such.
+  /// \return Slowest repetition in nanoseconds per call.
+  [[nodiscard]] inline auto max() const noexcept -> double {
+    return mNanosPerOp.empty() ? 0.0 : mNanosPerOp.back();
+  }
+
+  /// Distribution free confidence interval for the median from the order
+  /// statistics at ranks n/2 -+ 1.96 sqrt(n)/2, so about 95% for the sample
+  /// sizes used. With few samples it widens to the full sample range.
+  /// \return Lower and upper bound in nanoseconds per call.
+  [[nodiscard]] inline auto medianInterval() const noexcept
+      -> std::pair<double, double> {
+    std::size_t const lSize = mNanosPerOp.size();
+    if (lSize == 0) {
+      return {0.0, 0.0};
+    }
+    double const lHalfWidth = 0.98 * std::sqrt(static_cast<double>(lSize));
+    double const lCenter = static_cast<double>(lSize) / 2.0;
+    auto const fRank = [lSize](double aRank) -> std::size_t {
+      return std::clamp<std::size_t>(
+          static_cast<std::size_t>(std::max(0.0, std::round(aRank))), 1,
+          lSize);
+    };
+    return {mNanosPerOp[fRank(lCenter - lHalfWidth) - 1],
+            mNanosPerOp[fRank(lCenter + 1.0 + lHalfWidth) - 1]};
+  }
+};
+
+/// Run a benchmark. The number of calls per repetition is calibrated by
+/// doubling (or extrapolating) until one repetition takes at least the
+/// minimum time. One more repetition warms up caches and branch predictors
+/// before the measured repetitions.
+/// \param aTest A test with the BENCH tag.
+/// \param aMinTime Minimum time of each repetition.
+/// \param aReps Number of measured repetitions.
+/// \return The measurements.
+[[nodiscard]] inline auto runBenchmark(TestCaseInfo const &aTest,
+                                       TimeDelta aMinTime, std::size_t aReps)
+    -> BenchmarkStats {
+  auto const fRepetition = [&aTest](std::uint64_t aIterations) -> TimeDelta {
+    TimePoint const lStart = Clock::now();
+    for (std::uint64_t i = 0; i < aIterations; ++i) {
+      aTest.run();
+    }
+    return Clock::now() - lStart;
+  };
+
+  BenchmarkStats lStats;
+  lStats.mIterations = 1;
+  constexpr std::uint64_t cMaxIterations = std::uint64_t{1} << 40;
+  while (lStats.mIterations < cMaxIterations) {
+    TimeDelta const lTime = fRepetition(lStats.mIterations);
+    if (lTime >= aMinTime) {
+      break;
+    }
+    // Aim a little past the minimum time but grow at most 10x per step since
+    // the first few repetitions are noisy.
+    double const lScale =
+        lTime.count() <= 0
+            ? 10.0
+            : std::clamp(1.2 * static_cast<double>(aMinTime.count()) /
+                             static_cast<double>(lTime.count()),
+                         2.0, 10.0);
+    lStats.mIterations = static_cast<std::uint64_t>(
+        static_cast<double>(lStats.mIterations) * lScale);
+  }
+
+  static_cast<void>(fRepetition(lStats.mIterations)); // Warmup
+  lStats.mNanosPerOp.reserve(aReps);
+  for (std::size_t i = 0; i < aReps; ++i) {
+    auto const lNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        fRepetition(lStats.mIterations));
+    lStats.mNanosPerOp.push_back(static_cast<double>(lNanos.count()) /
+                                 static_cast<double>(lStats.mIterations));
+  }
+  std::ranges::sort(lStats.mNanosPerOp);
+  return lStats;
+}
+
+/// Names of the hardware counters measured with --instrument.
+inline constexpr std::array<std::string_view, 4> cHardwareCounterNames = {
+    "cycles", "instructions", "cache_misses", "branch_misses"};
+
+/// \brief Resources used by a test, measured with --instrument.
+struct ResourceUsage final {
+  /// Heap allocations on the test thread, if they are counted.
+  std::optional<internal::AllocCounts> mAllocations;
+  /// Growth of the peak resident set size of the process in KiB. With
+  /// several jobs it is the growth while this test ran, whichever test
+  /// caused it.
+  std::int64_t mPeakRssDeltaKiB = 0;
+  /// Hardware counters of the test thread in user space (in the order of
+  /// \c cHardwareCounterNames ), if they are available.
+  std::optional<std::array<std::uint64_t, cHardwareCounterNames.size()>>
+      mCounters;
+};
+
+/// \brief Stack samples of a test taken with --profile. Each stack lists
+/// code addresses from the interrupted instruction outwards, ending at the
+/// runner frame which ran the test.
+struct ProfileSamples final {
+  /// Frames of all samples one after the other.
+  std::vector<std::uintptr_t> mFrames;
+  /// Number of frames of each sample.
+  std::vector<std::uint32_t> mDepths;
+  /// Samples dropped because the ring buffer of the test thread was full.
+  std::uint64_t mLost = 0;
+};
+
+namespace internal {
+
+/// \return Peak resident set size of the process in KiB, 0 if unknown.
+[[nodiscard]] inline auto peakRssKiB() noexcept -> std::int64_t {
+#if TKOZ_SRTEST_HAS_FORK
+  rusage lUsage{};
+  if (getrusage(RUSAGE_SELF, &lUsage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return static_cast<std::int64_t>(lUsage.ru_maxrss) / 1024; // In bytes
+#else
+  return static_cast<std::int64_t>(lUsage.ru_maxrss);
+#endif
+#else
+  return 0;
+#endif
+}
+
+/// \brief Hardware counters of the calling thread in user space, counting
+/// from construction until \c read . They are opened as one perf event group
+/// so they count over the same time. Counters are unavailable off Linux and
+/// where perf events are not permitted (see perf_event_paranoid).
+class HardwareCounters final {
+private:
+  std::array<int, cHardwareCounterNames.size()> mFds;
+  bool mValid = false;
+
+public:
+  using Values = std::array<std::uint64_t, cHardwareCounterNames.size()>;
+
+  inline HardwareCounters() noexcept {
+    mFds.fill(-1);
+#if TKOZ_SRTEST_HAS_PERF
+    static constexpr std::array<std::uint64_t, cHardwareCounterNames.size()>
+        cConfigs = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (std::size_t i = 0; i < cConfigs.size(); ++i) {
+      perf_event_attr lAttr{};
+      lAttr.type = PERF_TYPE_HARDWARE;
+      lAttr.size = sizeof(lAttr);
+      lAttr.config = cConfigs[i];
+      lAttr.disabled = i == 0 ? 1 : 0;
+      lAttr.exclude_kernel = 1;
+      lAttr.exclude_hv = 1;
+      lAttr.read_format = PERF_FORMAT_GROUP;
+      mFds[i] = static_cast<int>(syscall(SYS_perf_event_open, &lAttr, 0, -1,
+                                         i == 0 ? -1 : mFds[0], 0));
+      if (mFds[i] < 0) {
+        return;
+      }
+    }
+    mValid = ioctl(mFds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) == 0 &&
+             ioctl(mFds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == 0;
+#endif
+  }
+
+  HardwareCounters(HardwareCounters const &) = delete;
+  auto operator=(HardwareCounters const &) -> HardwareCounters & = delete;
+
+  inline ~HardwareCounters() {
+#if TKOZ_SRTEST_HAS_PERF
+    for (int const lFd : mFds) {
+      if (lFd >= 0) {
+        close(lFd);
+      }
+    }
+#endif
+  }
+
+  /// Stop counting and read the counters.
+  /// \return The counter values, or nothing if they are unavailable.
+  [[nodiscard]] inline auto read() noexcept -> std::optional<Values> {
+#if TKOZ_SRTEST_HAS_PERF
+    if (!mValid) {
+      return std::nullopt;
+    }
+    mValid = false;
+    ioctl(mFds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // PERF_FORMAT_GROUP gives the number of counters then their values
+    std::array<std::uint64_t, cHardwareCounterNames.size() + 1> lBuffer{};
+    if (::read(mFds[0], lBuffer.data(), sizeof(lBuffer)) !=
+            static_cast<ssize_t>(sizeof(lBuffer)) ||
+        lBuffer[0] != cHardwareCounterNames.size()) {
+      return std::nullopt;
+    }
+    Values lValues;
+    std::copy(lBuffer.begin() + 1, lBuffer.end(), lValues.begin());
+    return lValues;
+#else
+    return std::nullopt;
+#endif
+  }
+};
+
+#if TKOZ_SRTEST_HAS_PROFILER
+
+/// Deepest stack kept for a --profile sample, outer frames are dropped.
+inline constexpr std::size_t cProfileMaxDepth = 64;
+
+/// \brief Lock-free ring buffer of the stack samples of one thread. The
+/// SIGPROF handler on that thread is the only producer and takes no locks and
+/// allocates nothing, so the signal may arrive anywhere. Consumers drain it
+/// with the mutex of the \c Profiler held.
+class ProfileRing final {
+public:
+  struct Slot final {
+    /// Session during which the sample was taken.
+    std::uint64_t mSession = 0;
+    std::uint32_t mDepth = 0;
+    std::array<std::uintptr_t, cProfileMaxDepth> mFrames{};
+  };
+
+  /// Number of slots, a power of 2. The collector drains the ring often
+  /// enough that it only fills at rates far above the default.
+  static constexpr std::size_t cCapacity = 1024;
+  static_assert(std::has_single_bit(cCapacity));
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+private:
+  std::array<Slot, cCapacity> mSlots;
+  /// Count of slots written, only stored by the producer.
+  std::atomic<std::uint64_t> mHead = 0;
+  /// Count of slots read, only stored by a consumer.
+  std::atomic<std::uint64_t> mTail = 0;
+  /// Session sampled on this thread, 0 if none.
+  std::atomic<std::uint64_t> mSession = 0;
+  std::atomic<std::uint64_t> mLost = 0;
+
+public:
+  /// Start attributing samples to a session.
+  inline void begin(std::uint64_t aSession) noexcept {
+    mSession.store(aSession, std::memory_order_relaxed);
+  }
+
+  /// Stop taking samples, one still pending is ignored.
+  inline void end() noexcept { mSession.store(0, std::memory_order_relaxed); }
+
+  /// \return Samples dropped so far because the ring was full.
+  [[nodiscard]] inline auto lost() const noexcept -> std::uint64_t {
+    return mLost.load(std::memory_order_relaxed);
+  }
+
+  /// Take a sample of the current stack. Called from the signal handler.
+  /// \param aPc The interrupted instruction, 0 if unknown.
+  inline void record(std::uintptr_t aPc) noexcept {
+    std::uint64_t const lSession = mSession.load(std::memory_order_relaxed);
+    if (lSession == 0) {
+      return;
+    }
+    std::uint64_t const lHead = mHead.load(std::memory_order_relaxed);
+    if (lHead - mTail.load(std::memory_order_acquire) >= cCapacity) {
+      mLost.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    // Room for the frames of the handler and the signal trampoline, which
+    // are above the interrupted instruction
+    std::array<void *, cProfileMaxDepth + 8> lFrames;
+    std::size_t const lDepth = static_cast<std::size_t>(std::max(
+        ::backtrace(lFrames.data(), static_cast<int>(lFrames.size())), 0));
+    std::size_t lFirst = 0;
+    if (aPc != 0) {
+      while (lFirst < lDepth &&
+             reinterpret_cast<std::uintptr_t>(lFrames[lFirst]) != aPc) {
+        ++lFirst;
+      }
+    }
+    Slot &lSlot = mSlots[lHead % cCapacity];
+    lSlot.mSession = lSession;
+    if (lFirst == lDepth) {
+      // The stack could not be unwound past the signal frame
+      lSlot.mFrames[0] = aPc;
+      lSlot.mDepth = 1;
+    } else {
+      lSlot.mDepth = static_cast<std::uint32_t>(
+          std::min(lDepth - lFirst, cProfileMaxDepth));
+      for (std::size_t i = 0; i < lSlot.mDepth; ++i) {
+        lSlot.mFrames[i] =
+            reinterpret_cast<std::uintptr_t>(lFrames[lFirst + i]);
+      }
+    }
+    mHead.store(lHead + 1, std::memory_order_release);
+  }
+
+  /// Pass each sample in the ring to a function and remove them.
+  /// \param aConsume Called with each \c Slot in the order taken.
+  template <typename F> inline void drain(F &&aConsume) {
+    std::uint64_t lTail = mTail.load(std::memory_order_relaxed);
+    std::uint64_t const lHead = mHead.load(std::memory_order_acquire);
+    for (; lTail != lHead; ++lTail) {
+      aConsume(mSlots[lTail % cCapacity]);
+    }
+    mTail.store(lTail, std::memory_order_release);
+  }
+};
+
+/// Ring of the calling thread, null until it runs a profiled test.
+inline thread_local ProfileRing *gProfileRing = nullptr;
+
+/// \return The instruction interrupted by a signal, 0 if unknown.
+[[nodiscard]] inline auto interruptedPc(void *aContext) noexcept
+    -> std::uintptr_t {
+  [[maybe_unused]] auto const *const lContext =
+      static_cast<ucontext_t const *>(aContext);
+#if defined(__x86_64__)
+  return static_cast<std::uintptr_t>(lContext->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+  return static_cast<std::uintptr_t>(lContext->uc_mcontext.pc);
+#else
+  return 0;
+#endif
+}
+
+/// SIGPROF handler of --profile, samples the interrupted thread.
+inline void profileSignalHandler(int, siginfo_t *, void *aContext) {
+  int const lErrno = errno;
+  if (ProfileRing *const lRing = gProfileRing) {
+    lRing->record(interruptedPc(aContext));
+  }
+  errno = lErrno;
+}
+
+/// \brief Sampling profiler of --profile. Each thread running a test gets a
+/// \c ProfileRing and, for the duration of the test, a timer on the CPU time
+/// of that thread which sends it SIGPROF. Only the test thread is sampled,
+/// as with the counters of --instrument, so concurrent tests are kept apart.
+/// A collector thread drains the rings into the samples of each test so the
+/// rings do not overflow during long tests.
+class Profiler final {
+private:
+  static constexpr auto cInterval = std::chrono::milliseconds(10);
+  std::mutex mMutex;
+  std::condition_variable_any mWake;
+  /// Rings of all threads which ran a profiled test, never freed since a
+  /// signal may still be delivered to their thread.
+  std::vector<std::unique_ptr<ProfileRing>> mRings;
+  /// Samples drained from the rings by session.
+  std::unordered_map<std::uint64_t, ProfileSamples> mSamples;
+  std::uint64_t mNextSession = 1;
+  std::jthread mThread;
+
+  inline void drainLocked(ProfileRing &aRing) {
+    aRing.drain([this](ProfileRing::Slot const &aSlot) {
+      ProfileSamples &lSamples = mSamples[aSlot.mSession];
+      lSamples.mFrames.insert(lSamples.mFrames.end(), aSlot.mFrames.begin(),
+                              aSlot.mFrames.begin() + aSlot.mDepth);
+      lSamples.mDepths.push_back(aSlot.mDepth);
+    });
+  }
+
+public:
+  /// \brief Samples the calling thread from construction until \c stop .
+  /// The frames below the constructor are the runner frames which are
+  /// trimmed from every sample.
+  class Session final {
+  private:
+    Profiler &mProfiler;
+    ProfileRing *mRing = nullptr;
+    std::uint64_t mId = 0;
+    std::uint64_t mLostStart = 0;
+    std::vector<std::uintptr_t> mBase;
+    timer_t mTimer{};
+    bool mArmed = false;
+
+  public:
+    /// \param aProfiler The started profiler.
+    /// \param aHz Samples per second of CPU time of the thread.
+    inline Session(Profiler &aProfiler, std::size_t aHz)
+        : mProfiler(aProfiler) {
+      {
+        std::lock_guard const lLock(mProfiler.mMutex);
+        if (gProfileRing == nullptr) {
+          gProfileRing = mProfiler.mRings
+                             .emplace_back(std::make_unique<ProfileRing>())
+                             .get();
+        }
+        mId = mProfiler.mNextSession++;
+      }
+      mRing = gProfileRing;
+      mLostStart = mRing->lost();
+      std::array<void *, cProfileMaxDepth> lBase;
+      auto const lDepth = static_cast<std::size_t>(std::max(
+          ::backtrace(lBase.data(), static_cast<int>(lBase.size())), 0));
+      for (std::size_t i = 0; i < lDepth; ++i) {
+        mBase.push_back(reinterpret_cast<std::uintptr_t>(lBase[i]));
+      }
+      mRing->begin(mId);
+      sigevent lEvent{};
+      lEvent.sigev_notify = SIGEV_THREAD_ID;
+      lEvent.sigev_signo = SIGPROF;
+      // Not every glibc defines the name sigev_notify_thread_id for this
+      lEvent._sigev_un._tid = static_cast<pid_t>(::syscall(SYS_gettid));
+      if (::timer_create(CLOCK_THREAD_CPUTIME_ID, &lEvent, &mTimer) != 0) {
+        return;
+      }
+      auto const lPeriod = static_cast<long>(1'000'000'000 / aHz);
+      itimerspec lSpec{};
+      lSpec.it_interval.tv_sec = lPeriod / 1'000'000'000;
+      lSpec.it_interval.tv_nsec = lPeriod % 1'000'000'000;
+      lSpec.it_value = lSpec.it_interval;
+      mArmed = ::timer_settime(mTimer, 0, &lSpec, nullptr) == 0;
+      if (!mArmed) {
+        ::timer_delete(mTimer);
+      }
+    }
+
+    Session(Session const &) = delete;
+    auto operator=(Session const &) -> Session & = delete;
+
+    inline ~Session() {
+      stop();
+      std::lock_guard const lLock(mProfiler.mMutex);
+      mProfiler.drainLocked(*mRing);
+      mProfiler.mSamples.erase(mId);
+    }
+
+    /// Stop sampling, before anything which should not be sampled.
+    inline void stop() noexcept {
+      if (mArmed) {
+        ::timer_delete(mTimer);
+        mArmed = false;
+      }
+      mRing->end();
+    }
+
+    /// Take the samples after \c stop .
+    /// \return The samples without the runner frames.
+    [[nodiscard]] inline auto take() -> ProfileSamples {
+      ProfileSamples lRaw;
+      {
+        std::lock_guard const lLock(mProfiler.mMutex);
+        mProfiler.drainLocked(*mRing);
+        if (auto lNode = mProfiler.mSamples.extract(mId)) {
+          lRaw = std::move(lNode.mapped());
+        }
+      }
+      ProfileSamples lSamples;
+      lSamples.mLost = mRing->lost() - mLostStart;
+      lSamples.mDepths.reserve(lRaw.mDepths.size());
+      std::size_t lOffset = 0;
+      for (std::uint32_t const lDepth : lRaw.mDepths) {
+        std::uintptr_t const *const lStack = lRaw.mFrames.data() + lOffset;
+        lOffset += lDepth;
+        // Frames shared with the stack of the constructor are the runner's
+        std::size_t lCommon = 0;
+        while (lCommon < lDepth && lCommon < mBase.size() &&
+               lStack[lDepth - 1 - lCommon] ==
+                   mBase[mBase.size() - 1 - lCommon]) {
+          ++lCommon;
+        }
+        std::size_t const lKept = std::max<std::size_t>(lDepth - lCommon, 1);
+        lSamples.mFrames.insert(lSamples.mFrames.end(), lStack,
+                                lStack + lKept);
+        lSamples.mDepths.push_back(static_cast<std::uint32_t>(lKept));
+      }
+      return lSamples;
+    }
+  };
+
+  /// Install the SIGPROF handler and start the collector thread, in the
+  /// process which runs the tests.
+  inline void start() {
+    // The first backtrace loads the unwinder, which allocates, so it must
+    // not happen in the signal handler
+    void *lFrame = nullptr;
+    static_cast<void>(::backtrace(&lFrame, 1));
+    struct sigaction lAction{};
+    lAction.sa_sigaction = profileSignalHandler;
+    lAction.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&lAction.sa_mask);
+    ::sigaction(SIGPROF, &lAction, nullptr);
+    mThread = std::jthread([this](std::stop_token aStop) {
+      std::unique_lock lLock(mMutex);
+      while (!aStop.stop_requested()) {
+        static_cast<void>(
+            mWake.wait_for(lLock, aStop, cInterval, [] { return false; }));
+        for (auto const &lRing : mRings) {
+          drainLocked(*lRing);
+        }
+      }
+    });
+  }
+
+  /// Stop the collector thread.
+  inline void stop() {
+    mThread.request_stop();
+    if (mThread.joinable()) {
+      mThread.join();
+    }
+  }
+};
+
+inline Profiler gProfiler;
+
+/// \return A symbol name demangled if it is a C++ name.
+[[nodiscard]] inline auto demangledName(char const *aName) -> std::string {
+#if defined(__GNUG__) || defined(__clang__)
+  int lStatus = -1;
+  char *const lName = abi::__cxa_demangle(aName, nullptr, nullptr, &lStatus);
+  if (lStatus == 0 && lName) {
+    std::string lResult = lName;
+    std::free(lName);
+    return lResult;
+  }
+#endif
+  return aName;
+}
+
+/// \brief Names the code addresses of --profile samples from the dynamic
+/// symbol tables, so functions of an executable are only named if it exports
+/// them (-rdynamic). Other addresses are written as module+offset, which
+/// addr2line can resolve. Each name is stored once, so names can be
+/// compared by address.
+class Symbolizer final {
+private:
+  std::unordered_set<std::string> mNames;
+  std::unordered_map<std::uintptr_t, std::string const *> mByAddress;
+
+  [[nodiscard]] static inline auto lookup(std::uintptr_t aAddress)
+      -> std::string {
+    Dl_info lInfo{};
+    if (::dladdr(reinterpret_cast<void *>(aAddress), &lInfo) == 0) {
+      return std::format("{:#x}", aAddress);
+    }
+    if (lInfo.dli_sname != nullptr) {
+      return demangledName(lInfo.dli_sname);
+    }
+    std::string_view lModule =
+        lInfo.dli_fname != nullptr ? lInfo.dli_fname : "?";
+    lModule.remove_prefix(std::min(lModule.size(), lModule.rfind('/') + 1));
+    return std::format("{}+{:#x}", lModule,
+                       aAddress - reinterpret_cast<std::uintptr_t>(
+                                      lInfo.dli_fbase));
+  }
+
+public:
+  /// \param aAddress A frame of a sample.
+  /// \param aLeaf True for the interrupted instruction, false for a return
+  /// address which is looked up one byte earlier to find the call.
+  /// \return Name of the function containing the address.
+  [[nodiscard]] inline auto name(std::uintptr_t aAddress, bool aLeaf)
+      -> std::string const & {
+    std::uintptr_t const lAddress = aLeaf ? aAddress : aAddress - 1;
+    auto const [lIter, lInserted] = mByAddress.try_emplace(lAddress);
+    if (lInserted) {
+      lIter->second = &*mNames.insert(lookup(lAddress)).first;
+    }
+    return *lIter->second;
+  }
+};
+
+#endif // TKOZ_SRTEST_HAS_PROFILER
+
+/// \return Operand of a failed soft check for its message, "?" if it was not
+/// kept.
+[[nodiscard]] inline auto checkValueString(CheckValue const &aValue)
+    -> std::string {
+  return std::visit(
+      []<typename T>(T const &aOperand) -> std::string {
+        if constexpr (std::is_same_v<T, std::monostate>) {
+          return "?";
+        } else if constexpr (std::is_floating_point_v<T>) {
+          return fpString(aOperand);
+        } else {
+          return std::format("{}", aOperand);
+        }
+      },
+      aValue);
+}
+
+/// \return Resources as a human readable string for the console.
+[[nodiscard]] inline auto resourcesString(ResourceUsage const &aUsage)
+    -> std::string {
+  std::string lResult;
+  if (aUsage.mAllocations.has_value()) {
+    lResult = std::format("{} allocations ({} bytes), ",
+                          aUsage.mAllocations->mCount,
+                          aUsage.mAllocations->mBytes);
+  } else {
+    lResult = "allocations not counted, ";
+  }
+  std::format_to(std::back_inserter(lResult), "peak RSS +{} KiB",
+                 aUsage.mPeakRssDeltaKiB);
+  if (aUsage.mCounters.has_value()) {
+    for (std::size_t i = 0; i < cHardwareCounterNames.size(); ++i) {
+      std::format_to(std::back_inserter(lResult), ", {} {}",
+                     (*aUsage.mCounters)[i], cHardwareCounterNames[i]);
+    }
+  } else {
+    lResult += ", hardware counters unavailable";
+  }
+  return lResult;
+}
+
+} // namespace internal
+
+/// \brief The outcome of running a single test case.
+struct TestResult final {
+  /// The test which was run.
+  TestCaseInfo const *mTest = nullptr;
+  /// True if the test completed without a failure.
+  bool mSuccess = false;
+  /// Wall time spent in the test function.
+  TimeDelta mDuration{};
+  /// Messages added by the test (see \c gTestMessages ).
+  std::vector<std::pair<bool, std::string>> mMessages;
+  /// How the test failed, such as "Test failure (std::bad_alloc)", empty for
+  /// a test which succeeded.
+  std::string mFailureKind;
+  /// Details of the failure, if there are any.
+  std::optional<std::string> mFailureMessage;
+  /// Measurements if the test is a benchmark which succeeded.
+  std::optional<BenchmarkStats> mBenchmark;
+  /// Resources used by the test if they were measured (--instrument).
+  std::optional<ResourceUsage> mResources;
+  /// Stack samples of the test if it was profiled (--profile).
+  std::optional<ProfileSamples> mProfile;
+};
+
+/// \brief Benchmark results saved from a previous run and compared against
+/// with --baseline. Stored as a text file with a version header line and one
+/// benchmark per line in the form "median low high iterations file:name",
+/// times in nanoseconds per call with [low, high] the median interval.
+class BenchmarkBaseline final {
+public:
+  /// \brief Saved result of one benchmark.
+  struct Entry final {
+    double mMedian = 0.0;
+    double mLow = 0.0;
+    double mHigh = 0.0;
+    std::uint64_t mIterations = 0;
+  };
+
+private:
+  static constexpr std::string_view cHeader = "# srtest-baseline v1";
+  std::unordered_map<std::string, Entry> mEntries;
+
+  [[nodiscard]] static inline auto key(TestCaseInfo const &aTest)
+      -> std::string {
+    return std::format("{}:{}", aTest.mFile, aTest.mName);
+  }
+
+  template <typename T>
+  [[nodiscard]] static inline auto parseField(std::string_view &aLine,
+                                              T &aValue) noexcept -> bool {
+    std::size_t const lSpacePos = aLine.find(' ');
+    if (lSpacePos == std::string_view::npos) {
+      return false;
+    }
+    auto const [lEnd, lError] =
+        std::from_chars(aLine.data(), aLine.data() + lSpacePos, aValue);
+    aLine.remove_prefix(lSpacePos + 1);
+    return lError == std::errc{} && lEnd == aLine.data() - 1;
+  }
+
+public:
+  BenchmarkBaseline() = default;
+
+  /// Read a baseline file.
+  /// \param aPath Path of the baseline file.
+  /// \return An error message if the file is missing or malformed.
+  inline auto load(std::string const &aPath) -> std::optional<std::string> {
+    std::ifstream lFile(aPath);
+    if (!lFile) {
+      return std::format("cannot read baseline file {}", aPath);
+    }
+    std::string lLine;
+    if (!std::getline(lFile, lLine) || lLine != cHeader) {
+      return std::format("{} is not a baseline file (expected \"{}\")", aPath,
+                         cHeader);
+    }
+    for (std::size_t lLineNum = 2; std::getline(lFile, lLine); ++lLineNum) {
+      std::string_view lRest = lLine;
+      Entry lEntry;
+      if (!parseField(lRest, lEntry.mMedian) ||
+          !parseField(lRest, lEntry.mLow) || !parseField(lRest, lEntry.mHigh) ||
+          !parseField(lRest, lEntry.mIterations) || lRest.empty()) {
+        return std::format("{}:{}: malformed baseline entry", aPath, lLineNum);
+      }
+      mEntries.insert_or_assign(std::string(lRest), lEntry);
+    }
+    return std::nullopt;
+  }
+
+  /// Write all entries to a file. It is written next to the destination and
+  /// renamed so an interrupted run cannot leave a truncated baseline.
+  /// \param aPath Path of the baseline file.
+  /// \return True if the file was written.
+  inline auto save(std::string const &aPath) const -> bool {
+    std::vector<std::pair<std::string_view, Entry const *>> lSorted;
+    lSorted.reserve(mEntries.size());
+    for (auto const &[lKey, lEntry] : mEntries) {
+      lSorted.emplace_back(lKey, &lEntry);
+    }
+    std::ranges::sort(lSorted, {}, &decltype(lSorted)::value_type::first);
+    std::string const lTempPath = aPath + ".tmp";
+    {
+      std::ofstream lFile(lTempPath, std::ios::trunc);
+      lFile << cHeader << '\n';
+      for (auto const &[lKey, lEntry] : lSorted) {
+        lFile << std::format("{} {} {} {} {}\n", lEntry->mMedian, lEntry->mLow,
+                             lEntry->mHigh, lEntry->mIterations, lKey);
+      }
+      if (!lFile.flush()) {
+        return false;
+      }
+    }
+    std::error_code lError;
+    std::filesystem::rename(lTempPath, aPath, lError);
+    return !lError;
+  }
+
+  /// \param aTest A benchmark.
+  /// \return Its saved result if there is one.
+  [[nodiscard]] inline auto find(TestCaseInfo const &aTest) const
+      -> Entry const * {
+    auto const lIter = mEntries.find(key(aTest));
+    return lIter == mEntries.end() ? nullptr : &lIter->second;
+  }
+
+  /// Take all entries from another baseline, replacing existing ones.
+  /// \param aOther Newer results.
+  inline void merge(BenchmarkBaseline const &aOther) {
+    for (auto const &[lKey, lEntry] : aOther.mEntries) {
+      mEntries.insert_or_assign(lKey, lEntry);
+    }
+  }
+
+  /// Record the result of a benchmark from this run.
+  /// \param aTest A benchmark.
+  /// \param aStats Its measurements.
+  inline void update(TestCaseInfo const &aTest, BenchmarkStats const &aStats) {
+    auto const [lLow, lHigh] = aStats.medianInterval();
+    mEntries.insert_or_assign(
+        key(aTest), Entry{aStats.median(), lLow, lHigh, aStats.mIterations});
+  }
+};
+
+/// Baseline loaded with --baseline, only read while tests run.
+inline BenchmarkBaseline gBaseline;
+
+/// Compare a successful benchmark to its baseline. It regresses when its
+/// median is slower than the baseline median by more than the allowed
+/// percentage and the median intervals do not overlap with that allowance,
+/// so noise within a run alone does not fail it. The comparison is added to
+/// the messages and a regression fails the result.
+/// \param aResult Result of a benchmark.
+/// \param aBaseline Baseline to compare against.
+/// \param aMaxRegress Allowed slowdown in percent.
+inline void compareToBaseline(TestResult &aResult,
+                              BenchmarkBaseline const &aBaseline,
+                              double aMaxRegress) {
+  BenchmarkBaseline::Entry const *const lEntry =
+      aBaseline.find(*aResult.mTest);
+  if (!aResult.mBenchmark.has_value() || lEntry == nullptr) {
+    return;
+  }
+  double const lMedian = aResult.mBenchmark->median();
+  auto const [lLow, lHigh] = aResult.mBenchmark->medianInterval();
+  double const lChange =
+      lEntry->mMedian > 0.0 ? 100.0 * (lMedian / lEntry->mMedian - 1.0) : 0.0;
+  double const lFactor = 1.0 + aMaxRegress / 100.0;
+  std::string lComparison = std::format(
+      "median {:.2f} ns/op [{:.2f}, {:.2f}] vs baseline {:.2f} ns/op "
+      "[{:.2f}, {:.2f}] ({:+.1f}%, limit +{:.1f}%)",
+      lMedian, lLow, lHigh, lEntry->mMedian, lEntry->mLow, lEntry->mHigh,
+      lChange, aMaxRegress);
+  if (lMedian > lEntry->mMedian * lFactor && lLow > lEntry->mHigh * lFactor) {
+    aResult.mSuccess = false;
+    aResult.mFailureKind = "Benchmark regressed";
+    aResult.mFailureMessage = std::move(lComparison);
+  } else {
+    aResult.mMessages.emplace_back(false, "Baseline: " + lComparison);
+  }
+}
+
+/// \return A duration in seconds for messages.
+[[nodiscard]] inline auto secondsString(TimeDelta aDuration) -> std::string {
+  return std::format("{:.3f} s",
+                     std::chrono::duration<double>(aDuration).count());
+}
+
+/// Check a finished test against its time budget. An overrun is a warning
+/// message, or a failure with --budget-fail.
+/// \param aResult The result, which is updated.
+/// \param aBudgets The budgets.
+/// \param aFail True if an overrun fails the test.
+inline void checkBudget(TestResult &aResult, TimeBudgets const &aBudgets,
+                        bool aFail) {
+  auto const lBudget = aBudgets.find(*aResult.mTest);
+  if (!lBudget.has_value() || aResult.mDuration <= lBudget->mLimit) {
+    return;
+  }
+  std::string lMessage =
+      std::format("took {}, budget {} ({})", secondsString(aResult.mDuration),
+                  secondsString(lBudget->mLimit), lBudget->mSource);
+  if (aFail) {
+    aResult.mSuccess = false;
+    aResult.mFailureKind = "Budget exceeded";
+    aResult.mFailureMessage = std::move(lMessage);
+  } else {
+    aResult.mMessages.emplace_back(false,
+                                   "Warning: budget exceeded, " + lMessage);
+  }
+}
+
+/// Run a single test on the calling thread. Messages added by the test are
+/// taken from the thread_local storage and kept in the result so they can be
+/// reported later without being interleaved with other tests.
+/// \param aTest The test to run.
+/// \return The result of running the test.
+[[nodiscard]] inline auto runTestCase(TestCaseInfo const &aTest)
+    -> TestResult {
+  TestResult lResult;
+  lResult.mTest = &aTest;
+  clearMessages();
+  clearCheckFailures();
+  // Opened before the test starts since opening allocates
+  std::optional<internal::HardwareCounters> lCounters;
+  std::int64_t lPeakRssStart = 0;
+  if (gCmdArgs.instrument()) {
+    lPeakRssStart = internal::peakRssKiB();
+    lCounters.emplace();
+  }
+#if TKOZ_SRTEST_HAS_PROFILER
+  std::optional<internal::Profiler::Session> lProfile;
+  if (gCmdArgs.profile()) {
+    lProfile.emplace(internal::gProfiler, gCmdArgs.profileHz());
+  }
+#endif
+  TimePoint lTimeStart;
+  TimePoint lTimeFinish;
+  internal::gAllocCounts = {};
+  try {
+    lTimeStart = Clock::now();
+    if (aTest.mTags.hasTag(TestTags::BENCH)) {
+      lResult.mBenchmark =
+          runBenchmark(aTest, gCmdArgs.benchTime(), gCmdArgs.benchReps());
+    } else {
+      aTest.run();
+    }
+    lTimeFinish = Clock::now();
+    lResult.mSuccess = true;
+  } catch (TestFailure const &exc) {
+    lResult.mFailureKind = "Test failure";
+    lResult.mFailureMessage = exc.message();
+  } catch (std::exception const &exc) {
+    lResult.mFailureKind =
+        std::format("Test failure ({})", typeName(&typeid(exc)));
+    lResult.mFailureMessage = exc.what();
+  } catch (...) {
+#if defined(__GNUG__) || defined(__clang__)
+    std::type_info const *const lType = abi::__cxa_current_exception_type();
+#else
+    std::type_info const *const lType = nullptr;
+#endif
+    lResult.mFailureKind = std::format("Test failure ({})", typeName(lType));
+  }
+#if TKOZ_SRTEST_HAS_PROFILER
+  if (lProfile.has_value()) {
+    lProfile->stop();
+  }
+#endif
+  if (!lResult.mSuccess) {
+    lTimeFinish = Clock::now();
+  }
+  lResult.mDuration = lTimeFinish - lTimeStart;
+  if (lCounters.has_value()) {
+    ResourceUsage lUsage;
+    lUsage.mCounters = lCounters->read();
+    if (TKOZ_SRTEST_ALLOC_HOOKS) {
+      lUsage.mAllocations = internal::gAllocCounts;
+    }
+    lUsage.mPeakRssDeltaKiB = internal::peakRssKiB() - lPeakRssStart;
+    lResult.mResources = lUsage;
+  }
+#if TKOZ_SRTEST_HAS_PROFILER
+  if (lProfile.has_value()) {
+    lResult.mProfile = lProfile->take();
+  }
+#endif
+  lResult.mMessages = std::move(gTestMessages);
+  clearMessages();
+  if (gCheckFailures.mFailed > 0) {
+    std::size_t const lNumRecorded =
+        std::min(gCheckFailures.mFailed, cMaxRecordedChecks);
+    for (std::size_t i = 0; i < lNumRecorded; ++i) {
+      auto const &[lDescription, lSrcLoc, lLeft, lRight] =
+          gCheckFailures.mRecorded[i];
+      std::string lMessage =
+          std::format("check failure at {}:{}: {}", lSrcLoc.file_name(),
+                      lSrcLoc.line(), lDescription);
+      if (!std::holds_alternative<std::monostate>(lLeft) ||
+          !std::holds_alternative<std::monostate>(lRight)) {
+        std::format_to(std::back_inserter(lMessage), ", values {} and {}",
+                       internal::checkValueString(lLeft),
+                       internal::checkValueString(lRight));
+      }
+      lResult.mMessages.emplace_back(false, std::move(lMessage));
+    }
+    if (gCheckFailures.mFailed > lNumRecorded) {
+      lResult.mMessages.emplace_back(
+          false, std::format("{} more check failures not shown",
+                             gCheckFailures.mFailed - lNumRecorded));
+    }
+    if (lResult.mSuccess) {
+      lResult.mSuccess = false;
+      lResult.mFailureKind = "Test failure";
+      lResult.mFailureMessage =
+          std::format("{} checks failed", gCheckFailures.mFailed);
+    }
+    clearCheckFailures();
+  }
+  if (lResult.mSuccess) {
+    compareToBaseline(lResult, gBaseline, gCmdArgs.maxRegress());
+  }
+  if (lResult.mSuccess) {
+    checkBudget(lResult, gCmdArgs.budgets(), gCmdArgs.budgetFail());
+  }
+  return lResult;
+}
+
+/// Write the line announcing that a test is running.
+/// \param aTest The test.
+inline void reportTestStart(TestCaseInfo const &aTest) {
+  infoWriteColored(cFgBBlue, "Running");
+  infoWriteLine(std::format(" {}:{} ({}, line {})", aTest.mFile, aTest.mName,
+                            testTagsString(aTest.mTags), aTest.mLine));
+}
+
+/// Write the messages, failure details, and timing of a finished test.
+/// Messages added for failure only are omitted for successful tests.
+/// \param aResult The test result.
+inline void reportTestResult(TestResult const &aResult) {
+  for (auto const &[lFailureOnly, lMessage] : aResult.mMessages) {
+    if (!aResult.mSuccess || !lFailureOnly) {
+      infoWriteLine(lMessage);
+    }
+  }
+  if (aResult.mBenchmark.has_value()) {
+    BenchmarkStats const &lStats = *aResult.mBenchmark;
+    infoWriteLine(std::format("Benchmark: {:.2f} ns/op median, {:.2f} min, "
+                              "{:.2f} max ({} x {} iterations)",
+                              lStats.median(), lStats.min(), lStats.max(),
+                              lStats.mNanosPerOp.size(), lStats.mIterations));
+  }
+  if (aResult.mResources.has_value()) {
+    infoWriteLine("Resources: ",
+                  internal::resourcesString(*aResult.mResources));
+  }
+  if (aResult.mSuccess) {
+    infoWriteColored(cFgBGreen, "Success");
+  } else {
+    infoWriteColored(cFgBRed, aResult.mFailureKind);
+    if (aResult.mFailureMessage.has_value()) {
+      infoWriteLine(": ", *aResult.mFailureMessage);
+    } else {
+      infoWriteLine();
+    }
+    infoWriteColored(cFgBRed, "Failure");
+  }
+  infoWriteLine(" (", timingsString(aResult.mDuration), ")");
+}
+
+/// \brief State of tests from previous runs, kept in one small file: the
+/// last outcome and duration of each test. Durations schedule long tests
+/// first and outcomes select tests for --last-failed and --failed-first.
+/// Stored as a text file with a version header line and one test per line in
+/// the form "outcome nanoseconds line file:name" with outcome "pass" or
+/// "fail". A test is found by file and name, or by file and registration line
+/// so a renamed test keeps its state. Rows of a TEST_CREATE_PARAMS table share
+/// a line, so their row number is part of the line key. Tests which were not
+/// run keep their entry.
+class TestState final {
+public:
+  /// \brief Saved state of one test.
+  struct Entry final {
+    bool mFailed = false;
+    std::int64_t mNanos = 0;
+    std::size_t mLine = 0;
+  };
+
+private:
+  static constexpr std::string_view cHeader = "# srtest-state v1";
+  /// Entries by "file:name".
+  std::unordered_map<std::string, Entry> mEntries;
+  /// Keys of mEntries by "file:line", or "file:line/row" for table rows.
+  std::unordered_map<std::string, std::string> mKeyByLine;
+  /// Keys of mEntries which were updated by this run.
+  std::unordered_set<std::string> mUpdated;
+
+  [[nodiscard]] static inline auto key(TestCaseInfo const &aTest)
+      -> std::string {
+    return std::format("{}:{}", aTest.mFile, aTest.mName);
+  }
+
+  [[nodiscard]] static inline auto lineKey(std::string_view aKey,
+                                           std::size_t aLine) -> std::string {
+    // Test names can not contain a colon so the file ends at the last one
+    std::size_t const lColonPos = aKey.rfind(':');
+    std::string_view const lName =
+        lColonPos == std::string_view::npos ? "" : aKey.substr(lColonPos + 1);
+    // A row of a table ends with "/" and its number
+    std::size_t const lSlashPos = lName.rfind('/');
+    std::string_view lRow;
+    if (lSlashPos != std::string_view::npos && lSlashPos + 1 < lName.size() &&
+        std::ranges::all_of(lName.substr(lSlashPos + 1), [](char aChar) {
+          return aChar >= '0' && aChar <= '9';
+        })) {
+      lRow = lName.substr(lSlashPos);
+    }
+    return std::format("{}:{}{}", aKey.substr(0, lColonPos), aLine, lRow);
+  }
+
+  [[nodiscard]] inline auto find(TestCaseInfo const &aTest) const
+      -> Entry const * {
+    auto lIter = mEntries.find(key(aTest));
+    if (lIter == mEntries.end()) {
+      auto const lKeyIter = mKeyByLine.find(lineKey(key(aTest), aTest.mLine));
+      if (lKeyIter == mKeyByLine.end()) {
+        return nullptr;
+      }
+      lIter = mEntries.find(lKeyIter->second);
+    }
+    return lIter == mEntries.end() ? nullptr : &lIter->second;
+  }
+
+  inline void insert(std::string aKey, Entry aEntry) {
+    std::string lLineKey = lineKey(aKey, aEntry.mLine);
+    auto const lOld = mKeyByLine.find(lLineKey);
+    if (lOld != mKeyByLine.end() && lOld->second != aKey) {
+      mEntries.erase(lOld->second); // Renamed, drop the old name
+    }
+    mKeyByLine.insert_or_assign(std::move(lLineKey), aKey);
+    mEntries.insert_or_assign(std::move(aKey), aEntry);
+  }
+
+public:
+  TestState() = default;
+
+  /// Read the state from a file. A missing or malformed file is not an error,
+  /// unreadable lines are skipped since the state only affects scheduling
+  /// and selection.
+  /// \param aPath Path of the state file.
+  inline void load(std::string const &aPath) {
+    std::ifstream lFile(aPath);
+    std::string lLine;
+    while (std::getline(lFile, lLine)) {
+      std::string_view lRest = lLine;
+      std::array<std::string_view, 3> lFields;
+      bool lValid = true;
+      for (std::string_view &lField : lFields) {
+        std::size_t const lSpacePos = lRest.find(' ');
+        lValid = lValid && lSpacePos != std::string_view::npos;
+        if (lValid) {
+          lField = lRest.substr(0, lSpacePos);
+          lRest.remove_prefix(lSpacePos + 1);
+        }
+      }
+      Entry lEntry;
+      auto const fParse = [](std::string_view aText, auto &aValue) {
+        auto const [lEnd, lError] =
+            std::from_chars(aText.data(), aText.data() + aText.size(), aValue);
+        return !aText.empty() && lError == std::errc{} &&
+               lEnd == aText.data() + aText.size();
+      };
+      if (!lValid || (lFields[0] != "pass" && lFields[0] != "fail") ||
+          !fParse(lFields[1], lEntry.mNanos) ||
+          !fParse(lFields[2], lEntry.mLine) || lRest.empty()) {
+        continue;
+      }
+      lEntry.mFailed = lFields[0] == "fail";
+      insert(std::string(lRest), lEntry);
+    }
+  }
+
+  /// Write the state to a file. Runs at the same time (such as --shard) share
+  /// the file, so under a lock the file is read again and only the tests this
+  /// run updated replace its entries. It is written next to the destination
+  /// and renamed so an interrupted run cannot leave a truncated file.
+  /// \param aPath Path of the state file.
+  /// \return True if the file was written.
+  inline auto save(std::string const &aPath) const -> bool {
+#if TKOZ_SRTEST_HAS_FORK
+    int const lLockFd =
+        ::open((aPath + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (lLockFd < 0) {
+      return false;
+    }
+    int lLocked = 0;
+    do {
+      lLocked = ::flock(lLockFd, LOCK_EX);
+    } while (lLocked != 0 && errno == EINTR);
+    // Closing the descriptor releases the lock
+    struct LockFd final {
+      int mFd;
+      ~LockFd() { ::close(mFd); }
+    } const lLock{lLockFd};
+    if (lLocked != 0) {
+      return false;
+    }
+    std::string const lTempPath = std::format("{}.tmp.{}", aPath, ::getpid());
+#else
+    std::string const lTempPath = aPath + ".tmp";
+#endif
+    TestState lMerged;
+    lMerged.load(aPath);
+    for (std::string const &lKey : mUpdated) {
+      auto const lIter = mEntries.find(lKey);
+      if (lIter != mEntries.end()) {
+        lMerged.insert(lKey, lIter->second);
+      }
+    }
+    {
+      std::ofstream lFile(lTempPath, std::ios::trunc);
+      lFile << cHeader << '\n';
+      for (auto const &[lKey, lEntry] : lMerged.mEntries) {
+        lFile << (lEntry.mFailed ? "fail" : "pass") << ' ' << lEntry.mNanos
+              << ' ' << lEntry.mLine << ' ' << lKey << '\n';
+      }
+      if (!lFile.flush()) {
+        return false;
+      }
+    }
+    std::error_code lError;
+    std::filesystem::rename(lTempPath, aPath, lError);
+    return !lError;
+  }
+
+  /// \param aTest A test.
+  /// \return Duration from a previous run if one is known.
+  [[nodiscard]] inline auto duration(TestCaseInfo const &aTest) const
+      -> std::optional<TimeDelta> {
+    Entry const *const lEntry = find(aTest);
+    if (lEntry == nullptr) {
+      return std::nullopt;
+    }
+    return std::chrono::duration_cast<TimeDelta>(
+        std::chrono::nanoseconds(lEntry->mNanos));
+  }
+
+  /// \param aTest A test.
+  /// \return True if the test failed the last time it was run.
+  [[nodiscard]] inline auto lastFailed(TestCaseInfo const &aTest) const
+      -> bool {
+    Entry const *const lEntry = find(aTest);
+    return lEntry != nullptr && lEntry->mFailed;
+  }
+
+  /// Record the outcome and duration of a test from this run.
+  /// \param aResult The result of the test.
+  inline void update(TestResult const &aResult) {
+    TestCaseInfo const &lTest = *aResult.mTest;
+    mUpdated.insert(key(lTest));
+    insert(key(lTest),
+           Entry{!aResult.mSuccess,
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     aResult.mDuration)
+                     .count(),
+                 lTest.mLine});
+  }
+};
+
+/// Order tests longest first by their previously recorded duration. Tests
+/// without a recorded duration go first since they may be long. The sort is
+/// stable so tests with equal or unknown duration keep their given order.
+/// With --failed-first, tests which failed last time go before all others.
+/// \param aTests The tests to order.
+/// \param aState Previously recorded durations and outcomes.
+/// \return The tests in scheduling order.
+[[nodiscard]] inline auto longestFirst(std::vector<TestCaseInfo const *> aTests,
+                                       TestState const &aState)
+    -> std::vector<TestCaseInfo const *> {
+  std::vector<std::pair<std::optional<TimeDelta>, TestCaseInfo const *>> lKeyed;
+  lKeyed.reserve(aTests.size());
+  for (TestCaseInfo const *const lTest : aTests) {
+    lKeyed.emplace_back(aState.duration(*lTest), lTest);
+  }
+  std::ranges::stable_sort(lKeyed, [](auto const &aLeft, auto const &aRight) {
+    if (!aLeft.first.has_value() || !aRight.first.has_value()) {
+      return !aLeft.first.has_value() && aRight.first.has_value();
+    }
+    return *aLeft.first > *aRight.first;
+  });
+  for (std::size_t i = 0; i < lKeyed.size(); ++i) {
+    aTests[i] = lKeyed[i].second;
+  }
+  if (gCmdArgs.failedFirst()) {
+    std::ranges::stable_partition(aTests, [&aState](TestCaseInfo const *aTest) {
+      return aState.lastFailed(*aTest);
+    });
+  }
+  return aTests;
+}
+
+/// \brief Per worker queues of tests to run. Each worker takes tests from the
+/// front of its own queue and when empty, steals from the back of another.
+/// With tests dealt out longest first, owners run their longest remaining
+/// tests while idle workers take the shortest ones from the others, so the
+/// work still queued at the end of a run is kept small.
+class WorkStealingQueues final {
+private:
+  /// \brief A queue and the lock for it, kept on separate cache lines.
+  struct alignas(64) WorkerQueue final {
+    std::mutex mMutex;
+    std::deque<TestCaseInfo const *> mTests;
+  };
+  std::vector<WorkerQueue> mQueues;
+
+public:
+  WorkStealingQueues() = delete;
+  WorkStealingQueues(WorkStealingQueues const &) = delete;
+  WorkStealingQueues(WorkStealingQueues &&) = delete;
+  WorkStealingQueues &operator=(WorkStealingQueues const &) = delete;
+  WorkStealingQueues &operator=(WorkStealingQueues &&) = delete;
+
+  /// Deal tests round robin to the workers in the given order.
+  /// \param aTests Tests in scheduling order.
+  /// \param aWorkers Number of workers, at least 1.
+  inline WorkStealingQueues(std::vector<TestCaseInfo const *> const &aTests,
+                            std::size_t aWorkers)
+      : mQueues(aWorkers) {
+    for (std::size_t i = 0; i < aTests.size(); ++i) {
+      mQueues[i % aWorkers].mTests.push_back(aTests[i]);
+    }
+  }
+
+  /// Take the next test for a worker.
+  /// \param aWorker Index of the worker.
+  /// \return The next test, or nullptr if no tests remain in any queue.
+  [[nodiscard]] inline auto pop(std::size_t aWorker) -> TestCaseInfo const * {
+    {
+      WorkerQueue &lOwn = mQueues[aWorker];
+      std::lock_guard const lLock(lOwn.mMutex);
+      if (!lOwn.mTests.empty()) {
+        TestCaseInfo const *const lTest = lOwn.mTests.front();
+        lOwn.mTests.pop_front();
+        return lTest;
+      }
+    }
+    for (std::size_t i = 1; i < mQueues.size(); ++i) {
+      WorkerQueue &lVictim = mQueues[(aWorker + i) % mQueues.size()];
+      std::lock_guard const lLock(lVictim.mMutex);
+      if (!lVictim.mTests.empty()) {
+        TestCaseInfo const *const lTest = lVictim.mTests.back();
+        lVictim.mTests.pop_back();
+        return lTest;
+      }
+    }
+    return nullptr;
+  }
+};
+
+/// \brief Counts and benchmark results of tests run by \c runTests .
+struct RunCounts final {
+  std::size_t mRun = 0;
+  std::size_t mSuccess = 0;
+  std::size_t mFailed = 0;
+  /// Results of the benchmarks which were run.
+  BenchmarkBaseline mBenchmarks;
+  /// Duration of each test which was run, for listing the slowest.
+  std::vector<std::pair<TimeDelta, TestCaseInfo const *>> mDurations;
+  /// Each test which failed with how it failed, for the summary.
+  std::vector<std::pair<TestCaseInfo const *, std::string>> mFailures;
+  /// Stack samples of each profiled test (--profile).
+  std::vector<std::pair<TestCaseInfo const *, ProfileSamples>> mProfiles;
+};
+
+/// Write the slowest tests of a run.
+/// \param aCounts Counts of the run.
+/// \param aNumber Maximum number of tests to list.
+inline void reportSlowest(RunCounts const &aCounts, std::size_t aNumber) {
+  std::vector<std::pair<TimeDelta, TestCaseInfo const *>> lSlowest =
+      aCounts.mDurations;
+  std::size_t const lShown = std::min(aNumber, lSlowest.size());
+  if (lShown == 0) {
+    return;
+  }
+  std::ranges::partial_sort(
+      lSlowest, lSlowest.begin() + static_cast<std::ptrdiff_t>(lShown),
+      std::ranges::greater{},
+      &std::pair<TimeDelta, TestCaseInfo const *>::first);
+  ReportBlock const lBlock;
+  infoWriteLine(std::format("Slowest {} tests:", lShown));
+  for (std::size_t i = 0; i < lShown; ++i) {
+    auto const &[lDuration, lTest] = lSlowest[i];
+    auto const lBudget = gCmdArgs.budgets().find(*lTest);
+    infoWriteLine(std::format(
+        "  {:>10} {}:{}{}", secondsString(lDuration), lTest->mFile,
+        lTest->mName,
+        lBudget.has_value() && lDuration > lBudget->mLimit
+            ? " (over budget)"
+            : ""));
+  }
+}
+
+#if TKOZ_SRTEST_HAS_PROFILER
+/// Write the hottest symbols of each profiled test and, if a file is given,
+/// the folded stacks of all of them for flame graph tools, one line
+/// "file:name;outer;...;inner count" per distinct stack. Symbols are named
+/// only now since it is too slow while sampling. Worker processes of
+/// --isolate are forked from this process, so their addresses name the same
+/// code here.
+/// \param aCounts Counts of the run.
+/// \param aTop Maximum number of symbols listed for each test.
+/// \param aFoldedPath File for the folded stacks, empty for none.
+inline void reportProfiles(RunCounts const &aCounts, std::size_t aTop,
+                           std::string const &aFoldedPath) {
+  using namespace internal;
+  if (aCounts.mProfiles.empty()) {
+    return;
+  }
+  std::vector<std::pair<TestCaseInfo const *, ProfileSamples const *>>
+      lProfiles;
+  for (auto const &[lTest, lSamples] : aCounts.mProfiles) {
+    // Tests shorter than the sampling period need not have any
+    if (!lSamples.mDepths.empty() || lSamples.mLost > 0) {
+      lProfiles.emplace_back(lTest, &lSamples);
+    }
+  }
+  std::ranges::sort(lProfiles, [](auto const &aLeft, auto const &aRight) {
+    return *aLeft.first < *aRight.first;
+  });
+  struct Heat final {
+    std::string const *mName = nullptr;
+    std::uint64_t mSelf = 0;
+    std::uint64_t mTotal = 0;
+  };
+  Symbolizer lSymbolizer;
+  std::string lFolded;
+  ReportBlock const lBlock;
+  infoWriteLine(std::format("Profiled {} tests, {} with samples at {} Hz of "
+                            "test thread CPU time:",
+                            aCounts.mProfiles.size(), lProfiles.size(),
+                            gCmdArgs.profileHz()));
+  for (auto const &[lTest, lSamples] : lProfiles) {
+    std::size_t const lNumSamples = lSamples->mDepths.size();
+    infoWriteLine(std::format("  {}:{}: {} samples{}", lTest->mFile,
+                              lTest->mName, lNumSamples,
+                              lSamples->mLost > 0
+                                  ? std::format(" ({} lost)", lSamples->mLost)
+                                  : ""));
+    std::unordered_map<std::string const *, Heat> lHeat;
+    std::map<std::string, std::uint64_t> lStacks;
+    std::vector<std::string const *> lNames;
+    std::size_t lOffset = 0;
+    for (std::uint32_t const lDepth : lSamples->mDepths) {
+      lNames.clear();
+      for (std::size_t i = 0; i < lDepth; ++i) {
+        lNames.push_back(
+            &lSymbolizer.name(lSamples->mFrames[lOffset + i], i == 0));
+      }
+      lOffset += lDepth;
+      ++lHeat[lNames.front()].mSelf;
+      for (std::size_t i = 0; i < lNames.size(); ++i) {
+        // Recursive functions count once per sample
+        auto const lOuter = lNames.begin() + static_cast<std::ptrdiff_t>(i);
+        if (std::find(lNames.begin(), lOuter, lNames[i]) == lOuter) {
+          ++lHeat[lNames[i]].mTotal;
+        }
+      }
+      if (!aFoldedPath.empty()) {
+        std::string lStack = std::format("{}:{}", lTest->mFile, lTest->mName);
+        for (std::string const *const lName : lNames | std::views::reverse) {
+          lStack.push_back(';');
+          lStack += *lName;
+        }
+        ++lStacks[std::move(lStack)];
+      }
+    }
+    for (auto const &[lStack, lCount] : lStacks) {
+      std::format_to(std::back_inserter(lFolded), "{} {}\n", lStack, lCount);
+    }
+    std::vector<Heat> lHottest;
+    for (auto const &[lName, lEntry] : lHeat) {
+      lHottest.push_back({lName, lEntry.mSelf, lEntry.mTotal});
+    }
+    std::size_t const lShown = std::min(aTop, lHottest.size());
+    std::ranges::partial_sort(
+        lHottest, lHottest.begin() + static_cast<std::ptrdiff_t>(lShown),
+        [](Heat const &aLeft, Heat const &aRight) {
+          return std::tie(aLeft.mSelf, aLeft.mTotal) >
+                 std::tie(aRight.mSelf, aRight.mTotal);
+        });
+    if (lShown > 0) {
+      infoWriteLine("      self   total  symbol");
+    }
+    for (std::size_t i = 0; i < lShown; ++i) {
+      auto const fPercent = [lNumSamples](std::uint64_t aCount) {
+        return 100.0 * static_cast<double>(aCount) /
+               static_cast<double>(lNumSamples);
+      };
+      infoWriteLine(std::format("    {:>5.1f}% {:>5.1f}%  {}",
+                                fPercent(lHottest[i].mSelf),
+                                fPercent(lHottest[i].mTotal),
+                                *lHottest[i].mName));
+    }
+  }
+  if (!aFoldedPath.empty()) {
+    std::ofstream lFile(aFoldedPath, std::ios::trunc);
+    lFile << lFolded;
+    if (!lFile.flush()) {
+      infoWriteLine("Failed to write folded stacks: ", aFoldedPath);
+    }
+  }
+}
+#endif
+
+/// \brief Watches running tests from a separate thread. It warns while a
+/// test runs past its budget, which shows which test is hanging. Without
+/// --isolate a test which runs past --timeout can not be stopped, so the
+/// watchdog reports it and exits the process. Worker processes of --isolate
+/// are killed by the parent instead.
+class Watchdog final {
+private:
+  struct Running final {
+    std::uint64_t mId = 0;
+    TestCaseInfo const *mTest = nullptr;
+    TimePoint mStart;
+    bool mWarned = false;
+  };
+
+  static constexpr auto cInterval = std::chrono::milliseconds(50);
+  std::mutex mMutex;
+  std::condition_variable_any mWake;
+  std::vector<Running> mRunning;
+  std::uint64_t mNextId = 0;
+  bool mEnforceTimeout = false;
+  std::function<void(TestCaseInfo const &, TimeDelta)> mOnTimeout;
+  std::jthread mThread;
+
+  inline void checkLocked(TimePoint aNow) {
+    for (Running &lRunning : mRunning) {
+      TimeDelta const lElapsed = aNow - lRunning.mStart;
+      TestCaseInfo const &lTest = *lRunning.mTest;
+      if (mEnforceTimeout && gCmdArgs.timeout().has_value() &&
+          lElapsed > *gCmdArgs.timeout()) {
+        infoWriteColored(cFgBRed, "Test timed out");
+        infoWriteLine(std::format(
+            ": {}:{} still running after {} (--timeout), stopping the run, use "
+            "--isolate to continue with other tests",
+            lTest.mFile, lTest.mName, secondsString(lElapsed)));
+        if (mOnTimeout) {
+          mOnTimeout(lTest, lElapsed);
+        }
+        gOutput.flush();
+        gReportOutput.flush();
+        std::_Exit(EXIT_FAILURE);
+      }
+      if (lRunning.mWarned) {
+        continue;
+      }
+      auto const lBudget = gCmdArgs.budgets().find(lTest);
+      if (lBudget.has_value() && lElapsed > lBudget->mLimit) {
+        lRunning.mWarned = true;
+        infoWriteLine(std::format(
+            "Warning: {}:{} still running after {}, budget {} ({})",
+            lTest.mFile, lTest.mName, secondsString(lElapsed),
+            secondsString(lBudget->mLimit), lBudget->mSource));
+      }
+    }
+  }
+
+public:
+  /// Start the watchdog thread.
+  /// \param aEnforceTimeout True to exit the process when a test passes
+  /// --timeout.
+  inline void start(bool aEnforceTimeout) {
+    mEnforceTimeout = aEnforceTimeout;
+    mThread = std::jthread([this](std::stop_token aStop) {
+      std::unique_lock lLock(mMutex);
+      while (!aStop.stop_requested()) {
+        static_cast<void>(
+            mWake.wait_for(lLock, aStop, cInterval, [] { return false; }));
+        checkLocked(Clock::now());
+      }
+    });
+  }
+
+  /// Set what to do before exiting the process when a test passes
+  /// --timeout, such as finishing the report.
+  /// \param aOnTimeout Called with the test and how long it ran, or empty for
+  /// nothing.
+  inline void onTimeout(
+      std::function<void(TestCaseInfo const &, TimeDelta)> aOnTimeout) {
+    std::lock_guard const lLock(mMutex);
+    mOnTimeout = std::move(aOnTimeout);
+  }
+
+  /// Stop the watchdog thread.
+  inline void stop() {
+    mThread.request_stop();
+    if (mThread.joinable()) {
+      mThread.join();
+    }
+  }
+
+  /// Watch a test which is starting.
+  /// \return Identifier to pass to \c finished .
+  [[nodiscard]] inline auto started(TestCaseInfo const &aTest)
+      -> std::uint64_t {
+    std::lock_guard const lLock(mMutex);
+    mRunning.push_back(Running{mNextId, &aTest, Clock::now(), false});
+    return mNextId++;
+  }
+
+  /// Stop watching a test.
+  /// \param aId Identifier from \c started .
+  inline void finished(std::uint64_t aId) {
+    std::lock_guard const lLock(mMutex);
+    std::erase_if(mRunning, [aId](Running const &aRunning) {
+      return aRunning.mId == aId;
+    });
+  }
+};
+
+/// The watchdog of the runner, started in \c main .
+inline Watchdog gWatchdog;
+
+/// \brief Receives test results as tests finish, to write them in some
+/// format. Methods for individual tests may be called concurrently from
+/// different threads for tests which run concurrently.
+class IReporter {
+public:
+  virtual ~IReporter() = default;
+
+  /// Called once before any test runs.
+  /// \param aNumTests Number of tests which are going to run.
+  virtual void runStarted(std::size_t aNumTests) = 0;
+
+  /// Called right before a test is started.
+  /// \param aTest The test.
+  virtual void testStarted(TestCaseInfo const &aTest) = 0;
+
+  /// Called once for each finished test.
+  /// \param aResult The result of the test.
+  virtual void testFinished(TestResult const &aResult) = 0;
+
+  /// Called once after all tests finished.
+  /// \param aCounts Counts of the tests which were run.
+  /// \param aDuration Wall time of the whole run.
+  virtual void runFinished(RunCounts const &aCounts, TimeDelta aDuration) = 0;
+};
+
+/// \brief The human readable colored output. When tests run one at a time,
+/// the line announcing a test is written before it runs so a hanging or
+/// crashing test can be identified. Otherwise each test is written as one
+/// block when it finishes.
+class ConsoleReporter final : public IReporter {
+private:
+  bool mStreamStarts;
+
+public:
+  /// \param aStreamStarts True to write tests as they start.
+  inline explicit ConsoleReporter(bool aStreamStarts) noexcept
+      : mStreamStarts(aStreamStarts) {}
+
+  inline void runStarted(std::size_t) override {}
+
+  inline void testStarted(TestCaseInfo const &aTest) override {
+    if (mStreamStarts) {
+      reportTestStart(aTest);
+    }
+  }
+
+  inline void testFinished(TestResult const &aResult) override {
+    ReportBlock const lBlock;
+    if (!mStreamStarts) {
+      reportTestStart(*aResult.mTest);
+    }
+    reportTestResult(aResult);
+  }
+
+  inline void runFinished(RunCounts const &, TimeDelta) override {}
+};
+
+namespace internal {
+
+/// Append a string as a quoted JSON string.
+inline void appendJsonString(std::string &aOut, std::string_view aText) {
+  aOut.push_back('"');
+  for (char const lChar : aText) {
+    switch (lChar) {
+    case '"':
+      aOut += "\\\"";
+      break;
+    case '\\':
+      aOut += "\\\\";
+      break;
+    case '\n':
+      aOut += "\\n";
+      break;
+    case '\r':
+      aOut += "\\r";
+      break;
+    case '\t':
+      aOut += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(lChar) < 0x20) {
+        std::format_to(std::back_inserter(aOut), "\\u{:04x}",
+                       static_cast<unsigned>(lChar));
+      } else {
+        aOut.push_back(lChar);
+      }
+    }
+  }
+  aOut.push_back('"');
+}
+
+/// Append a string escaped for XML text or attribute values. Control
+/// characters which XML 1.0 does not allow are dropped.
+inline void appendXmlEscaped(std::string &aOut, std::string_view aText) {
+  for (char const lChar : aText) {
+    switch (lChar) {
+    case '&':
+      aOut += "&amp;";
+      break;
+    case '<':
+      aOut += "&lt;";
+      break;
+    case '>':
+      aOut += "&gt;";
+      break;
+    case '"':
+      aOut += "&quot;";
+      break;
+    case '\'':
+      aOut += "&apos;";
+      break;
+    default:
+      if (static_cast<unsigned char>(lChar) >= 0x20 || lChar == '\n' ||
+          lChar == '\t' || lChar == '\r') {
+        aOut.push_back(lChar);
+      }
+    }
+  }
+}
+
+/// \return Tags of a test as a string, empty if it has none.
+[[nodiscard]] inline auto reportTagsString(TestTags aTags) -> std::string {
+  return aTags.allTags().empty() ? std::string() : testTagsString(aTags);
+}
+
+/// Call a function with each message of a result which is shown for its
+/// outcome, messages for failure only are skipped for a successful test.
+template <typename F>
+inline void forEachShownMessage(TestResult const &aResult, F &&aVisit) {
+  for (auto const &[lFailureOnly, lMessage] : aResult.mMessages) {
+    if (!aResult.mSuccess || !lFailureOnly) {
+      aVisit(lMessage);
+    }
+  }
+}
+
+/// \return Nanoseconds in a duration.
+[[nodiscard]] inline auto nanos(TimeDelta aDuration) noexcept
+    -> std::int64_t {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(aDuration)
+      .count();
+}
+
+/// Call a function with the name and value of each measured resource, for
+/// reporters which write them as flat fields.
+template <typename F>
+inline void forEachResource(ResourceUsage const &aUsage, F &&aVisit) {
+  if (aUsage.mAllocations.has_value()) {
+    aVisit("allocations", aUsage.mAllocations->mCount);
+    aVisit("allocated_bytes", aUsage.mAllocations->mBytes);
+  }
+  aVisit("peak_rss_delta_kib",
+         static_cast<std::uint64_t>(std::max<std::int64_t>(
+             aUsage.mPeakRssDeltaKiB, 0)));
+  if (aUsage.mCounters.has_value()) {
+    for (std::size_t i = 0; i < cHardwareCounterNames.size(); ++i) {
+      aVisit(cHardwareCounterNames[i], (*aUsage.mCounters)[i]);
+    }
+  }
+}
+
+/// \return A buffer for formatting a report, reused by each thread.
+[[nodiscard]] inline auto reportScratch() -> std::string & {
+  static thread_local std::string sBuffer;
+  sBuffer.clear();
+  return sBuffer;
+}
+
+} // namespace internal
+
+/// \brief JUnit XML as understood by most CI systems. The document is
+/// streamed, each test case is written when it finishes and the closing tags
+/// when the run ends. Tags are a property of each test case.
+class JUnitReporter final : public IReporter {
+private:
+  OutputSink &mSink;
+
+public:
+  /// \param aSink Where to write.
+  inline explicit JUnitReporter(OutputSink &aSink) noexcept : mSink(aSink) {}
+
+  inline void runStarted(std::size_t) override {
+    mSink.publish("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<testsuites>\n<testsuite name=\"srtest\">\n");
+  }
+
+  inline void testStarted(TestCaseInfo const &) override {}
+
+  inline void testFinished(TestResult const &aResult) override {
+    using namespace internal;
+    TestCaseInfo const &lTest = *aResult.mTest;
+    std::string &lOut = reportScratch();
+    lOut += "<testcase classname=\"";
+    appendXmlEscaped(lOut, lTest.mFile);
+    lOut += "\" name=\"";
+    appendXmlEscaped(lOut, lTest.mName);
+    std::format_to(std::back_inserter(lOut),
+                   "\" line=\"{}\" time=\"{:.9f}\">\n", lTest.mLine,
+                   std::chrono::duration<double>(aResult.mDuration).count());
+    std::vector<std::pair<std::string_view, std::string>> lProperties;
+    if (std::string lTags = reportTagsString(lTest.mTags); !lTags.empty()) {
+      lProperties.emplace_back("tags", std::move(lTags));
+    }
+    if (aResult.mResources.has_value()) {
+      forEachResource(*aResult.mResources,
+                      [&](std::string_view aName, std::uint64_t aValue) {
+                        lProperties.emplace_back(aName,
+                                                 std::to_string(aValue));
+                      });
+    }
+    if (!lProperties.empty()) {
+      lOut += "<properties>";
+      for (auto const &[lName, lValue] : lProperties) {
+        lOut += "<property name=\"";
+        appendXmlEscaped(lOut, lName);
+        lOut += "\" value=\"";
+        appendXmlEscaped(lOut, lValue);
+        lOut += "\"/>";
+      }
+      lOut += "</properties>\n";
+    }
+    if (!aResult.mSuccess) {
+      lOut += "<failure type=\"";
+      appendXmlEscaped(lOut, aResult.mFailureKind);
+      lOut += "\" message=\"";
+      appendXmlEscaped(lOut, aResult.mFailureMessage.value_or(""));
+      lOut += "\">";
+      appendXmlEscaped(lOut, aResult.mFailureMessage.value_or(""));
+      lOut += "</failure>\n";
+    }
+    bool lHasOutput = false;
+    forEachShownMessage(aResult, [&](std::string const &aMessage) {
+      if (!lHasOutput) {
+        lOut += "<system-out>";
+        lHasOutput = true;
+      }
+      appendXmlEscaped(lOut, aMessage);
+      lOut.push_back('\n');
+    });
+    if (lHasOutput) {
+      lOut += "</system-out>\n";
+    }
+    lOut += "</testcase>\n";
+    mSink.publish(lOut);
+  }
+
+  inline void runFinished(RunCounts const &, TimeDelta) override {
+    mSink.publish("</testsuite>\n</testsuites>\n");
+  }
+};
+
+/// \brief One JSON object per line: a "run_start" event, a "test" event for
+/// each finished test and a "run_end" event with the counts.
+class JsonLinesReporter final : public IReporter {
+private:
+  OutputSink &mSink;
+
+public:
+  /// \param aSink Where to write.
+  inline explicit JsonLinesReporter(OutputSink &aSink) noexcept
+      : mSink(aSink) {}
+
+  inline void runStarted(std::size_t aNumTests) override {
+    mSink.publish(
+        std::format("{{\"event\":\"run_start\",\"tests\":{}}}\n", aNumTests));
+  }
+
+  inline void testStarted(TestCaseInfo const &) override {}
+
+  inline void testFinished(TestResult const &aResult) override {
+    using namespace internal;
+    TestCaseInfo const &lTest = *aResult.mTest;
+    std::string &lOut = reportScratch();
+    auto lIter = std::back_inserter(lOut);
+    lOut += "{\"event\":\"test\",\"file\":";
+    appendJsonString(lOut, lTest.mFile);
+    lOut += ",\"name\":";
+    appendJsonString(lOut, lTest.mName);
+    std::format_to(lIter, ",\"line\":{},\"tags\":", lTest.mLine);
+    appendJsonString(lOut, reportTagsString(lTest.mTags));
+    std::format_to(lIter, ",\"success\":{},\"duration_ns\":{},\"messages\":[",
+                   aResult.mSuccess, nanos(aResult.mDuration));
+    bool lFirst = true;
+    forEachShownMessage(aResult, [&](std::string const &aMessage) {
+      if (!lFirst) {
+        lOut.push_back(',');
+      }
+      lFirst = false;
+      appendJsonString(lOut, aMessage);
+    });
+    lOut.push_back(']');
+    if (!aResult.mSuccess) {
+      lOut += ",\"failure\":{\"kind\":";
+      appendJsonString(lOut, aResult.mFailureKind);
+      lOut += ",\"message\":";
+      if (aResult.mFailureMessage.has_value()) {
+        appendJsonString(lOut, *aResult.mFailureMessage);
+      } else {
+        lOut += "null";
+      }
+      lOut.push_back('}');
+    }
+    if (aResult.mBenchmark.has_value()) {
+      BenchmarkStats const &lStats = *aResult.mBenchmark;
+      std::format_to(lIter,
+                     ",\"benchmark\":{{\"iterations\":{},\"repetitions\":{},"
+                     "\"median_ns\":{},\"min_ns\":{},\"max_ns\":{}}}",
+                     lStats.mIterations, lStats.mNanosPerOp.size(),
+                     lStats.median(), lStats.min(), lStats.max());
+    }
+    if (aResult.mResources.has_value()) {
+      lOut += ",\"resources\":{";
+      bool lFirstResource = true;
+      forEachResource(*aResult.mResources,
+                      [&](std::string_view aName, std::uint64_t aValue) {
+                        std::format_to(lIter, "{}\"{}\":{}",
+                                       lFirstResource ? "" : ",", aName,
+                                       aValue);
+                        lFirstResource = false;
+                      });
+      lOut.push_back('}');
+    }
+    lOut += "}\n";
+    mSink.publish(lOut);
+  }
+
+  inline void runFinished(RunCounts const &aCounts,
+                          TimeDelta aDuration) override {
+    mSink.publish(std::format("{{\"event\":\"run_end\",\"run\":{},"
+                              "\"passed\":{},\"failed\":{},"
+                              "\"duration_ns\":{}}}\n",
+                              aCounts.mRun, aCounts.mSuccess, aCounts.mFailed,
+                              internal::nanos(aDuration)));
+  }
+};
+
+/// \brief Test Anything Protocol version 13. Tests are numbered in the order
+/// they finish and the plan is written at the end since a run stops early on
+/// a failure. Messages are diagnostic lines before each result and failures
+/// have a YAML block.
+class TapReporter final : public IReporter {
+private:
+  OutputSink &mSink;
+  std::mutex mMutex;
+  std::size_t mNumber = 0;
+
+public:
+  /// \param aSink Where to write.
+  inline explicit TapReporter(OutputSink &aSink) noexcept : mSink(aSink) {}
+
+  inline void runStarted(std::size_t) override {
+    mSink.publish("TAP version 13\n");
+  }
+
+  inline void testStarted(TestCaseInfo const &) override {}
+
+  inline void testFinished(TestResult const &aResult) override {
+    using namespace internal;
+    TestCaseInfo const &lTest = *aResult.mTest;
+    std::string &lOut = reportScratch();
+    forEachShownMessage(aResult, [&](std::string const &aMessage) {
+      std::string_view lRest = aMessage;
+      while (true) {
+        std::size_t const lEnd = lRest.find('\n');
+        lOut += "# ";
+        lOut += lRest.substr(0, lEnd);
+        lOut.push_back('\n');
+        if (lEnd == std::string_view::npos) {
+          break;
+        }
+        lRest.remove_prefix(lEnd + 1);
+      }
+    });
+    if (aResult.mResources.has_value()) {
+      lOut += "# Resources: ";
+      lOut += resourcesString(*aResult.mResources);
+      lOut.push_back('\n');
+    }
+    // Numbers must be in output order
+    std::lock_guard const lLock(mMutex);
+    std::format_to(std::back_inserter(lOut), "{} {} - {}:{}\n",
+                   aResult.mSuccess ? "ok" : "not ok", ++mNumber, lTest.mFile,
+                   lTest.mName);
+    if (!aResult.mSuccess) {
+      lOut += "  ---\n  kind: ";
+      appendJsonString(lOut, aResult.mFailureKind);
+      lOut += "\n  message: ";
+      appendJsonString(lOut, aResult.mFailureMessage.value_or(""));
+      std::format_to(std::back_inserter(lOut),
+                     "\n  line: {}\n  duration_ms: {:.3f}\n  ...\n",
+                     lTest.mLine,
+                     std::chrono::duration<double, std::milli>(
+                         aResult.mDuration)
+                         .count());
+    }
+    mSink.publish(lOut);
+  }
+
+  inline void runFinished(RunCounts const &aCounts, TimeDelta) override {
+    mSink.publish(std::format("1..{}\n", aCounts.mRun));
+  }
+};
+
+/// Create the reporter selected with --reporter.
+/// \param aKind The reporter.
+/// \param aStreamStarts For the console, true to write tests as they start.
+/// \param aSink Where non console reporters write.
+[[nodiscard]] inline auto makeReporter(ReporterKind aKind, bool aStreamStarts,
+                                       OutputSink &aSink)
+    -> std::unique_ptr<IReporter> {
+  switch (aKind) {
+  case ReporterKind::JUNIT:
+    return std::make_unique<JUnitReporter>(aSink);
+  case ReporterKind::JSONL:
+    return std::make_unique<JsonLinesReporter>(aSink);
+  case ReporterKind::TAP:
+    return std::make_unique<TapReporter>(aSink);
+  case ReporterKind::CONSOLE:
+    break;
+  }
+  return std::make_unique<ConsoleReporter>(aStreamStarts);
+}
+
+/// Write a list of tests without running them. The text format has one line
+/// "line tags file:name" per test, with tags separated by commas or "-" for
+/// none, in the style of the state file so the path can be taken from the
+/// end of the line. The JSON format is a single object with a "tests" array.
+/// \param aTests The tests to list.
+/// \param aFormat The format.
+/// \param aSink Where to write.
+inline void listTests(std::vector<TestCaseInfo const *> const &aTests,
+                      ListFormat aFormat, OutputSink &aSink) {
+  using namespace internal;
+  std::string lOut;
+  auto lIter = std::back_inserter(lOut);
+  if (aFormat == ListFormat::TEXT) {
+    for (TestCaseInfo const *const lTest : aTests) {
+      std::string const lTags = reportTagsString(lTest->mTags);
+      std::format_to(lIter, "{} {} {}:{}\n", lTest->mLine,
+                     lTags.empty() ? "-" : lTags, lTest->mFile, lTest->mName);
+    }
+  } else {
+    lOut += "{\"tests\":[";
+    for (std::size_t i = 0; i < aTests.size(); ++i) {
+      TestCaseInfo const &lTest = *aTests[i];
+      lOut += i == 0 ? "\n{\"file\":" : ",\n{\"file\":";
+      appendJsonString(lOut, lTest.mFile);
+      lOut += ",\"name\":";
+      appendJsonString(lOut, lTest.mName);
+      std::format_to(lIter, ",\"line\":{},\"tags\":[", lTest.mLine);
+      auto const lTags = lTest.mTags.allTags();
+      for (std::size_t j = 0; j < lTags.size(); ++j) {
+        if (j > 0) {
+          lOut.push_back(',');
+        }
+        appendJsonString(lOut, TestTags::tagString(lTags[j]));
+      }
+      lOut += "]}";
+    }
+    lOut += "\n]}\n";
+  }
+  aSink.publish(lOut);
+}
+
+/// Run tests and report their results. With a single job, tests run in order
+/// on the calling thread. Otherwise tests are scheduled longest first on work
+/// stealing queues of a pool of worker threads and each finished test is
+/// reported as it finishes, so the output of concurrent tests is never
+/// interleaved. Benchmarks (the BENCH tag) are kept out of the pool and run
+/// one at a time after it drains, so other tests do not disturb their timing.
+/// No new tests are started after the first failure unless
+/// \c aContinueOnFailure is set.
+/// \param aTests The tests to run.
+/// \param aJobs Maximum number of tests to run concurrently.
+/// \param aState State for scheduling, updated with this run.
+/// \param aReporter Receives the results.
+/// \param aContinueOnFailure True to run all tests even if some fail.
+/// \return Counts of tests which were run.
+inline auto runTests(std::vector<TestCaseInfo const *> const &aTests,
+                     std::size_t aJobs, TestState &aState,
+                     IReporter &aReporter, bool aContinueOnFailure)
+    -> RunCounts {
+  RunCounts lCounts;
+  auto const fCount = [&lCounts, &aState](TestResult const &aResult) {
+    ++lCounts.mRun;
+    ++(aResult.mSuccess ? lCounts.mSuccess : lCounts.mFailed);
+    if (!aResult.mSuccess) {
+      lCounts.mFailures.emplace_back(aResult.mTest, aResult.mFailureKind);
+    }
+    aState.update(aResult);
+    if (aResult.mBenchmark.has_value()) {
+      lCounts.mBenchmarks.update(*aResult.mTest, *aResult.mBenchmark);
+    }
+    lCounts.mDurations.emplace_back(aResult.mDuration, aResult.mTest);
+    if (aResult.mProfile.has_value()) {
+      lCounts.mProfiles.emplace_back(aResult.mTest, *aResult.mProfile);
+    }
+  };
+  auto const fRun = [](TestCaseInfo const &aTest) {
+    std::uint64_t const lWatchId = gWatchdog.started(aTest);
+    TestResult lResult = runTestCase(aTest);
+    gWatchdog.finished(lWatchId);
+    return lResult;
+  };
+  std::mutex lCountMutex;
+  TimePoint const lRunStart = Clock::now();
+  // The process exits when a test passes --timeout, so count the test as
+  // failed and finish the report and state first.
+  gWatchdog.onTimeout([&](TestCaseInfo const &aTest, TimeDelta aElapsed) {
+    TestResult lResult;
+    lResult.mTest = &aTest;
+    lResult.mDuration = aElapsed;
+    lResult.mFailureKind = "Test timed out";
+    lResult.mFailureMessage = std::format("still running after {} (--timeout)",
+                                          secondsString(aElapsed));
+    aReporter.testFinished(lResult);
+    std::lock_guard const lLock(lCountMutex);
+    fCount(lResult);
+    aReporter.runFinished(lCounts, Clock::now() - lRunStart);
+    if (!gCmdArgs.stateFile().empty() && !aState.save(gCmdArgs.stateFile())) {
+      infoWriteLine("Failed to write state file: ", gCmdArgs.stateFile());
+    }
+  });
+  struct ClearOnTimeout final {
+    ~ClearOnTimeout() { gWatchdog.onTimeout({}); }
+  } const lClearOnTimeout;
+
+  // Run tests in order on this thread.
+  // Returns false if stopped by a failure.
+  auto const fRunInOrder =
+      [&](std::vector<TestCaseInfo const *> const &aInOrder) -> bool {
+    for (TestCaseInfo const *const lTest : aInOrder) {
+      aReporter.testStarted(*lTest);
+      TestResult const lResult = fRun(*lTest);
+      aReporter.testFinished(lResult);
+      std::lock_guard const lLock(lCountMutex);
+      fCount(lResult);
+      if (!lResult.mSuccess && !aContinueOnFailure) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  if (aJobs <= 1 || aTests.size() <= 1) {
+    static_cast<void>(fRunInOrder(aTests));
+    return lCounts;
+  }
+
+  std::vector<TestCaseInfo const *> lPooled;
+  std::vector<TestCaseInfo const *> lBenchmarks;
+  for (TestCaseInfo const *const lTest : aTests) {
+    (lTest->mTags.hasTag(TestTags::BENCH) ? lBenchmarks : lPooled)
+        .push_back(lTest);
+  }
+  std::size_t const lNumWorkers = std::min(aJobs, lPooled.size());
+  WorkStealingQueues lQueues(longestFirst(lPooled, aState),
+                             std::max<std::size_t>(lNumWorkers, 1));
+  std::atomic<bool> lStop = false;
+  auto const fWorker = [&](std::size_t aWorker) {
+    while (!lStop.load(std::memory_order_relaxed)) {
+      TestCaseInfo const *const lTest = lQueues.pop(aWorker);
+      if (lTest == nullptr) {
+        break;
+      }
+      aReporter.testStarted(*lTest);
+      TestResult const lResult = fRun(*lTest);
+      aReporter.testFinished(lResult);
+      std::lock_guard const lLock(lCountMutex);
+      fCount(lResult);
+      if (!lResult.mSuccess && !aContinueOnFailure) {
+        lStop.store(true, std::memory_order_relaxed);
+      }
+    }
+  };
+  {
+    std::vector<std::jthread> lWorkers;
+    lWorkers.reserve(lNumWorkers);
+    for (std::size_t i = 0; i < lNumWorkers; ++i) {
+      lWorkers.emplace_back(fWorker, i);
+    }
+  } // Join all workers
+  if (!lStop.load(std::memory_order_relaxed)) {
+    static_cast<void>(fRunInOrder(lBenchmarks));
+  }
+  return lCounts;
+}
+
+#if TKOZ_SRTEST_HAS_FORK
+
+// Helpers for running tests in worker processes. The parent sends the index
+// of a test to run over a command pipe and the worker sends back a frame with
+// the serialized TestResult over a result pipe. A byte count prefixes each
+// frame. Both ends are the same executable so the native layout is used.
+namespace internal {
+
+/// Write all bytes to a file descriptor, retrying on interruption.
+/// \return False if the write failed.
+inline auto writeAll(int aFd, void const *aData, std::size_t aSize) noexcept
+    -> bool {
+  auto const *lData = static_cast<char const *>(aData);
+  while (aSize > 0) {
+    ssize_t const lWritten = ::write(aFd, lData, aSize);
+    if (lWritten < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    lData += lWritten;
+    aSize -= static_cast<std::size_t>(lWritten);
+  }
+  return true;
+}
+
+/// Read exactly the requested number of bytes, retrying on interruption.
+/// \return False on end of file or failure.
+inline auto readAll(int aFd, void *aData, std::size_t aSize) noexcept -> bool {
+  auto *lData = static_cast<char *>(aData);
+  while (aSize > 0) {
+    ssize_t const lRead = ::read(aFd, lData, aSize);
+    if (lRead < 0 && errno == EINTR) {
+      continue;
+    }
+    if (lRead <= 0) {
+      return false;
+    }
+    lData += lRead;
+    aSize -= static_cast<std::size_t>(lRead);
+  }
+  return true;
+}
+
+template <typename T>
+  requires std::is_trivially_copyable_v<T>
+inline void serializeValue(std::string &aOut, T aValue) {
+  aOut.append(reinterpret_cast<char const *>(&aValue), sizeof(T));
+}
+
+inline void serializeString(std::string &aOut, std::string_view aValue) {
+  serializeValue(aOut, static_cast<std::uint32_t>(aValue.size()));
+  aOut.append(aValue);
+}
+
+template <typename T>
+  requires std::is_trivially_copyable_v<T>
+[[nodiscard]] inline auto deserializeValue(std::string_view &aIn, T &aValue)
+    -> bool {
+  if (aIn.size() < sizeof(T)) {
+    return false;
+  }
+  std::memcpy(&aValue, aIn.data(), sizeof(T));
+  aIn.remove_prefix(sizeof(T));
+  return true;
+}
+
+[[nodiscard]] inline auto deserializeString(std::string_view &aIn,
+                                            std::string &aValue) -> bool {
+  std::uint32_t lSize = 0;
+  if (!deserializeValue(aIn, lSize) || aIn.size() < lSize) {
+    return false;
+  }
+  aValue.assign(aIn.substr(0, lSize));
+  aIn.remove_prefix(lSize);
+  return true;
+}
+
+/// Serialize a test result to the payload of a result frame.
+[[nodiscard]] inline auto serializeResult(TestResult const &aResult)
+    -> std::string {
+  std::string lOut;
+  serializeValue(lOut, static_cast<std::uint8_t>(aResult.mSuccess));
+  serializeValue(lOut,
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     aResult.mDuration)
+                     .count());
+  serializeValue(lOut, static_cast<std::uint32_t>(aResult.mMessages.size()));
+  for (auto const &[lFailureOnly, lMessage] : aResult.mMessages) {
+    serializeValue(lOut, static_cast<std::uint8_t>(lFailureOnly));
+    serializeString(lOut, lMessage);
+  }
+  serializeString(lOut, aResult.mFailureKind);
+  serializeValue(lOut, static_cast<std::uint8_t>(
+                           aResult.mFailureMessage.has_value()));
+  if (aResult.mFailureMessage.has_value()) {
+    serializeString(lOut, *aResult.mFailureMessage);
+  }
+  serializeValue(lOut,
+                 static_cast<std::uint8_t>(aResult.mBenchmark.has_value()));
+  if (aResult.mBenchmark.has_value()) {
+    serializeValue(lOut, aResult.mBenchmark->mIterations);
+    serializeValue(lOut, static_cast<std::uint32_t>(
+                             aResult.mBenchmark->mNanosPerOp.size()));
+    for (double const lNanos : aResult.mBenchmark->mNanosPerOp) {
+      serializeValue(lOut, lNanos);
+    }
+  }
+  serializeValue(lOut,
+                 static_cast<std::uint8_t>(aResult.mResources.has_value()));
+  if (aResult.mResources.has_value()) {
+    ResourceUsage const &lUsage = *aResult.mResources;
+    serializeValue(lOut, lUsage.mAllocations);
+    serializeValue(lOut, lUsage.mPeakRssDeltaKiB);
+    serializeValue(lOut, lUsage.mCounters);
+  }
+  serializeValue(lOut,
+                 static_cast<std::uint8_t>(aResult.mProfile.has_value()));
+  if (aResult.mProfile.has_value()) {
+    ProfileSamples const &lProfile = *aResult.mProfile;
+    serializeValue(lOut, lProfile.mLost);
+    serializeValue(lOut, static_cast<std::uint32_t>(lProfile.mDepths.size()));
+    for (std::uint32_t const lDepth : lProfile.mDepths) {
+      serializeValue(lOut, lDepth);
+    }
+    for (std::uintptr_t const lFrame : lProfile.mFrames) {
+      serializeValue(lOut, lFrame);
+    }
+  }
+  return lOut;
+}
+
+/// Deserialize the payload of a result frame.
+/// \return The result, or nothing if the payload is malformed.
+[[nodiscard]] inline auto deserializeResult(std::string_view aIn,
+                                            TestCaseInfo const &aTest)
+    -> std::optional<TestResult> {
+  TestResult lResult;
+  lResult.mTest = &aTest;
+  std::uint8_t lFlag = 0;
+  std::chrono::nanoseconds::rep lNanos = 0;
+  std::uint32_t lNumMessages = 0;
+  if (!deserializeValue(aIn, lFlag) || !deserializeValue(aIn, lNanos) ||
+      !deserializeValue(aIn, lNumMessages)) {
+    return std::nullopt;
+  }
+  lResult.mSuccess = lFlag != 0;
+  lResult.mDuration = std::chrono::duration_cast<TimeDelta>(
+      std::chrono::nanoseconds(lNanos));
+  for (std::uint32_t i = 0; i < lNumMessages; ++i) {
+    std::string lMessage;
+    if (!deserializeValue(aIn, lFlag) || !deserializeString(aIn, lMessage)) {
+      return std::nullopt;
+    }
+    lResult.mMessages.emplace_back(lFlag != 0, std::move(lMessage));
+  }
+  if (!deserializeString(aIn, lResult.mFailureKind) ||
+      !deserializeValue(aIn, lFlag)) {
+    return std::nullopt;
+  }
+  if (lFlag != 0) {
+    std::string lMessage;
+    if (!deserializeString(aIn, lMessage)) {
+      return std::nullopt;
+    }
+    lResult.mFailureMessage = std::move(lMessage);
+  }
+  if (!deserializeValue(aIn, lFlag)) {
+    return std::nullopt;
+  }
+  if (lFlag != 0) {
+    BenchmarkStats lStats;
+    std::uint32_t lNumSamples = 0;
+    if (!deserializeValue(aIn, lStats.mIterations) ||
+        !deserializeValue(aIn, lNumSamples)) {
+      return std::nullopt;
+    }
+    for (std::uint32_t i = 0; i < lNumSamples; ++i) {
+      double lSample = 0.0;
+      if (!deserializeValue(aIn, lSample)) {
+        return std::nullopt;
+      }
+      lStats.mNanosPerOp.push_back(lSample);
+    }
+    lResult.mBenchmark = std::move(lStats);
+  }
+  if (!deserializeValue(aIn, lFlag)) {
+    return std::nullopt;
+  }
+  if (lFlag != 0) {
+    ResourceUsage lUsage;
+    if (!deserializeValue(aIn, lUsage.mAllocations) ||
+        !deserializeValue(aIn, lUsage.mPeakRssDeltaKiB) ||
+        !deserializeValue(aIn, lUsage.mCounters)) {
+      return std::nullopt;
+    }
+    lResult.mResources = lUsage;
+  }
+  if (!deserializeValue(aIn, lFlag)) {
+    return std::nullopt;
+  }
+  if (lFlag != 0) {
+    ProfileSamples lProfile;
+    std::uint32_t lNumSamples = 0;
+    if (!deserializeValue(aIn, lProfile.mLost) ||
+        !deserializeValue(aIn, lNumSamples)) {
+      return std::nullopt;
+    }
+    std::size_t lNumFrames = 0;
+    lProfile.mDepths.resize(lNumSamples);
+    for (std::uint32_t &lDepth : lProfile.mDepths) {
+      if (!deserializeValue(aIn, lDepth)) {
+        return std::nullopt;
+      }
+      lNumFrames += lDepth;
+    }
+    lProfile.mFrames.resize(lNumFrames);
+    for (std::uintptr_t &lFrame : lProfile.mFrames) {
+      if (!deserializeValue(aIn, lFrame)) {
+        return std::nullopt;
+      }
+    }
+    lResult.mProfile = std::move(lProfile);
+  }
+  return lResult;
+}
+
+/// Main loop of a worker process. Runs tests by index until the command pipe
+/// is closed, then exits without running static destructors of the state it
+/// shares with the parent.
+[[noreturn]] inline void
+isolatedWorkerMain(int aCommandFd, int aResultFd,
+                   std::vector<TestCaseInfo const *> const &aTests) {
+#if TKOZ_SRTEST_HAS_PROFILER
+  if (gCmdArgs.profile()) {
+    gProfiler.start();
+  }
+#endif
+  std::uint64_t lIndex = 0;
+  while (readAll(aCommandFd, &lIndex, sizeof(lIndex))) {
+    std::string const lPayload =
+        serializeResult(runTestCase(*aTests.at(lIndex)));
+    std::uint32_t const lSize = static_cast<std::uint32_t>(lPayload.size());
+    std::cout.flush();
+    if (!writeAll(aResultFd, &lSize, sizeof(lSize)) ||
+        !writeAll(aResultFd, lPayload.data(), lPayload.size())) {
+      break;
+    }
+  }
+  std::cout.flush();
+  std::fflush(nullptr);
+  ::_exit(0);
+}
+
+/// Describe how a worker process ended, from a status of \c waitpid .
+[[nodiscard]] inline auto exitStatusString(int aStatus) -> std::string {
+  if (WIFSIGNALED(aStatus)) {
+    return std::format("killed by signal {} ({})", WTERMSIG(aStatus),
+                       ::strsignal(WTERMSIG(aStatus)));
+  }
+  if (WIFEXITED(aStatus)) {
+    return std::format("exited with status {}", WEXITSTATUS(aStatus));
+  }
+  return "ended unexpectedly";
+}
+
+} // namespace internal
+
+/// Run tests in worker processes and report their results. Each worker takes
+/// the next test from a queue shared through the parent, which schedules
+/// longest first like \c runTests . A worker which dies while running a test,
+/// from a crash, \c std::terminate or calling \c exit , is reported as a
+/// failure of that test and replaced by a new worker. A test fails if no
+/// worker can be started for it while none is running. Benchmarks run one at a
+/// time after the other tests, as in \c runTests . Unlike \c runTests , all
+/// tests are run even after a failure.
+/// \param aTests The tests to run.
+/// \param aJobs Number of worker processes.
+/// \param aState State for scheduling, updated with this run.
+/// \param aReporter Receives the results.
+/// \return Counts of tests which were run.
+inline auto runTestsIsolated(std::vector<TestCaseInfo const *> const &aTests,
+                             std::size_t aJobs, TestState &aState,
+                             IReporter &aReporter) -> RunCounts {
+  /// \brief State of a worker process as seen by the parent.
+  struct Worker final {
+    pid_t mPid = -1;
+    int mCommandFd = -1;
+    int mResultFd = -1;
+    /// Index into aTests of the test being run, if any
+    std::optional<std::size_t> mCurrent;
+    TimePoint mStarted;
+    std::uint64_t mWatchId = 0;
+    /// True if the worker was killed for passing --timeout
+    bool mTimedOut = false;
+    /// Bytes received which do not form a complete frame yet
+    std::string mBuffer;
+  };
+
+  RunCounts lCounts;
+  auto const fReport = [&lCounts, &aState,
+                        &aReporter](TestResult const &aResult) {
+    aReporter.testFinished(aResult);
+    lCounts.mDurations.emplace_back(aResult.mDuration, aResult.mTest);
+    ++lCounts.mRun;
+    ++(aResult.mSuccess ? lCounts.mSuccess : lCounts.mFailed);
+    if (!aResult.mSuccess) {
+      lCounts.mFailures.emplace_back(aResult.mTest, aResult.mFailureKind);
+    }
+    aState.update(aResult);
+    if (aResult.mBenchmark.has_value()) {
+      lCounts.mBenchmarks.update(*aResult.mTest, *aResult.mBenchmark);
+    }
+    if (aResult.mProfile.has_value()) {
+      lCounts.mProfiles.emplace_back(aResult.mTest, *aResult.mProfile);
+    }
+  };
+
+  // The worker processes index into the selected tests, so schedule by
+  // position in that list. Benchmarks go last and each runs alone after the
+  // other tests, so other tests do not disturb their timing.
+  std::vector<TestCaseInfo const *> lOrder = longestFirst(aTests, aState);
+  auto const fIsBenchmark = [](TestCaseInfo const *aTest) {
+    return aTest->mTags.hasTag(TestTags::BENCH);
+  };
+  std::ranges::stable_partition(
+      lOrder, [&fIsBenchmark](TestCaseInfo const *aTest) {
+        return !fIsBenchmark(aTest);
+      });
+  std::unordered_map<TestCaseInfo const *, std::size_t> lIndexOf;
+  for (std::size_t i = 0; i < aTests.size(); ++i) {
+    lIndexOf.emplace(aTests[i], i);
+  }
+  std::size_t lNextInOrder = 0;
+
+  // A write to a worker which died would otherwise kill the parent.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  std::vector<Worker> lWorkers(std::max<std::size_t>(
+      1, std::min(aJobs, aTests.size())));
+  auto const fClose = [](Worker &aWorker) {
+    ::close(aWorker.mCommandFd);
+    ::close(aWorker.mResultFd);
+    aWorker = Worker{};
+  };
+  auto const fSpawn = [&lWorkers, &aTests](Worker &aWorker) -> bool {
+    int lCommandPipe[2];
+    int lResultPipe[2];
+    if (::pipe(lCommandPipe) != 0) {
+      return false;
+    }
+    if (::pipe(lResultPipe) != 0) {
+      ::close(lCommandPipe[0]);
+      ::close(lCommandPipe[1]);
+      return false;
+    }
+    // Do not duplicate buffered output into the child
+    gOutput.flush();
+    gReportOutput.flush();
+    std::cout.flush();
+    std::fflush(nullptr);
+    pid_t const lPid = ::fork();
+    if (lPid == 0) {
+      // Pipes of other workers must be closed so they see end of file when
+      // the parent closes its ends.
+      for (Worker const &lOther : lWorkers) {
+        if (lOther.mPid > 0) {
+          ::close(lOther.mCommandFd);
+          ::close(lOther.mResultFd);
+        }
+      }
+      ::close(lCommandPipe[1]);
+      ::close(lResultPipe[0]);
+      internal::isolatedWorkerMain(lCommandPipe[0], lResultPipe[1], aTests);
+    }
+    ::close(lCommandPipe[0]);
+    ::close(lResultPipe[1]);
+    if (lPid < 0) {
+      ::close(lCommandPipe[1]);
+      ::close(lResultPipe[0]);
+      return false;
+    }
+    aWorker.mPid = lPid;
+    aWorker.mCommandFd = lCommandPipe[1];
+    aWorker.mResultFd = lResultPipe[0];
+    return true;
+  };
+  // Handle a worker which closed its result pipe, reporting its test.
+  auto const fReap = [&](Worker &aWorker) {
+    int lStatus = 0;
+    while (::waitpid(aWorker.mPid, &lStatus, 0) < 0 && errno == EINTR) {
+    }
+    if (aWorker.mCurrent.has_value()) {
+      gWatchdog.finished(aWorker.mWatchId);
+      TestResult lResult;
+      lResult.mTest = aTests[*aWorker.mCurrent];
+      lResult.mDuration = Clock::now() - aWorker.mStarted;
+      if (aWorker.mTimedOut) {
+        lResult.mFailureKind = "Test timed out";
+        lResult.mFailureMessage =
+            std::format("worker process killed after {} (--timeout)",
+                        secondsString(lResult.mDuration));
+      } else {
+        lResult.mFailureKind = "Test crashed";
+        lResult.mFailureMessage = std::format(
+            "worker process {}", internal::exitStatusString(lStatus));
+      }
+      fReport(lResult);
+    }
+    fClose(aWorker);
+  };
+
+  auto const fAnyRunning = [&lWorkers] {
+    return std::ranges::any_of(lWorkers, [](Worker const &aWorker) {
+      return aWorker.mCurrent.has_value();
+    });
+  };
+
+  while (true) {
+    // Give a test to each idle worker, starting workers as needed.
+    for (Worker &lWorker : lWorkers) {
+      while (!lWorker.mCurrent.has_value() && lNextInOrder < lOrder.size() &&
+             !(fIsBenchmark(lOrder[lNextInOrder]) && fAnyRunning())) {
+        if (lWorker.mPid <= 0 && !fSpawn(lWorker)) {
+          std::string const lError = std::strerror(errno);
+          if (fAnyRunning()) {
+            // Try again when a running test finishes
+            infoWriteLine("Failed to start a worker process: ", lError);
+            break;
+          }
+          // No worker can run the test, so it fails instead of being lost
+          TestResult lResult;
+          lResult.mTest = lOrder[lNextInOrder];
+          lResult.mFailureKind = "Test not started";
+          lResult.mFailureMessage =
+              std::format("could not start a worker process: {}", lError);
+          aReporter.testStarted(*lResult.mTest);
+          fReport(lResult);
+          ++lNextInOrder;
+          continue;
+        }
+        std::size_t const lIndex = lIndexOf.at(lOrder[lNextInOrder]);
+        std::uint64_t const lCommand = lIndex;
+        aReporter.testStarted(*aTests[lIndex]);
+        lWorker.mStarted = Clock::now();
+        if (internal::writeAll(lWorker.mCommandFd, &lCommand,
+                               sizeof(lCommand))) {
+          lWorker.mWatchId = gWatchdog.started(*aTests[lIndex]);
+          lWorker.mCurrent = lIndex;
+          ++lNextInOrder;
+        } else {
+          fReap(lWorker); // Died while idle, replace it and try again
+        }
+      }
+    }
+
+    std::vector<pollfd> lPollFds;
+    std::vector<Worker *> lPolled;
+    for (Worker &lWorker : lWorkers) {
+      if (lWorker.mCurrent.has_value()) {
+        lPollFds.push_back(pollfd{lWorker.mResultFd, POLLIN, 0});
+        lPolled.push_back(&lWorker);
+      }
+    }
+    if (lPollFds.empty()) {
+      break; // Nothing running and nothing left to start
+    }
+    // Wake up for the first test to pass --timeout
+    int lPollTimeout = -1;
+    if (gCmdArgs.timeout().has_value()) {
+      TimePoint const lNow = Clock::now();
+      TimeDelta lFirst = TimeDelta::max();
+      for (Worker const *const lWorker : lPolled) {
+        lFirst = std::min<TimeDelta>(
+            lFirst, lWorker->mStarted + *gCmdArgs.timeout() - lNow);
+      }
+      lPollTimeout = static_cast<int>(std::clamp<std::int64_t>(
+          std::chrono::ceil<std::chrono::milliseconds>(lFirst).count(), 0,
+          std::numeric_limits<int>::max()));
+    }
+    int const lNumReady =
+        ::poll(lPollFds.data(), lPollFds.size(), lPollTimeout);
+    if (lNumReady < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      infoWriteLine("Failed to wait for worker processes: ",
+                    std::strerror(errno));
+      break;
+    }
+    if (lNumReady == 0) {
+      TimePoint const lNow = Clock::now();
+      for (Worker *const lWorker : lPolled) {
+        if (lNow - lWorker->mStarted >= *gCmdArgs.timeout()) {
+          ::kill(lWorker->mPid, SIGKILL);
+          lWorker->mTimedOut = true;
+          fReap(*lWorker);
+        }
+      }
+      continue;
+    }
+
+    for (std::size_t i = 0; i < lPollFds.size(); ++i) {
+      if (lPollFds[i].revents == 0) {
+        continue;
+      }
+      Worker &lWorker = *lPolled[i];
+      char lChunk[1 << 16];
+      ssize_t const lRead = ::read(lWorker.mResultFd, lChunk, sizeof(lChunk));
+      if (lRead < 0 && errno == EINTR) {
+        continue;
+      }
+      if (lRead <= 0) {
+        fReap(lWorker);
+        continue;
+      }
+      lWorker.mBuffer.append(lChunk, static_cast<std::size_t>(lRead));
+      std::uint32_t lSize = 0;
+      if (lWorker.mBuffer.size() < sizeof(lSize)) {
+        continue;
+      }
+      std::memcpy(&lSize, lWorker.mBuffer.data(), sizeof(lSize));
+      if (lWorker.mBuffer.size() < sizeof(lSize) + lSize) {
+        continue;
+      }
+      TestCaseInfo const &lTest = *aTests[*lWorker.mCurrent];
+      std::optional<TestResult> lResult = internal::deserializeResult(
+          std::string_view(lWorker.mBuffer).substr(sizeof(lSize), lSize),
+          lTest);
+      if (!lResult.has_value()) {
+        lResult = TestResult{};
+        lResult->mTest = &lTest;
+        lResult->mFailureKind = "Test failure";
+        lResult->mFailureMessage = "malformed result from worker process";
+      }
+      gWatchdog.finished(lWorker.mWatchId);
+      fReport(*lResult);
+      lWorker.mBuffer.clear();
+      lWorker.mCurrent.reset();
+    }
+  }
+
+  // Closing the command pipes tells idle workers to exit.
+  for (Worker &lWorker : lWorkers) {
+    if (lWorker.mPid > 0) {
+      ::close(lWorker.mCommandFd);
+      ::close(lWorker.mResultFd);
+      while (::waitpid(lWorker.mPid, nullptr, 0) < 0 && errno == EINTR) {
+      }
+    }
+  }
+  return lCounts;
+}
+
+#endif // TKOZ_SRTEST_HAS_FORK
+
+} // namespace tkoz::srtest
+// End of definitions for things the main runner uses
+
+int main(int argc, char **argv) {
+  using namespace tkoz::srtest;
+  gCmdArgs.parse(argc, argv);
 
   if (gCmdArgs.failure()) {
     infoWriteLine("Failed to parse arguments: ", gCmdArgs.failureMessage());
@@ -821,7 +5377,13 @@ int main(int argc, char **argv) {
     gCmdArgs.printHelp(gInfoStream);
     return 1;
   }
+  installFatalSignalHandlers();
+  installForkHandlers();
+  gOutput.startFlusher();
 
+  // Static registration is done, put the tests in their canonical order once
+  // so the index and everything else can use them in place.
+  tkoz::srtest::TestRegistry::instance().sort();
   auto const &sRegistry = tkoz::srtest::TestRegistry::instance();
   auto const &sAllTests = sRegistry.allTests();
 
@@ -829,104 +5391,168 @@ int main(int argc, char **argv) {
                        "TKoz SRTest -- Statically Registered Test Library");
   infoWriteLine(std::format("Found {} registered tests", sAllTests.size()));
 
-  auto lSelectedTests = testsToRun(gCmdArgs.paths());
+  TestIndex const lIndex(sRegistry);
+  // Listing without paths shows every test, running without paths runs none
+  auto lSelectedTests = gCmdArgs.list() && gCmdArgs.paths().empty()
+                            ? lIndex.tests()
+                            : lIndex.select(gCmdArgs.paths());
+  if (!gCmdArgs.tagExpression().empty()) {
+    std::erase_if(lSelectedTests, [](TestCaseInfo const *aTest) {
+      return !gCmdArgs.tagFilter().matches(aTest->mTags);
+    });
+  }
+  if (gCmdArgs.list()) {
+    listTests(lSelectedTests, gCmdArgs.listFormat(), gReportOutput);
+    return 0;
+  }
   infoWriteLine(std::format("Selected {} tests to run", lSelectedTests.size()));
 
-  std::size_t lNumRun = 0;
-  std::size_t lNumSuccess = 0;
-  std::size_t lNumFailed = 0;
-
-  // We should have a monotonicity guarantee for timing performance so it is
-  // better to use steady_clock instead of high_resolution_clock.
-  using Clock = std::chrono::steady_clock;
-  static_assert(Clock::is_steady);
-  using TimePoint = decltype(Clock::now());
-  using TimeDelta =
-      decltype(std::declval<TimePoint>() - std::declval<TimePoint>());
-  auto const fTimingsString = [](TimeDelta const &t) -> std::string {
-    using namespace std::chrono;
-    return std::format("{} / {} / {}", duration_cast<milliseconds>(t),
-                       duration_cast<microseconds>(t),
-                       duration_cast<nanoseconds>(t));
-  };
+  TestState lState;
+  if (!gCmdArgs.stateFile().empty()) {
+    lState.load(gCmdArgs.stateFile());
+  }
+  if (gCmdArgs.lastFailed()) {
+    std::vector<TestCaseInfo const *> lFailed;
+    std::ranges::copy_if(
+        lSelectedTests, std::back_inserter(lFailed),
+        [&lState](TestCaseInfo const *aTest) {
+          return lState.lastFailed(*aTest);
+        });
+    if (lFailed.empty()) {
+      infoWriteLine("No selected tests failed last time, running all");
+    } else {
+      infoWriteLine(std::format("Running {} tests which failed last time",
+                                lFailed.size()));
+      lSelectedTests = std::move(lFailed);
+    }
+  }
+  if (gCmdArgs.failedFirst()) {
+    std::ranges::stable_partition(lSelectedTests,
+                                  [&lState](TestCaseInfo const *aTest) {
+                                    return lState.lastFailed(*aTest);
+                                  });
+  }
+  if (gCmdArgs.shardCount() > 1) {
+    lSelectedTests = shardTests(std::move(lSelectedTests),
+                                gCmdArgs.shardIndex(), gCmdArgs.shardCount());
+    infoWriteLine(std::format("Running {} tests in shard {}/{}",
+                              lSelectedTests.size(), gCmdArgs.shardIndex(),
+                              gCmdArgs.shardCount()));
+  }
 
-  for (auto const &lTest : lSelectedTests) {
-    infoWriteColored(tkoz::srtest::cFgBBlue, "Running");
+  if (gCmdArgs.isolate()) {
     infoWriteLine(
-        std::format(" {}:{} ({}, line {})", lTest->mFile, lTest->mName,
-                    tkoz::srtest::testTagsString(lTest->mTags), lTest->mLine));
-    tkoz::srtest::clearMessages();
-
-    bool lSuccess = false;
-    TimePoint lTimeStart;
-    TimePoint lTimeFinish;
-    std::optional<std::string> lFailureMessage;
-    try {
-      lTimeStart = Clock::now();
-      lTest->run();
-      lTimeFinish = Clock::now();
-      lSuccess = true;
-    } catch (tkoz::srtest::TestFailure const &exc) {
-      lFailureMessage =
-          std::format("{}Test failure{}: {}", tkoz::srtest::cFgBRed,
-                      tkoz::srtest::cFmtReset, exc.message());
-    } catch (std::exception const &exc) {
-      lFailureMessage =
-          std::format("{}Test failure{} ({}): {}", tkoz::srtest::cFgBRed,
-                      tkoz::srtest::cFmtReset,
-                      tkoz::srtest::typeName(&typeid(exc)), exc.what());
-    } catch (...) {
-#if defined(__GNUG__) || defined(__clang__)
-      std::type_info const *const lType = abi::__cxa_current_exception_type();
-#else
-      std::type_info const *const lType = nullptr;
-#endif
-      lFailureMessage =
-          std::format("{}Test failure{} ({})", tkoz::srtest::cFgBRed,
-                      tkoz::srtest::cFmtReset, tkoz::srtest::typeName(lType));
-    }
-    ++lNumRun;
-    if (lSuccess) {
-      ++lNumSuccess;
-      for (auto const &[lFailureOnly, lMessage] : tkoz::srtest::gTestMessages) {
-        if (!lFailureOnly) {
-          infoWriteLine(lMessage);
-        }
-      }
-      infoWriteColored(tkoz::srtest::cFgBGreen, "Success");
-      infoWriteLine(" (", fTimingsString(lTimeFinish - lTimeStart), ")");
-    } else {
-      lTimeFinish = Clock::now();
-      ++lNumFailed;
-      for (auto const &[lFailureOnly, lMessage] : tkoz::srtest::gTestMessages) {
-        std::ignore = lFailureOnly;
-        infoWriteLine(lMessage);
-      }
-      if (lFailureMessage.has_value()) {
-        infoWriteLine(*lFailureMessage);
-      }
-      infoWriteColored(tkoz::srtest::cFgBRed, "Failure");
-      infoWriteLine(" (", fTimingsString(lTimeFinish - lTimeStart), ")");
-      // TODO determine if we should terminate after first failure with cmd args
+        std::format("Running in {} worker processes", gCmdArgs.jobs()));
+  } else if (gCmdArgs.jobs() > 1) {
+    infoWriteLine(std::format("Running with {} jobs", gCmdArgs.jobs()));
+  }
+
+  if (!gCmdArgs.reportOut().empty()) {
+#if TKOZ_SRTEST_HAS_FORK
+    int const lFd = ::open(gCmdArgs.reportOut().c_str(),
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (lFd < 0) {
+      infoWriteLine("Failed to open report file: ", gCmdArgs.reportOut(), ": ",
+                    std::strerror(errno));
       return 1;
     }
+    gReportOutput.redirect(lFd);
+#endif
+  } else if (gCmdArgs.reportFd().has_value()) {
+    gReportOutput.redirect(*gCmdArgs.reportFd());
   }
+  if (gCmdArgs.reporter() != ReporterKind::CONSOLE) {
+    gReportOutput.startFlusher();
+  }
+  std::unique_ptr<IReporter> const lReporter = makeReporter(
+      gCmdArgs.reporter(), gCmdArgs.jobs() <= 1 && !gCmdArgs.isolate(),
+      gReportOutput);
 
+  if (!gCmdArgs.baseline().empty()) {
+    if (auto const lError = gBaseline.load(gCmdArgs.baseline())) {
+      infoWriteLine("Failed to load baseline: ", *lError);
+      return 1;
+    }
+  }
+  gWatchdog.start(!gCmdArgs.isolate());
+#if TKOZ_SRTEST_HAS_PROFILER
+  // Worker processes of --isolate start their own
+  if (gCmdArgs.profile() && !gCmdArgs.isolate()) {
+    internal::gProfiler.start();
+  }
+#endif
+  lReporter->runStarted(lSelectedTests.size());
+  TimePoint const lRunStart = Clock::now();
+#if TKOZ_SRTEST_HAS_FORK
+  RunCounts const lCounts =
+      gCmdArgs.isolate()
+          ? runTestsIsolated(lSelectedTests, gCmdArgs.jobs(), lState,
+                             *lReporter)
+          : runTests(lSelectedTests, gCmdArgs.jobs(), lState, *lReporter,
+                     gCmdArgs.continueOnFailure());
+#else
+  RunCounts const lCounts =
+      runTests(lSelectedTests, gCmdArgs.jobs(), lState, *lReporter,
+               gCmdArgs.continueOnFailure());
+#endif
+  lReporter->runFinished(lCounts, Clock::now() - lRunStart);
+  gWatchdog.stop();
+  reportSlowest(lCounts, gCmdArgs.slowest());
+#if TKOZ_SRTEST_HAS_PROFILER
+  internal::gProfiler.stop();
+  reportProfiles(lCounts, gCmdArgs.profileTop(), gCmdArgs.profileFolded());
+#endif
+  if (!gCmdArgs.stateFile().empty() && !lState.save(gCmdArgs.stateFile())) {
+    infoWriteLine("Failed to write state file: ", gCmdArgs.stateFile());
+  }
+  if (!gCmdArgs.saveBaseline().empty()) {
+    // Keep entries for benchmarks which were not run this time.
+    BenchmarkBaseline lSaved;
+    static_cast<void>(lSaved.load(gCmdArgs.saveBaseline()));
+    lSaved.merge(lCounts.mBenchmarks);
+    if (!lSaved.save(gCmdArgs.saveBaseline())) {
+      infoWriteLine("Failed to write baseline: ", gCmdArgs.saveBaseline());
+    }
+  }
   // Results
-  infoWriteLine(std::format("Completed running {} tests", lNumRun));
+  infoWriteLine(std::format("Completed running {} tests", lCounts.mRun));
   infoWriteColored(tkoz::srtest::cFgBGreen, "Successes");
-  infoWriteLine(": ", lNumSuccess);
-  if (lNumFailed > 0) {
+  infoWriteLine(": ", lCounts.mSuccess);
+  if (lCounts.mFailed > 0) {
     infoWriteColored(tkoz::srtest::cFgBRed, "Failures");
   } else {
     infoWrite("Failures");
   }
-  infoWriteLine(": ", lNumFailed);
+  infoWriteLine(": ", lCounts.mFailed);
+  if (!lCounts.mFailures.empty()) {
+    auto lFailures = lCounts.mFailures;
+    std::ranges::sort(lFailures, [](auto const &aLeft, auto const &aRight) {
+      return *aLeft.first < *aRight.first;
+    });
+    infoWriteLine("Failed tests:");
+    for (auto const &[lTest, lKind] : lFailures) {
+      infoWriteLine(
+          std::format("  {}:{} ({})", lTest->mFile, lTest->mName, lKind));
+    }
+  }
+  if (lCounts.mRun < lSelectedTests.size()) {
+    std::size_t const lNotRun = lSelectedTests.size() - lCounts.mRun;
+    if (lCounts.mFailed > 0 && !gCmdArgs.isolate() &&
+        !gCmdArgs.continueOnFailure()) {
+      infoWriteLine(std::format("{} tests were not run after the failure, use "
+                                "-c to continue on failure",
+                                lNotRun));
+    } else {
+      infoWriteLine(std::format("{} tests were not run", lNotRun));
+    }
+  }
 
   // Give a nonzero exit code if any tests failed.
-  return lNumFailed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+  return lCounts.mFailed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 #else
 #error "SRTestMain.hpp must appear exactly once in a test runner .cpp file"
 #endif // #ifdef TKOZ_SRTEST_MAIN_INCLUDED
+
+#endif // TKOZ_SRTEST_COMPILED && !TKOZ_SRTEST_BUILDING_LIBRARY
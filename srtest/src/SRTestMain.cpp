@@ -0,0 +1,7 @@
+/// SRTest - statically registered test library
+///
+/// The test runner compiled once as the tkoz-srtest-runner library, see
+/// TKOZ_SRTEST_LIBRARY_TYPE in srtest/CMakeLists.txt. Test runners linking it
+/// get main from here.
+
+#include <tkoz/SRTestMain.hpp>
@@ -0,0 +1,381 @@
+/// SRTest - statically registered test library
+///
+/// Tests of the runner internals. Including SRTestMain.hpp makes this the
+/// whole runner, so these tests see the classes that are not in SRTest.hpp.
+
+#include <tkoz/SRTestMain.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <unistd.h> // getpid
+
+namespace {
+
+using ::tkoz::srtest::TagFilter;
+using ::tkoz::srtest::TestTags;
+
+/// \return Error from parsing a tag expression, empty if it is valid.
+auto parseError(std::string_view aExpression) -> std::string {
+  TagFilter lFilter;
+  return lFilter.parse(aExpression).value_or("");
+}
+
+/// \return Filter for a tag expression which is required to be valid.
+auto makeFilter(std::string_view aExpression) -> TagFilter {
+  TagFilter lFilter;
+  auto const lError = lFilter.parse(aExpression);
+  TEST_REQUIRE_MSG(!lError.has_value(), lError.value_or(""));
+  return lFilter;
+}
+
+constexpr TestTags cNone = TestTags::create<>();
+constexpr TestTags cFast = TestTags::create<TestTags::FAST>();
+constexpr TestTags cSlow = TestTags::create<TestTags::SLOW>();
+constexpr TestTags cBench = TestTags::create<TestTags::BENCH>();
+constexpr TestTags cFastBench =
+    TestTags::create<TestTags::FAST, TestTags::BENCH>();
+constexpr TestTags cSlowBench =
+    TestTags::create<TestTags::SLOW, TestTags::BENCH>();
+
+} // namespace
+
+TEST_CREATE(tagFilterDefaultMatchesAll) {
+  TagFilter const lFilter;
+  TEST_REQUIRE(lFilter.matches(cNone));
+  TEST_REQUIRE(lFilter.matches(cSlowBench));
+}
+
+TEST_CREATE(tagFilterPrecedence) {
+  // & binds tighter than |
+  TagFilter const lFilter = makeFilter("SLOW | FAST & BENCH");
+  TEST_REQUIRE(lFilter.matches(cSlow));
+  TEST_REQUIRE(lFilter.matches(cFastBench));
+  TEST_REQUIRE(!lFilter.matches(cFast));
+  TEST_REQUIRE(!lFilter.matches(cBench));
+  TEST_REQUIRE(!lFilter.matches(cNone));
+
+  TagFilter const lGrouped = makeFilter("(SLOW | FAST) & BENCH");
+  TEST_REQUIRE(lGrouped.matches(cSlowBench));
+  TEST_REQUIRE(lGrouped.matches(cFastBench));
+  TEST_REQUIRE(!lGrouped.matches(cSlow));
+  TEST_REQUIRE(!lGrouped.matches(cBench));
+}
+
+TEST_CREATE(tagFilterNot) {
+  TagFilter const lFilter = makeFilter("!BENCH");
+  TEST_REQUIRE(lFilter.matches(cNone));
+  TEST_REQUIRE(lFilter.matches(cFast));
+  TEST_REQUIRE(!lFilter.matches(cFastBench));
+
+  // ! binds tighter than &, and De Morgan over a group
+  TagFilter const lAnd = makeFilter("!FAST & BENCH");
+  TEST_REQUIRE(lAnd.matches(cSlowBench));
+  TEST_REQUIRE(!lAnd.matches(cFastBench));
+  TEST_REQUIRE(!lAnd.matches(cSlow));
+  TagFilter const lGroup = makeFilter("!(FAST | SLOW)");
+  TEST_REQUIRE(lGroup.matches(cBench));
+  TEST_REQUIRE(!lGroup.matches(cFast));
+  TEST_REQUIRE(!lGroup.matches(cSlowBench));
+  TagFilter const lTwice = makeFilter("!!FAST");
+  TEST_REQUIRE(lTwice.matches(cFast));
+  TEST_REQUIRE(!lTwice.matches(cSlow));
+
+  // a contradiction matches nothing
+  TagFilter const lNever = makeFilter("FAST & !FAST");
+  TEST_REQUIRE(!lNever.matches(cFast));
+  TEST_REQUIRE(!lNever.matches(cNone));
+}
+
+TEST_CREATE(tagFilterSpacesAndParentheses) {
+  TagFilter const lFilter = makeFilter("\t( ( FAST ) )&(BENCH|SLOW) ");
+  TEST_REQUIRE(lFilter.matches(cFastBench));
+  TEST_REQUIRE(!lFilter.matches(cFast));
+  TEST_REQUIRE(!lFilter.matches(cSlowBench));
+}
+
+TEST_CREATE(tagFilterErrors) {
+  TEST_REQUIRE_EQ(parseError(""), "expected a tag at position 0");
+  TEST_REQUIRE_EQ(parseError("FAST &"), "expected a tag at position 6");
+  TEST_REQUIRE_EQ(parseError("FAST | | SLOW"), "expected a tag at position 7");
+  TEST_REQUIRE_EQ(parseError("(FAST | SLOW"), "expected ')' at position 12");
+  TEST_REQUIRE_EQ(parseError("FAST)"), "unexpected ')' at position 4");
+  TEST_REQUIRE_EQ(parseError("FAST SLOW"), "unexpected 'S' at position 5");
+  TEST_REQUIRE_EQ(parseError("FAST & QUICK"), "\"QUICK\" is not a tag");
+  TEST_REQUIRE_EQ(parseError("fast"), "\"fast\" is not a tag");
+
+  // the first error is reported
+  TEST_REQUIRE_EQ(parseError("(QUICK | )"), "\"QUICK\" is not a tag");
+
+  // a failed parse keeps the previous filter
+  TagFilter lFilter = makeFilter("SLOW");
+  TEST_REQUIRE(lFilter.parse("SLOW &").has_value());
+  TEST_REQUIRE(lFilter.matches(cSlow));
+  TEST_REQUIRE(!lFilter.matches(cFast));
+}
+
+namespace {
+
+using ::tkoz::srtest::TestCaseInfo;
+using ::tkoz::srtest::TestResult;
+using ::tkoz::srtest::TestState;
+
+void noTest() {}
+
+/// \brief State file in the temporary directory, removed when destroyed.
+class TempStateFile final {
+private:
+  std::string mPath;
+
+public:
+  explicit TempStateFile(std::string_view aName)
+      : mPath((std::filesystem::temp_directory_path() /
+               std::format("srtest-state-{}-{}", getpid(), aName))
+                  .string()) {}
+  ~TempStateFile() {
+    std::error_code lError;
+    std::filesystem::remove(mPath, lError);
+    std::filesystem::remove(mPath + ".lock", lError);
+  }
+  TempStateFile(TempStateFile const &) = delete;
+  TempStateFile &operator=(TempStateFile const &) = delete;
+
+  [[nodiscard]] auto path() const -> std::string const & { return mPath; }
+
+  /// Replace the contents of the file.
+  void write(std::string_view aText) const {
+    std::ofstream(mPath, std::ios::trunc) << aText;
+  }
+
+  /// \return The contents of the file.
+  [[nodiscard]] auto read() const -> std::string {
+    std::ifstream lFile(mPath);
+    return std::string(std::istreambuf_iterator<char>(lFile), {});
+  }
+};
+
+/// \return Result of running a test for TestState::update.
+auto makeResult(TestCaseInfo const &aTest, bool aSuccess,
+                std::int64_t aNanos) -> TestResult {
+  TestResult lResult;
+  lResult.mTest = &aTest;
+  lResult.mSuccess = aSuccess;
+  lResult.mDuration = std::chrono::duration_cast<::tkoz::srtest::TimeDelta>(
+      std::chrono::nanoseconds(aNanos));
+  return lResult;
+}
+
+/// \return Recorded duration of a test in nanoseconds, -1 if unknown.
+auto nanos(TestState const &aState, TestCaseInfo const &aTest)
+    -> std::int64_t {
+  auto const lDuration = aState.duration(aTest);
+  return lDuration.has_value()
+             ? std::chrono::duration_cast<std::chrono::nanoseconds>(*lDuration)
+                   .count()
+             : -1;
+}
+
+constexpr TestCaseInfo cAlpha(noTest, "alpha", "dir/file", 10, cNone);
+constexpr TestCaseInfo cBeta(noTest, "beta", "dir/file", 20, cNone);
+constexpr TestCaseInfo cOther(noTest, "alpha", "dir/other", 10, cNone);
+// rows of a table, registered at the same line
+constexpr TestCaseInfo cRow0(noTest, "table/0", "dir/file", 30, cNone);
+constexpr TestCaseInfo cRow1(noTest, "table/1", "dir/file", 30, cNone);
+
+} // namespace
+
+TEST_CREATE(testStateRoundTrip) {
+  TempStateFile const lFile("roundTrip");
+  TestState lState;
+  lState.update(makeResult(cAlpha, true, 1500));
+  lState.update(makeResult(cBeta, false, 70));
+  TEST_REQUIRE(lState.save(lFile.path()));
+  TEST_REQUIRE(!std::filesystem::exists(
+      std::format("{}.tmp.{}", lFile.path(), getpid())));
+  TEST_REQUIRE(lFile.read().starts_with("# srtest-state v1\n"));
+
+  TestState lLoaded;
+  lLoaded.load(lFile.path());
+  TEST_REQUIRE_EQ(nanos(lLoaded, cAlpha), 1500);
+  TEST_REQUIRE_EQ(nanos(lLoaded, cBeta), 70);
+  TEST_REQUIRE(!lLoaded.lastFailed(cAlpha));
+  TEST_REQUIRE(lLoaded.lastFailed(cBeta));
+  // same name and line in another file
+  TEST_REQUIRE_EQ(nanos(lLoaded, cOther), -1);
+  TEST_REQUIRE(!lLoaded.lastFailed(cOther));
+
+  // a missing file is an empty state
+  TestState lMissing;
+  lMissing.load(lFile.path() + ".missing");
+  TEST_REQUIRE_EQ(nanos(lMissing, cAlpha), -1);
+}
+
+TEST_CREATE(testStateRename) {
+  TempStateFile const lFile("rename");
+  lFile.write("# srtest-state v1\n"
+              "fail 300 10 dir/file:oldAlpha\n"
+              "pass 40 20 dir/file:beta\n");
+  TestState lState;
+  lState.load(lFile.path());
+  // found by its line under the new name
+  TEST_REQUIRE_EQ(nanos(lState, cAlpha), 300);
+  TEST_REQUIRE(lState.lastFailed(cAlpha));
+  TEST_REQUIRE_EQ(nanos(lState, cOther), -1);
+
+  // updating under the new name drops the old one, other tests are kept
+  lState.update(makeResult(cAlpha, true, 5));
+  TEST_REQUIRE(lState.save(lFile.path()));
+  std::string const lText = lFile.read();
+  TEST_REQUIRE(lText.find("oldAlpha") == std::string::npos);
+  TEST_REQUIRE(lText.find("pass 5 10 dir/file:alpha\n") != std::string::npos);
+  TEST_REQUIRE(lText.find("pass 40 20 dir/file:beta\n") != std::string::npos);
+
+  // a later line at the same place replaces an earlier one when loading
+  lFile.write("pass 1 10 dir/file:first\n"
+              "pass 2 10 dir/file:alpha\n");
+  TestState lReloaded;
+  lReloaded.load(lFile.path());
+  TEST_REQUIRE_EQ(nanos(lReloaded, cAlpha), 2);
+  TEST_REQUIRE(lReloaded.save(lFile.path()));
+  TEST_REQUIRE(lFile.read().find("first") == std::string::npos);
+}
+
+TEST_CREATE(testStateConcurrentSaves) {
+  TempStateFile const lFile("concurrent");
+  lFile.write("# srtest-state v1\n"
+              "fail 300 10 dir/file:alpha\n"
+              "pass 40 20 dir/file:beta\n");
+  // two runs such as shards which loaded the same file, each updating
+  // different tests, keep the results of each other
+  for (int i = 0; i < 20; ++i) {
+    TestState lFirst;
+    TestState lSecond;
+    lFirst.load(lFile.path());
+    lSecond.load(lFile.path());
+    lFirst.update(makeResult(cAlpha, true, 100 + i));
+    lSecond.update(makeResult(cRow0, false, 200 + i));
+    bool lFirstSaved = false;
+    bool lSecondSaved = false;
+    {
+      std::jthread const lThread(
+          [&] { lFirstSaved = lFirst.save(lFile.path()); });
+      lSecondSaved = lSecond.save(lFile.path());
+    }
+    TEST_REQUIRE(lFirstSaved);
+    TEST_REQUIRE(lSecondSaved);
+
+    TestState lLoaded;
+    lLoaded.load(lFile.path());
+    TEST_REQUIRE_EQ(nanos(lLoaded, cAlpha), 100 + i);
+    TEST_REQUIRE(!lLoaded.lastFailed(cAlpha));
+    TEST_REQUIRE_EQ(nanos(lLoaded, cRow0), 200 + i);
+    TEST_REQUIRE(lLoaded.lastFailed(cRow0));
+    // not run by either
+    TEST_REQUIRE_EQ(nanos(lLoaded, cBeta), 40);
+  }
+}
+
+TEST_CREATE(testStateMalformedLines) {
+  TempStateFile const lFile("malformed");
+  lFile.write("# srtest-state v1\n"
+              "\n"
+              "skip 100 10 dir/file:alpha\n"
+              "pass -- 10 dir/file:alpha\n"
+              "pass 100 1x dir/file:alpha\n"
+              "pass 100  dir/file:alpha\n"
+              "pass 100 10\n"
+              "pass 100 10 \n"
+              "fail 25 20 dir/file:beta\n"
+              "fail 99 1"); // cut off before the end of the fields
+  TestState lState;
+  lState.load(lFile.path());
+  TEST_REQUIRE_EQ(nanos(lState, cAlpha), -1);
+  TEST_REQUIRE_EQ(nanos(lState, cBeta), 25);
+  TEST_REQUIRE(lState.lastFailed(cBeta));
+
+  // only the valid lines are written back
+  TEST_REQUIRE(lState.save(lFile.path()));
+  TEST_REQUIRE_EQ(lFile.read(),
+                  "# srtest-state v1\nfail 25 20 dir/file:beta\n");
+}
+
+TEST_CREATE(testStateTableRows) {
+  TempStateFile const lFile("tableRows");
+  TestState lState;
+  lState.update(makeResult(cRow0, true, 11));
+  lState.update(makeResult(cRow1, false, 22));
+  TEST_REQUIRE_EQ(nanos(lState, cRow0), 11);
+  TEST_REQUIRE_EQ(nanos(lState, cRow1), 22);
+  TEST_REQUIRE(lState.save(lFile.path()));
+
+  TestState lLoaded;
+  lLoaded.load(lFile.path());
+  TEST_REQUIRE_EQ(nanos(lLoaded, cRow0), 11);
+  TEST_REQUIRE_EQ(nanos(lLoaded, cRow1), 22);
+  TEST_REQUIRE(!lLoaded.lastFailed(cRow0));
+  TEST_REQUIRE(lLoaded.lastFailed(cRow1));
+
+  // a renamed table keeps the state of each row
+  lFile.write("pass 33 30 dir/file:oldTable/0\n"
+              "fail 44 30 dir/file:oldTable/1\n");
+  TestState lRenamed;
+  lRenamed.load(lFile.path());
+  TEST_REQUIRE_EQ(nanos(lRenamed, cRow0), 33);
+  TEST_REQUIRE_EQ(nanos(lRenamed, cRow1), 44);
+  TEST_REQUIRE(lRenamed.lastFailed(cRow1));
+}
+
+TEST_CREATE(checkFailuresKeepOperands) {
+  using ::tkoz::srtest::CheckValue;
+  using ::tkoz::srtest::gCheckFailures;
+  using ::tkoz::srtest::internal::checkValueString;
+  int const lThree = 3;
+  unsigned const lFour = 4;
+  TEST_CHECK_EQ(lThree, -7);
+  TEST_CHECK_GE(lFour, 5u);
+  TEST_CHECK_LT(2.5, 0.1);
+  TEST_CHECK_CLOSE_ABS(1.0f, 2.0f, 0.5f);
+  TEST_CHECK(lThree == 4);
+  TEST_CHECK_EQ(std::string("a"), "b");
+  // read and clear the failures so this test does not fail
+  std::size_t const lFailed = ::tkoz::srtest::checkFailureCount();
+  auto const lRecorded = gCheckFailures.mRecorded;
+  ::tkoz::srtest::clearCheckFailures();
+
+  TEST_REQUIRE_EQ(lFailed, 6);
+  TEST_REQUIRE(lRecorded[0].mLeft == CheckValue(std::int64_t{3}));
+  TEST_REQUIRE(lRecorded[0].mRight == CheckValue(std::int64_t{-7}));
+  TEST_REQUIRE(lRecorded[1].mLeft == CheckValue(std::uint64_t{4}));
+  TEST_REQUIRE(lRecorded[2].mRight == CheckValue(0.1));
+  TEST_REQUIRE(lRecorded[3].mLeft == CheckValue(1.0f));
+  TEST_REQUIRE(std::holds_alternative<std::monostate>(lRecorded[4].mLeft));
+  TEST_REQUIRE(std::holds_alternative<std::monostate>(lRecorded[5].mLeft));
+  TEST_REQUIRE_EQ(checkValueString(lRecorded[0].mRight), "-7");
+  TEST_REQUIRE_EQ(checkValueString(lRecorded[2].mRight), "0.1");
+  TEST_REQUIRE_EQ(checkValueString(lRecorded[3].mRight), "2");
+  TEST_REQUIRE_EQ(checkValueString(lRecorded[5].mRight), "?");
+}
+
+TEST_CREATE(uniformExcludesHigh) {
+  ::tkoz::srtest::SplitMix64 lRng(12345);
+  // Range of one ulp, where about half the values round up to the bound
+  float const lLowF = 1.0f;
+  float const lHighF = std::nextafter(lLowF, 2.0f);
+  ::tkoz::srtest::gen::Uniform<float> const lNarrowF{lLowF, lHighF};
+  double const lLowD = -3.0;
+  double const lHighD = std::nextafter(lLowD, 0.0);
+  ::tkoz::srtest::gen::Uniform<double> const lNarrowD{lLowD, lHighD};
+  ::tkoz::srtest::gen::Uniform<float> const lWideF{-2.0f, 5.0f};
+  for (int i = 0; i < 1000; ++i) {
+    TEST_CHECK_EQ(lNarrowF(lRng), lLowF);
+    TEST_CHECK_EQ(lNarrowD(lRng), lLowD);
+    float const lValue = lWideF(lRng);
+    TEST_CHECK_GE(lValue, -2.0f);
+    TEST_CHECK_LT(lValue, 5.0f);
+  }
+}